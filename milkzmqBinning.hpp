@@ -0,0 +1,192 @@
+/** \file milkzmqBinning.hpp
+  * \brief Binning of frames into coarser products on the server.
+  * \author milkzmq contributors
+  *
+  * History:
+  * - 2026 created
+  */
+
+//***********************************************************************//
+// Copyright 2026 the milkzmq contributors
+//
+// This file is part of milkzmq.
+//
+// milkzmq is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// milkzmq is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with milkzmq.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef milkzmqBinning_hpp
+#define milkzmqBinning_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include <ImageStreamIO/ImageStreamIO.h>
+
+namespace milkzmq
+{
+
+/// The data type of a binned frame.
+/** A mean keeps the type.  A sum is widened so that it can not overflow: 8 and 16 bit integers
+  * to 32 bits, and 32 bit integers to 64 bits.
+  *
+  * \returns the ImageStreamIO data type code of the binned frame
+  * \returns 0 if the type can not be binned
+  */
+inline
+uint8_t binnedType( uint8_t atype, ///< [in] the ImageStreamIO data type code of the frame
+                    bool mean      ///< [in] true for the mean, false for the sum
+                  )
+{
+   switch(atype)
+   {
+      case _DATATYPE_UINT8:
+      case _DATATYPE_UINT16:
+         return mean ? atype : _DATATYPE_UINT32;
+      case _DATATYPE_INT8:
+      case _DATATYPE_INT16:
+         return mean ? atype : _DATATYPE_INT32;
+      case _DATATYPE_UINT32:
+         return mean ? atype : _DATATYPE_UINT64;
+      case _DATATYPE_INT32:
+         return mean ? atype : _DATATYPE_INT64;
+      case _DATATYPE_UINT64:
+      case _DATATYPE_INT64:
+      case _DATATYPE_FLOAT:
+      case _DATATYPE_DOUBLE:
+         return atype;
+      default:
+         return 0;
+   }
+}
+
+/// Bin a region of a frame.
+/** Each bin x bin block of the region becomes one element, the sum or the mean of the block.  Rows and columns
+  * left over at the high edges are dropped.  Each row is first summed along x into an accumulator row, with
+  * contiguous inner loops which the compiler vectorizes, and the mean is formed from the accumulators at the end.
+  * Integer means are truncated toward zero.
+  */
+template<typename inT, typename outT>
+void binFrame( outT * dest,        ///< [out] the binned frame, (nx/bin) x (ny/bin)
+               const inT * src,    ///< [in] the first element of the region
+               size_t nx,          ///< [in] the width of the region
+               size_t ny,          ///< [in] the height of the region
+               size_t stride,      ///< [in] the number of elements between rows of the frame
+               uint32_t bin,       ///< [in] the binning factor
+               bool mean,          ///< [in] true for the mean, false for the sum
+               std::vector<char> & work ///< [in] working space, resized as needed
+             )
+{
+   typedef typename std::conditional<std::is_floating_point<inT>::value, double,
+                       typename std::conditional<std::is_signed<inT>::value, int64_t, uint64_t>::type>::type accT;
+
+   size_t bnx = nx/bin;
+   size_t bny = ny/bin;
+
+   work.resize(bnx*sizeof(accT));
+   accT * acc = (accT *) work.data();
+
+   for(size_t by = 0; by < bny; ++by)
+   {
+      for(size_t bx = 0; bx < bnx; ++bx) acc[bx] = 0;
+
+      for(size_t j = 0; j < bin; ++j)
+      {
+         const inT * row = src + (by*bin + j)*stride;
+
+         for(size_t i = 0; i < bin; ++i)
+         {
+            for(size_t bx = 0; bx < bnx; ++bx) acc[bx] += row[bx*bin + i];
+         }
+      }
+
+      outT * out = dest + by*bnx;
+
+      if(mean)
+      {
+         accT n = ((accT) bin)*bin;
+         for(size_t bx = 0; bx < bnx; ++bx) out[bx] = acc[bx]/n;
+      }
+      else
+      {
+         for(size_t bx = 0; bx < bnx; ++bx) out[bx] = acc[bx];
+      }
+   }
+}
+
+/// Bin a region of a frame.
+/** Dispatches to binFrame by the data type.  The binned frame has type binnedType(atype, mean).
+  *
+  * \returns 0 on success
+  * \returns -1 if the type can not be binned
+  */
+inline
+int binFrame( char * dest,          ///< [out] the binned frame, (nx/bin) x (ny/bin)
+              const char * src,     ///< [in] the first element of the region
+              uint8_t atype,        ///< [in] the ImageStreamIO data type code of the frame
+              size_t nx,            ///< [in] the width of the region
+              size_t ny,            ///< [in] the height of the region
+              size_t stride,        ///< [in] the number of elements between rows of the frame
+              uint32_t bin,         ///< [in] the binning factor
+              bool mean,            ///< [in] true for the mean, false for the sum
+              std::vector<char> & work ///< [in] working space, resized as needed
+            )
+{
+   switch(atype)
+   {
+      case _DATATYPE_UINT8:
+         if(mean) binFrame((uint8_t *) dest, (const uint8_t *) src, nx, ny, stride, bin, mean, work);
+         else binFrame((uint32_t *) dest, (const uint8_t *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      case _DATATYPE_INT8:
+         if(mean) binFrame((int8_t *) dest, (const int8_t *) src, nx, ny, stride, bin, mean, work);
+         else binFrame((int32_t *) dest, (const int8_t *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      case _DATATYPE_UINT16:
+         if(mean) binFrame((uint16_t *) dest, (const uint16_t *) src, nx, ny, stride, bin, mean, work);
+         else binFrame((uint32_t *) dest, (const uint16_t *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      case _DATATYPE_INT16:
+         if(mean) binFrame((int16_t *) dest, (const int16_t *) src, nx, ny, stride, bin, mean, work);
+         else binFrame((int32_t *) dest, (const int16_t *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      case _DATATYPE_UINT32:
+         if(mean) binFrame((uint32_t *) dest, (const uint32_t *) src, nx, ny, stride, bin, mean, work);
+         else binFrame((uint64_t *) dest, (const uint32_t *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      case _DATATYPE_INT32:
+         if(mean) binFrame((int32_t *) dest, (const int32_t *) src, nx, ny, stride, bin, mean, work);
+         else binFrame((int64_t *) dest, (const int32_t *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      case _DATATYPE_UINT64:
+         binFrame((uint64_t *) dest, (const uint64_t *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      case _DATATYPE_INT64:
+         binFrame((int64_t *) dest, (const int64_t *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      case _DATATYPE_FLOAT:
+         binFrame((float *) dest, (const float *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      case _DATATYPE_DOUBLE:
+         binFrame((double *) dest, (const double *) src, nx, ny, stride, bin, mean, work);
+         return 0;
+      default:
+         return -1;
+   }
+}
+
+} //namespace milkzmq
+
+#endif //milkzmqBinning_hpp
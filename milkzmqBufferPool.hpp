@@ -0,0 +1,263 @@
+/** \file milkzmqBufferPool.hpp
+  * \brief A pool of reference counted message buffers for zero-copy sends.
+  * \author milkzmq contributors
+  *
+  * History:
+  * - 2026 created
+  */
+
+//***********************************************************************//
+// Copyright 2026 the milkzmq contributors
+//
+// This file is part of milkzmq.
+//
+// milkzmq is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// milkzmq is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with milkzmq.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef milkzmqBufferPool_hpp
+#define milkzmqBufferPool_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace milkzmq
+{
+
+class msgBufferPool;
+
+/// A message buffer which can be shared by several zmq messages.
+/** The buffer is returned to its pool when the last reference is released.
+  */
+struct msgBuffer
+{
+   uint8_t * m_data {nullptr}; ///< The buffer memory.
+
+   size_t m_size {0}; ///< The allocated size of the buffer.
+
+   std::atomic<int> m_refs {0}; ///< The number of outstanding references to this buffer.
+
+   std::shared_ptr<msgBufferPool> m_pool; ///< The pool this buffer belongs to.  Only set while checked out, so that the pool outlives its buffers.
+};
+
+/// A pool of pre-allocated message buffers.
+/** Buffers are checked out with acquire(), which returns a buffer with one reference held by the caller.
+  * Each zmq message built on the buffer takes a reference with addRef() and passes zmqFree as its free function,
+  * so the buffer is recycled only after zmq is done sending it to every recipient.
+  *
+  * The pool must be created with std::make_shared.
+  */
+class msgBufferPool : public std::enable_shared_from_this<msgBufferPool>
+{
+protected:
+
+   std::mutex m_mutex; ///< Mutex protecting the free list and buffer size.
+
+   std::vector<msgBuffer *> m_free; ///< The idle buffers.
+
+   size_t m_bufferSize {0}; ///< The size of buffers handed out by acquire().
+
+   size_t m_maxFree {4}; ///< The maximum number of idle buffers to keep.  Extras are freed when released.
+
+public:
+
+   /// Destructor.  Frees the idle buffers.
+   ~msgBufferPool();
+
+   /// Set the size of the buffers.
+   /** Idle buffers of a different size are freed immediately.  Outstanding buffers of a different size are freed when released.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int bufferSize( size_t sz /**< [in] the new buffer size in bytes */);
+
+   /// Get the size of the buffers.
+   /**
+     * \returns the current value of m_bufferSize.
+     */
+   size_t bufferSize();
+
+   /// Set the maximum number of idle buffers to keep.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int maxFree( size_t mf /**< [in] the new maximum number of idle buffers */);
+
+   /// Get the maximum number of idle buffers to keep.
+   /**
+     * \returns the current value of m_maxFree.
+     */
+   size_t maxFree();
+
+   /// Check out a buffer.
+   /** The returned buffer has one reference, owned by the caller, which must eventually be released.
+     *
+     * \returns a pointer to a buffer of at least bufferSize() bytes
+     * \returns nullptr on an allocation error
+     */
+   msgBuffer * acquire();
+
+   /// Add a reference to a buffer.
+   static void addRef( msgBuffer * buf /**< [in] the buffer */);
+
+   /// Release a reference to a buffer, returning it to its pool if this was the last one.
+   static void release( msgBuffer * buf /**< [in] the buffer */);
+
+   /// The zmq free function for messages built on a pool buffer.
+   /** Pass the msgBuffer pointer as the hint.
+     */
+   static void zmqFree( void * data, ///< [in] the message data (unused)
+                        void * hint  ///< [in] the msgBuffer pointer
+                      );
+
+protected:
+
+   /// Return a buffer to the free list, or free it if it is the wrong size or the list is full.
+   void checkin( msgBuffer * buf /**< [in] the buffer */);
+
+   /// Free a buffer and its memory.
+   static void destroy( msgBuffer * buf /**< [in] the buffer */);
+};
+
+inline
+msgBufferPool::~msgBufferPool()
+{
+   for(size_t n = 0; n < m_free.size(); ++n) destroy(m_free[n]);
+}
+
+inline
+int msgBufferPool::bufferSize( size_t sz )
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+
+   if(sz == m_bufferSize) return 0;
+
+   m_bufferSize = sz;
+
+   for(size_t n = 0; n < m_free.size(); ++n) destroy(m_free[n]);
+   m_free.clear();
+
+   return 0;
+}
+
+inline
+size_t msgBufferPool::bufferSize()
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+   return m_bufferSize;
+}
+
+inline
+int msgBufferPool::maxFree( size_t mf )
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+   m_maxFree = mf;
+   return 0;
+}
+
+inline
+size_t msgBufferPool::maxFree()
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+   return m_maxFree;
+}
+
+inline
+msgBuffer * msgBufferPool::acquire()
+{
+   msgBuffer * buf = nullptr;
+
+   //Scope for mutex
+   {
+      std::lock_guard<std::mutex> guard(m_mutex);
+
+      if(m_free.size() > 0)
+      {
+         buf = m_free.back();
+         m_free.pop_back();
+      }
+      else
+      {
+         buf = new msgBuffer;
+         buf->m_data = (uint8_t *) malloc(m_bufferSize);
+         if(buf->m_data == nullptr)
+         {
+            delete buf;
+            return nullptr;
+         }
+         buf->m_size = m_bufferSize;
+      }
+   }
+
+   buf->m_pool = shared_from_this();
+   buf->m_refs.store(1, std::memory_order_relaxed);
+
+   return buf;
+}
+
+inline
+void msgBufferPool::addRef( msgBuffer * buf )
+{
+   buf->m_refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline
+void msgBufferPool::release( msgBuffer * buf )
+{
+   if(buf->m_refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+   //Last reference.  Move the pool pointer out first, since the pool may be destroyed when it goes out of scope here.
+   std::shared_ptr<msgBufferPool> pool = std::move(buf->m_pool);
+   pool->checkin(buf);
+}
+
+inline
+void msgBufferPool::zmqFree( void * data,
+                             void * hint
+                           )
+{
+   static_cast<void>(data);
+
+   release(static_cast<msgBuffer *>(hint));
+}
+
+inline
+void msgBufferPool::checkin( msgBuffer * buf )
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+
+   if(buf->m_size != m_bufferSize || m_free.size() >= m_maxFree)
+   {
+      destroy(buf);
+      return;
+   }
+
+   m_free.push_back(buf);
+}
+
+inline
+void msgBufferPool::destroy( msgBuffer * buf )
+{
+   free(buf->m_data);
+   delete buf;
+}
+
+} //namespace milkzmq
+
+#endif //milkzmqBufferPool_hpp
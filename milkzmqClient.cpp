@@ -86,7 +86,9 @@ void usage( const char * msg = 0 )
    
    std::cerr << "usage: " << argv0 << " [options] remote-host shm-name [shm-names]\n\n";
    
-   std::cerr << "   remote-host is the address of the remote host where milkzmqServer is running.\n\n";
+   std::cerr << "   remote-host is the address of the remote host where milkzmqServer is running.\n";
+   std::cerr << "            It can also be a full ZeroMQ URI, e.g. ipc:///tmp/milkzmq for a server on this host,\n";
+   std::cerr << "            in which case -p is ignored.\n\n";
    std::cerr << "   shm-name is the root of the ImageStreamIO shared memory image file.\n";
    std::cerr << "            If the full path is \"/tmp/image00.im.shm\" then shm-name=image00\n";
    std::cerr << "            At least one shm-name must be specified.\n";
@@ -95,6 +97,34 @@ void usage( const char * msg = 0 )
    std::cerr << "options:\n";
    std::cerr << "    -h    print this message and exit.\n";
    std::cerr << "    -p    specify the port number of the server [default = 5556].\n";
+   std::cerr << "    -f    specify the max frame rate to request from the server [default = 0, the server's rate].\n";
+   std::cerr << "    -d    request delta frames, which are differences from the previous frame, with periodic keyframes.\n";
+   std::cerr << "          Reduces bandwidth for slowly varying images when the server compresses [default is off].\n";
+   std::cerr << "    -b    request every frame written to circular buffer streams since the last message, instead of only\n";
+   std::cerr << "          the newest.  They are written to the local stream in order [default is off].\n";
+   std::cerr << "    -r    request only a region of interest, as x0,y0,width,height.  The server crops before encoding, and\n";
+   std::cerr << "          the local stream is the size of the region [default is the full frame].\n";
+   std::cerr << "    -B    request the frame binned by this factor before it is sent.  Integer sums are widened [default = 1].\n";
+   std::cerr << "    -M    with -B, request the mean of each bin rather than the sum [default is off].\n";
+   std::cerr << "    -C    request float and double frames converted to int16 (scaled to each frame's range), fp16, or bf16\n";
+   std::cerr << "          for sending.  They are converted back in the local stream [default is off].\n";
+   std::cerr << "    -U    receive frames sent to every client by a server with -U, on this UDP endpoint, instead of requesting them.\n";
+   std::cerr << "          Use the server's multicast address, e.g. udp://239.192.0.1:5600.  Only whole keyframes are received,\n";
+   std::cerr << "          frames missing a datagram are dropped and counted, and remote-host is not used [default is off].\n";
+   std::cerr << "    -L    with -U, specify the largest frame in MB accepted before a frame of the stream has given its size,\n";
+   std::cerr << "          which then limits the rest [default = 16].\n";
+   std::cerr << "    -w    specify the credit window, the number of frames the server may send ahead of our requests.\n";
+   std::cerr << "          More than 1 keeps frames in flight, so the rate over a long round trip is not limited by the\n";
+   std::cerr << "          latency [default = 1, one frame per request].\n";
+   std::cerr << "    -D    specify the number of threads decoding frames, shared by all streams.  The threads receiving\n";
+   std::cerr << "          the streams then only hand frames over, so one slow to decode does not hold up the others\n";
+   std::cerr << "          [default = 0, each stream is decoded by the thread receiving it].\n";
+   std::cerr << "    -Q    with -D, specify the number of frames which can wait to be decoded for each stream, in order.\n";
+   std::cerr << "          Frames arriving when this many wait are dropped [default = 0, only the newest waits].\n";
+   std::cerr << "    -E    receive all the streams in one event loop over one socket, instead of a thread and socket for each.\n";
+   std::cerr << "          Always on with -U, which receives all the streams on one UDP socket [default is off].\n";
+   std::cerr << "\n";
+   std::cerr << "Send SIGUSR1 to print the latency, jitter, and decode time statistics of each stream to stderr.\n";
 
    return;
 }
@@ -137,6 +167,19 @@ int parseName( std::string & remName,
 int main (int argc, char *argv[])
 {
    int port = 5556;
+   float fpsTgt = 0;
+   bool deltaFrames = false;
+   bool burst = false;
+   unsigned roi[4] = {0,0,0,0};
+   int binFactor = 1;
+   bool binMean = false;
+   uint8_t convert = milkzmq::convertNone;
+   std::string radioEndpoint;
+   int radioMaxMB = milkzmq::radioMaxMessage/(1024*1024);
+   int creditWindow = 1;
+   int decodeThreads = 0;
+   int decodeDepth = 0;
+   bool eventLoop = false;
    bool help = false;
 
    argv0 = argv[0];
@@ -144,7 +187,7 @@ int main (int argc, char *argv[])
    opterr = 0;
    
    int c;
-   while ((c = getopt (argc, argv, "hp:")) != -1)
+   while ((c = getopt (argc, argv, "hdbMEp:f:r:B:C:U:L:w:D:Q:")) != -1)
    {
       if(c == 'h')
       {
@@ -167,9 +210,59 @@ int main (int argc, char *argv[])
          case 'p':
             port = atoi(optarg);
             break;
+         case 'f':
+            fpsTgt = atof(optarg);
+            break;
+         case 'd':
+            deltaFrames = true;
+            break;
+         case 'b':
+            burst = true;
+            break;
+         case 'r':
+            if(sscanf(optarg, "%u,%u,%u,%u", &roi[0], &roi[1], &roi[2], &roi[3]) != 4)
+            {
+               usage("region of interest must be x0,y0,width,height");
+               return 1;
+            }
+            break;
+         case 'B':
+            binFactor = atoi(optarg);
+            break;
+         case 'M':
+            binMean = true;
+            break;
+         case 'E':
+            eventLoop = true;
+            break;
+         case 'w':
+            creditWindow = atoi(optarg);
+            break;
+         case 'D':
+            decodeThreads = atoi(optarg);
+            break;
+         case 'Q':
+            decodeDepth = atoi(optarg);
+            break;
+         case 'C':
+            if(strcmp(optarg, "int16") == 0) convert = milkzmq::convertInt16;
+            else if(strcmp(optarg, "fp16") == 0) convert = milkzmq::convertFp16;
+            else if(strcmp(optarg, "bf16") == 0) convert = milkzmq::convertBf16;
+            else
+            {
+               usage("conversion must be int16, fp16, or bf16");
+               return 1;
+            }
+            break;
+         case 'U':
+            radioEndpoint = optarg;
+            break;
+         case 'L':
+            radioMaxMB = atoi(optarg);
+            break;
          case '?':
             char errm[256];
-            if (optopt == 'p' || optopt == 'u' || optopt == 'f' || optopt == 's')
+            if (optopt == 'p' || optopt == 'u' || optopt == 'f' || optopt == 's' || optopt == 'r' || optopt == 'B' || optopt == 'C' || optopt == 'U' || optopt == 'L' || optopt == 'w' || optopt == 'D' || optopt == 'Q')
                snprintf(errm, 256, "Option -%c requires an argument.", optopt);
             else if (isprint (optopt))
                snprintf(errm, 256, "Unknown option `-%c'.", optopt);
@@ -200,10 +293,48 @@ int main (int argc, char *argv[])
    
    std::string remote_address = argv[optind];
    
+   //SIGUSR1 is only taken by sigtimedwait below.  It is blocked first, so every thread started from here on has it blocked.
+   sigset_t usr1;
+   sigemptyset(&usr1);
+   sigaddset(&usr1, SIGUSR1);
+   pthread_sigmask(SIG_BLOCK, &usr1, nullptr);
+   
    milkzmq::milkzmqClient mzc;
    mzc.argv0(argv0);
    mzc.address(remote_address);
    mzc.imagePort(port);
+   mzc.fpsTgt(fpsTgt);
+   mzc.deltaFrames(deltaFrames);
+   mzc.burst(burst);
+   mzc.roi(roi[0], roi[1], roi[2], roi[3]);
+   if(binFactor < 1 || binFactor > 255 || mzc.bin(binFactor, binMean) < 0)
+   {
+      usage("binning factor must be between 1 and 255");
+      return -1;
+   }
+   mzc.convert(convert);
+   mzc.radioEndpoint(radioEndpoint);
+   if(radioMaxMB < 1 || radioMaxMB > 4095 || mzc.radioMaxSize(((size_t) radioMaxMB)*1024*1024) < 0)
+   {
+      usage("largest radio frame must be between 1 and 4095 MB");
+      return -1;
+   }
+   if(creditWindow < 1 || creditWindow > 65535 || mzc.creditWindow(creditWindow) < 0)
+   {
+      usage("credit window must be between 1 and 65535");
+      return -1;
+   }
+   if(decodeThreads < 0 || mzc.decodeThreads(decodeThreads) < 0)
+   {
+      usage("number of decode threads must be 0 or more");
+      return -1;
+   }
+   if(decodeDepth < 0 || mzc.decodeDepth(decodeDepth) < 0)
+   {
+      usage("decode depth must be 0 or more");
+      return -1;
+   }
+   mzc.eventLoop(eventLoop || radioEndpoint != ""); //a RADIO is always received in one loop, on one DISH socket
    
    std::cerr << "N: " << argc - optind << "\n";
    for(int n=1; n < argc - optind; ++n)
@@ -224,19 +355,31 @@ int main (int argc, char *argv[])
    
    setSigTermHandler();
    
-   for(size_t n=0; n < argc-optind - 1; ++n)
+   if(mzc.eventLoop())
    {
-      mzc.imageThreadStart(n);
+      if(mzc.eventLoopStart() < 0) return -1;
+   }
+   else
+   {
+      for(size_t n=0; n < argc-optind - 1; ++n)
+      {
+         mzc.imageThreadStart(n);
+      }
    }
    
    while(!milkzmq::milkzmqClient::m_timeToDie) 
    {
-      milkzmq::sleep(1);
+      timespec ts = {1, 0};
+      if(sigtimedwait(&usr1, nullptr, &ts) == SIGUSR1) std::cerr << mzc.histogramReport();
    }
    
-   for(size_t n=0; n < argc-optind - 1; ++n)
+   if(mzc.eventLoop()) mzc.eventLoopKill();
+   else
    {
-      mzc.imageThreadKill(n);
+      for(size_t n=0; n < argc-optind - 1; ++n)
+      {
+         mzc.imageThreadKill(n);
+      }
    }
    
 
@@ -29,12 +29,24 @@
 #define milkzmqClient_hpp
 
 #include <signal.h>
+#include <fcntl.h>  // for open
+#include <unistd.h> // for close
+#include <semaphore.h>
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
 
 #define ZMQ_BUILD_DRAFT_API
 #define ZMQ_CPP11
 #include <zmq.hpp>
 
 #include "milkzmqUtils.hpp"
+#include "milkzmqCodec.hpp"
+#include "milkzmqConvert.hpp"
+#include "milkzmqRadio.hpp"
+#include "milkzmqQueue.hpp"
+#include "milkzmqHistogram.hpp"
 
 namespace milkzmq 
 {
@@ -54,6 +66,38 @@ protected:
    
    int m_imagePort{5556}; ///< The port number to use for the image server.
    
+   float m_fpsTgt {0}; ///< The max frame rate to request from the server.  <= 0 means the server's rate.
+   
+   bool m_deltaFrames {false}; ///< Whether to request delta frames from the server.
+   
+   bool m_burst {false}; ///< Whether to request every frame of circular buffer streams.
+   
+   uint32_t m_roiX0 {0}; ///< The first column of the region of interest to request.
+   
+   uint32_t m_roiY0 {0}; ///< The first row of the region of interest to request.
+   
+   uint32_t m_roiWidth {0}; ///< The width of the region of interest to request.  0 means the full frame.
+   
+   uint32_t m_roiHeight {0}; ///< The height of the region of interest to request.  0 means the full frame.
+   
+   uint8_t m_binFactor {1}; ///< The binning factor to request.
+   
+   bool m_binMean {false}; ///< Whether to request the mean of each bin rather than the sum.
+   
+   uint8_t m_convert {convertNone}; ///< The conversion of floating point frames to a 16 bit type to request.
+   
+   std::string m_radioEndpoint; ///< If set, frames are received by one DISH from the server's RADIO on this UDP endpoint, instead of requested.
+   
+   size_t m_radioMaxSize {radioMaxMessage}; ///< The largest frame, with its header, reassembled from m_radioEndpoint.
+   
+   int m_decodeThreads {0}; ///< The number of decode threads shared by all streams.  0 means each stream is decoded by the thread receiving it.
+   
+   uint32_t m_decodeDepth {0}; ///< With decode threads, the number of frames which can wait for each stream.  0 means only the newest waits.
+   
+   uint16_t m_creditWindow {1}; ///< The number of frames the server may send ahead of our requests.  1 means one frame per request.
+   
+   bool m_eventLoop {false}; ///< Whether to receive all streams in one event loop over one socket, instead of a thread and socket per stream.
+   
    ///@}
    
    /** \name Internal State 
@@ -78,7 +122,94 @@ protected:
 
    std::vector<s_imageThread> m_imageThreads; ///< The image threads, one per shared memory streamm being served.
    
-   zmq::context_t * m_ZMQ_context {nullptr}; ///< The ZeroMQ context, allocated on construction.
+   ///A frame message waiting to be decoded.
+   struct s_frameMsg
+   {
+      zmq::message_t m_msg;  ///< The message.
+      int64_t m_arrival {0}; ///< When the message arrived, CLOCK_REALTIME in nanoseconds.
+   };
+   
+   ///The decoding state of a local stream, and its request.
+   struct s_localStream
+   {
+      std::string m_imageName;            ///< The name of the remote stream.
+      std::string m_shMemImName;          ///< The name of the local stream.
+      std::string m_endpoint;             ///< The server socket the event loop requests the stream from, which the server can redirect.
+      
+      uint8_t m_atype {0};                ///< The data type of the local stream.
+      uint64_t m_nx {0};                  ///< The width of the local stream.
+      uint64_t m_ny {0};                  ///< The height of the local stream.
+      uint32_t m_nz {0};                  ///< The depth of the local stream, 0 if it is not a cube.
+      uint8_t m_naxis {0};                ///< The number of axes of the local stream.
+      uint8_t m_convert {0};              ///< The conversion the last frame was sent with.
+      uint8_t m_wire {0};                 ///< The data type sent, after any conversion.
+      int16_t m_difference {0};           ///< The difference method xrif is configured for.
+      int16_t m_reorder {0};              ///< The reorder method xrif is configured for.
+      int16_t m_compress {0};             ///< The compress method xrif is configured for.
+      
+      std::vector<char> m_scratch;        ///< Working space for the byte-shuffle decoding.
+      std::vector<char> m_deltaBuf;       ///< The decoded delta frame.
+      std::vector<char> m_convertBuf;     ///< The decoded frame before converting back to the local type.
+      uint64_t m_heldSeq {0};             ///< The server's sequence number of the frame in the local stream, which delta frames are applied to.
+      
+      std::vector<char> m_batchBuf;       ///< The decoded frames of a batch.
+      std::vector<uint64_t> m_batchMeta;  ///< cnt0, tv_sec and tv_nsec of each frame of a batch.
+      xrif_t m_batchXrif {nullptr};       ///< xrif handle for batches, allocated on the first one.
+      uint32_t m_batchFrames {0};         ///< The number of frames m_batchXrif is configured for.
+      int16_t m_batchDifference {0};      ///< The difference method m_batchXrif is configured for.
+      int16_t m_batchReorder {0};         ///< The reorder method m_batchXrif is configured for.
+      int16_t m_batchCompress {0};        ///< The compress method m_batchXrif is configured for.
+      
+      xrif_t m_xrif {nullptr};            ///< xrif handle for single frames, with its own buffers.
+      xrif_t m_directXrif {nullptr};      ///< xrif handle for decoding straight into the stream, see decodeFrame.
+      
+      IMAGE m_image;                      ///< The local stream.
+      bool m_opened {false};              ///< Whether m_image is open.
+      
+      char m_reqData[requestSize];        ///< The request: the name, followed by our rate and flags.
+      
+      std::atomic<bool> m_needKey {false}; ///< Set by decoding when a frame could not be decoded, so the next request asks for a keyframe.
+      std::atomic<bool> m_reconnected {false}; ///< Set when the connection is reset, so decoding no longer applies deltas to the frame held.
+      
+      std::atomic<s_frameMsg *> m_newest {nullptr}; ///< With decode threads and m_decodeDepth 0, the newest frame waiting to be decoded.
+      mpmcQueue<s_frameMsg *> m_waiting;      ///< With decode threads and m_decodeDepth > 0, the frames waiting to be decoded, in order.
+      std::atomic<bool> m_queued {false};     ///< Whether the stream is on the decode queue or being decoded, so it is only ever on it once.
+      std::atomic<uint64_t> m_dropped {0};    ///< The number of frames dropped because decoding fell behind.
+      uint64_t m_droppedReported {0};         ///< m_dropped when it was last reported.
+      int64_t m_droppedTime {0};              ///< Monotonic time m_dropped was last reported, in nanoseconds.
+      
+      timeHistogram m_latency;            ///< Time from the source writing each frame to posting it locally.  Needs synchronized clocks.
+      timeHistogram m_jitter;             ///< Absolute change in transit time between successive frames, |D(i-1,i)| of RFC 3550, unsmoothed.
+      timeHistogram m_decodeTime;         ///< Time to decode and write each message to the local stream.
+      int64_t m_lastSource {0};           ///< The source writetime of the last frame posted, CLOCK_REALTIME in nanoseconds.
+      int64_t m_lastArrival {0};          ///< The arrival time of the last frame posted, CLOCK_REALTIME in nanoseconds.
+      
+      bool m_connected {false};           ///< Whether the event loop has had a frame since the last hangup.
+      int64_t m_lastRequest {0};          ///< Monotonic time the event loop last requested the stream, in nanoseconds.
+      
+      #ifdef MZMQ_FPS_MONITORING
+      int m_Nrecvd {100};                 ///< Frames received since m_t0.
+      double m_t0 {0};                    ///< Start of the current rate measurement.
+      #endif
+   };
+   
+   std::thread m_eventLoopThread; ///< The event loop thread, if the streams are received with eventLoopStart().
+   
+   std::mutex m_localStreamsMutex; ///< Mutex for m_localStreams.
+   
+   std::vector<s_localStream *> m_localStreams; ///< The local streams set up, for histogramReport().
+   
+   std::vector<std::thread> m_decodeThreadPool; ///< The decode threads.
+   
+   std::atomic<int> m_decodeRunning {0}; ///< The number of decode threads which have not exited.  Streams are not freed until it is 0.
+   
+   mpmcQueue<s_localStream *> m_decodeQueue; ///< The streams with frames waiting to be decoded.
+   
+   sem_t m_decodeSem; ///< Posted once for each stream put on m_decodeQueue.
+   
+   zmq::context_t * m_ZMQ_context {nullptr}; ///< The ZeroMQ context, allocated on construction unless one is shared with context().
+   
+   bool m_ownContext {true}; ///< Whether m_ZMQ_context was allocated by us, and so is deleted by us.
    
 
    ///@}
@@ -106,7 +237,10 @@ public:
    std::string argv0();
    
    /// Set the address of the remote server.
-   /** This sets the value of m_address.
+   /** This is either a host name or IP address, which is connected to with tcp on imagePort(), or a full ZeroMQ URI
+     * such as tcp://host:5556, ipc:///tmp/milkzmq or inproc://milkzmq.  An inproc URI needs the server's context, see context().
+     * 
+     * This sets the value of m_address.
      * 
      * \returns 0 on success
      * \returns -1 on error
@@ -119,6 +253,21 @@ public:
      */
    std::string address();
    
+   /// Get the endpoint URI of the remote server.
+   /**
+     * \returns m_address if it is a URI, otherwise tcp://m_address:m_imagePort
+     */
+   std::string endpoint();
+   
+   /// Share a ZeroMQ context, such as the one of a milkzmqServer in the same process.
+   /** This is needed to connect to an inproc:// endpoint.  The context is not deleted by the client, and must outlive it.
+     * Must be called before the image threads are started.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int context( zmq::context_t * ctx /**< [in] the context to use */);
+   
    /// Set the port number of the image server
    /** This sets the value of m_imagePort.
      * 
@@ -133,6 +282,222 @@ public:
      */ 
    int imagePort();
    
+   /// Set the max frame rate to request from the server
+   /** This sets the value of m_fpsTgt.  The server will not send faster than its own rate limit.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int fpsTgt( float fps /**< [in] the new max frame rate [f.p.s.].  <= 0 means the server's rate. */);
+   
+   /// Get the max frame rate to request from the server
+   /**
+     * \returns the current value of m_fpsTgt
+     */ 
+   float fpsTgt();
+   
+   /// Set whether to request delta frames from the server
+   /** Delta frames are the difference from the previous frame, which is held in the local stream, and are
+     * sent with periodic keyframes.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int deltaFrames( bool df /**< [in] the new value of the flag */);
+   
+   /// Get whether to request delta frames from the server
+   /**
+     * \returns the current value of m_deltaFrames
+     */ 
+   bool deltaFrames();
+   
+   /// Set whether to request every frame of circular buffer streams
+   /** The server then sends every slice written since the last message, and each is written to the local stream in order.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int burst( bool b /**< [in] the new value of the flag */);
+   
+   /// Get whether to request every frame of circular buffer streams
+   /**
+     * \returns the current value of m_burst
+     */ 
+   bool burst();
+   
+   /// Set the region of interest to request from the server
+   /** The server crops each frame before encoding it, and the local stream is the size of the region.  It is clipped
+     * to the frame by the server.  Delta frames and bursts are not sent for a region of interest.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int roi( uint32_t x0,    ///< [in] the first column
+            uint32_t y0,    ///< [in] the first row
+            uint32_t width, ///< [in] the width, 0 for the full frame
+            uint32_t height ///< [in] the height, 0 for the full frame
+          );
+   
+   /// Get the first column of the region of interest
+   /**
+     * \returns the current value of m_roiX0
+     */ 
+   uint32_t roiX0();
+   
+   /// Get the first row of the region of interest
+   /**
+     * \returns the current value of m_roiY0
+     */ 
+   uint32_t roiY0();
+   
+   /// Get the width of the region of interest
+   /**
+     * \returns the current value of m_roiWidth
+     */ 
+   uint32_t roiWidth();
+   
+   /// Get the height of the region of interest
+   /**
+     * \returns the current value of m_roiHeight
+     */ 
+   uint32_t roiHeight();
+   
+   /// Set the binning to request from the server
+   /** The server bins the frame, or the region of interest, before encoding it, and the local stream is the binned size.
+     * Sums of integers are widened so they can not overflow, e.g. 16 bit integers to 32 bits.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int bin( uint8_t factor, ///< [in] the binning factor, 1 for none
+            bool mean       ///< [in] true for the mean of each bin, false for the sum
+          );
+   
+   /// Get the binning factor
+   /**
+     * \returns the current value of m_binFactor
+     */ 
+   uint8_t binFactor();
+   
+   /// Get whether the mean of each bin is requested
+   /**
+     * \returns the current value of m_binMean
+     */ 
+   bool binMean();
+   
+   /// Set the conversion of floating point frames to a 16 bit type to request from the server
+   /** Float and double frames are sent as scaled int16, fp16, or bf16, and converted back to the stream's type in the 
+     * local stream.  Other types are sent unconverted.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int convert( uint8_t cv /**< [in] the conversion, convertNone, convertInt16, convertFp16, or convertBf16 */);
+   
+   /// Get the conversion of floating point frames to request
+   /**
+     * \returns the current value of m_convert
+     */ 
+   uint8_t convert();
+   
+   /// Set the UDP endpoint to receive frames on, from a server sending them to every client with a RADIO socket
+   /** If set, nothing is requested from the server.  One DISH socket is bound to this endpoint and joins the group 
+     * radioGroup(name) of every stream, and each datagram goes to the stream whose id is in its fragment header, where
+     * keyframes are reassembled.  Frames missing any datagram are dropped and counted.  Start it with eventLoopStart(), 
+     * which then runs radioLoopExec(), instead of the image threads.
+     * Use the multicast address the server sends to, e.g. udp://239.192.0.1:5600, or for a unicast server udp://0.0.0.0:port.
+     * The rate, delta, burst, ROI, binning and conversion requests do not apply.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int radioEndpoint( const std::string & ep /**< [in] the new endpoint, empty to request frames as usual */);
+   
+   /// Get the UDP endpoint to receive frames on
+   /**
+     * \returns the current value of m_radioEndpoint
+     */ 
+   std::string radioEndpoint();
+   
+   /// Set the largest frame, with its header, reassembled from the RADIO endpoint
+   /** Datagrams claiming a larger frame are ignored, so nothing sent to the endpoint makes us allocate more than this.
+     * Once a stream's first frame arrives, its own size sets a tighter limit, so this only needs to cover the first.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int radioMaxSize( size_t ms /**< [in] the new largest size, in bytes, more than headerSize */);
+   
+   /// Get the largest frame, with its header, reassembled from the RADIO endpoint
+   /**
+     * \returns the current value of m_radioMaxSize
+     */ 
+   size_t radioMaxSize();
+   
+   /// Set the number of decode threads shared by all streams
+   /** The threads receiving the streams then only hand each frame to the decode threads, and request the next, so a 
+     * stream which is slow to decode does not hold up the others.  A stream is decoded by one thread at a time.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int decodeThreads( int dt /**< [in] the number of threads, 0 to decode in the receiving threads */);
+   
+   /// Get the number of decode threads
+   /**
+     * \returns the current value of m_decodeThreads
+     */ 
+   int decodeThreads();
+   
+   /// Set the number of frames which can wait to be decoded for each stream
+   /** With 0 only the newest frame waits, and one arriving before it is decoded replaces it.  Otherwise frames wait
+     * in order, and those arriving when this many are waiting are dropped.  Dropped frames break a chain of delta 
+     * frames, which is repaired by asking for a keyframe, and leave gaps in a burst.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int decodeDepth( uint32_t dd /**< [in] the number of frames, 0 for only the newest */);
+   
+   /// Get the number of frames which can wait to be decoded for each stream
+   /**
+     * \returns the current value of m_decodeDepth
+     */ 
+   uint32_t decodeDepth();
+   
+   /// Set the credit window, the number of frames the server may send ahead of our requests
+   /** The first request grants the whole window, and each frame received is replaced with a request granting one 
+     * more.  So up to this many frames are in flight, and on a link with a long round trip the rate is set by 
+     * the bandwidth rather than by the latency.  Servers which do not know about credits send one frame per request.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int creditWindow( uint16_t cw /**< [in] the new window, at least 1 */);
+   
+   /// Get the credit window
+   /**
+     * \returns the current value of m_creditWindow
+     */ 
+   uint16_t creditWindow();
+   
+   /// Set whether to receive all streams in one event loop
+   /** The event loop requests every stream over one socket to the server, waits on it with a poller, and writes each 
+     * message to the local stream named in its header.  A server which shards its streams redirects some of them, and 
+     * the loop then has one socket per server socket.  Start it with eventLoopStart() instead of the image threads.
+     * With a RADIO endpoint set, eventLoopStart() receives from it instead, see radioEndpoint().
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int eventLoop( bool el /**< [in] the new value of the flag */);
+   
+   /// Get whether to receive all streams in one event loop
+   /**
+     * \returns the current value of m_eventLoop
+     */ 
+   bool eventLoop();
+   
    /// Add a ImageStreamIO shared memory image
    /** This is just the root.  E.g. for a complete path of '/tmp/image00.im.shm' the argument should be "image00".
      * This image name is appeneded to the list.
@@ -181,6 +546,131 @@ public:
                          const std::string & localImageName ///< [in] the local name for the image stream
                        );
 
+private:
+   ///Thread starter, called by eventLoopStart on thread construction.  Calls eventLoopExec.
+   static void internal_eventLoopStart( milkzmqClient * mzc /**< [in] a pointer to this client */);
+
+public:
+   /// Start the event loop, which receives all the streams in one thread.  Used instead of imageThreadStart.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int eventLoopStart();
+   
+   /// Execute the event loop.
+   void eventLoopExec();
+   
+   /// Execute the event loop receiving from a RADIO, run by eventLoopStart() if radioEndpoint() is set.
+   /** One DISH socket joins the group of every stream, and each datagram is added to the reassembly of the stream
+     * named by the id in its fragment header.
+     */
+   void radioLoopExec();
+   
+   /// Signal the event loop thread to kill it.
+   int eventLoopKill();
+   
+   /// Set up the decoding state of a local stream, and its request.
+   void localStreamSetup( s_localStream & ls,                ///< [out] the local stream
+                          const std::string & imageName,     ///< [in] the name of the remote image stream
+                          const std::string & localImageName ///< [in] the local name for the image stream, the remote name if ""
+                        );
+   
+   /// Prepare the next request of a local stream.
+   /** Sets the credits it grants, and asks for a keyframe if decoding needs one.  A new or re-sent request grants
+     * the whole window, which the server caps at the window, and the request for each frame received grants one.
+     */
+   void localStreamRequest( s_localStream & ls, ///< [in/out] the local stream
+                            uint16_t credit     ///< [in] the credits to grant
+                          );
+   
+   /// Handle a hangup from the server for a local stream in the event loop.
+   /** The stream is requested again from the original endpoint after a second.
+     */
+   void localStreamHangup( s_localStream & ls /**< [in/out] the local stream */);
+   
+   /// Close the local stream and free its decoding state.
+   void localStreamFree( s_localStream & ls /**< [in/out] the local stream */);
+   
+   /// Hand a frame message to be decoded into its local stream.
+   /** Without decode threads it is decoded right away.  Otherwise the message is kept for the decode threads, and the 
+     * stream is put on the decode queue if it is not already there.
+     */
+   void localStreamDecode( s_localStream & ls,    ///< [in/out] the local stream
+                           zmq::message_t & msg,  ///< [in/out] the message received, moved from if it holds the frame
+                           char * msgData,        ///< [in] the frame message, which is in msg unless it was reassembled
+                           size_t msgSize         ///< [in] the size of the frame message
+                         );
+   
+   /// Report the latency, jitter, and decode time statistics of each stream.
+   /** Each is summarized by its count, mean, minimum, percentiles and maximum.  The latency is from the source's 
+     * writetime to posting the frame locally, so it is only meaningful if the clocks of the two hosts are synchronized.
+     * 
+     * \returns the report, one line per statistic
+     */
+   std::string histogramReport( bool reset = false /**< [in] if true the histograms are emptied after the report */);
+   
+private:
+   ///Thread starter, called by decodeThreadsStart on thread construction.  Calls decodeThreadExec.
+   static void internal_decodeThreadStart( milkzmqClient * mzc /**< [in] a pointer to this client */);
+   
+public:
+   /// Start the decode threads, if there are to be any and they are not already started.
+   /** Called by imageThreadStart and eventLoopStart.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int decodeThreadsStart();
+   
+   /// Execute a decode thread.
+   /** Takes streams from the decode queue, and decodes their waiting frames.
+     */
+   void decodeThreadExec();
+   
+   /// Decode a frame message into its local stream.
+   /** A frame which can not be decoded is dropped, and a keyframe is asked for with the next request.
+     */
+   void receiveFrame( s_localStream & ls, ///< [in/out] the local stream
+                      char * msgData,     ///< [in] the message
+                      size_t msgSize,     ///< [in] the size of the message, more than headerSize
+                      int64_t arrival     ///< [in] when the message arrived, CLOCK_REALTIME in nanoseconds
+                    );
+
+   /// Decode one encoded frame.
+   /** The codec is given by the difference, reorder and compress methods from the header.  xrif and direct must already 
+     * be configured for them.  Unencoded frames are copied once into dest.  Where it can, xrif decodes with direct straight 
+     * from src into dest, and otherwise through its own buffers with xrif.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   static int decodeFrame( char * dest,                 ///< [out] the frame, nel*typeSize in size
+                           const char * src,            ///< [in] the encoded frame
+                           size_t srcSize,              ///< [in] the size of the encoded frame
+                           xrif_t xrif,                 ///< [in] the xrif handle, with its own buffers
+                           xrif_t direct,               ///< [in] the xrif handle for decoding into dest, with compress_on_raw off and no raw buffer.  May be nullptr.
+                           int16_t difference,          ///< [in] the difference method
+                           int16_t reorder,             ///< [in] the reorder method
+                           int16_t compress,            ///< [in] the compress method
+                           std::vector<char> & scratch, ///< [in] working space for the byte-shuffle, nel*typeSize in size
+                           size_t nel,                  ///< [in] the number of elements
+                           size_t typeSize              ///< [in] the size of each element
+                         );
+   
+   /// Open an existing local stream, if its shape and type match.
+   /** Reusing the stream, rather than re-creating it, means its readers never have to re-open it.
+     * 
+     * \returns true if the stream is open
+     * \returns false if it does not exist or does not match, in which case it is not open
+     */
+   static bool openLocal( IMAGE & image,              ///< [out] the image
+                          const std::string & name,   ///< [in] the name of the local stream
+                          uint8_t naxis,              ///< [in] the number of axes it must have
+                          const uint32_t * imsize,    ///< [in] the size it must have, 3 elements, the last ignored if naxis < 3
+                          uint8_t atype               ///< [in] the data type it must have
+                        );
+   
    /// Flag to control execution.  When true all threads will exit.
    static bool m_timeToDie;
    
@@ -227,7 +717,7 @@ milkzmqClient::~milkzmqClient()
 {
    m_timeToDie = true;
 
-   if(m_ZMQ_context) delete m_ZMQ_context;
+   if(m_ZMQ_context && m_ownContext) delete m_ZMQ_context;
    
    for(size_t n = 0; n < m_imageThreads.size(); ++n)
    {
@@ -239,6 +729,15 @@ milkzmqClient::~milkzmqClient()
       }
    }
    
+   if(m_eventLoopThread.joinable()) m_eventLoopThread.join();
+   
+   for(size_t n = 0; n < m_decodeThreadPool.size(); ++n)
+   {
+      if(m_decodeThreadPool[n].joinable()) m_decodeThreadPool[n].join();
+   }
+   
+   if(m_decodeQueue.capacity() > 0) sem_destroy(&m_decodeSem);
+   
 
 }
 
@@ -269,6 +768,27 @@ std::string milkzmqClient::address()
    return m_address;
 }
 
+inline
+std::string milkzmqClient::endpoint()
+{
+   if(m_address.find("://") != std::string::npos) return m_address;
+   
+   return "tcp://" + m_address + ":" + std::to_string(m_imagePort);
+}
+
+inline
+int milkzmqClient::context( zmq::context_t * ctx )
+{
+   if(ctx == nullptr) return -1;
+   
+   if(m_ZMQ_context && m_ownContext) delete m_ZMQ_context;
+   
+   m_ZMQ_context = ctx;
+   m_ownContext = false;
+   
+   return 0;
+}
+
 inline
 int milkzmqClient::imagePort( const int & imagePort )
 {
@@ -284,55 +804,269 @@ int milkzmqClient::imagePort()
 }
 
 inline
-int milkzmqClient::shMemImName( const std::string & name )
-{   
-   return shMemImName(name, name);
+int milkzmqClient::fpsTgt( float fps )
+{
+   m_fpsTgt = fps;
+   
+   return 0;
 }
 
 inline
-int milkzmqClient::shMemImName( const std::string & name,
-                                const std::string & localName
-                              )
+float milkzmqClient::fpsTgt()
 {
-   s_imageThread nt;
-   
-   nt.m_mzc = this;
-   nt.m_imageName = name;
-   nt.m_localImageName = localName;
-   
-   m_imageThreads.push_back(nt);
+   return m_fpsTgt;
+}
+
+inline
+int milkzmqClient::deltaFrames( bool df )
+{
+   m_deltaFrames = df;
    
    return 0;
 }
 
 inline
-std::string milkzmqClient::shMemImName(size_t imno)
+bool milkzmqClient::deltaFrames()
 {
-   if(imno >= m_imageThreads.size()) return "";
-   
-   return m_imageThreads[imno].m_imageName;
+   return m_deltaFrames;
 }
 
 inline
-std::string milkzmqClient::localShMemImName(size_t imno)
+int milkzmqClient::burst( bool b )
 {
-   if(imno >= m_imageThreads.size()) return "";
+   m_burst = b;
    
-   return m_imageThreads[imno].m_localImageName;
+   return 0;
 }
 
 inline
-void milkzmqClient::internal_imageThreadStart( s_imageThread* mit  )
+bool milkzmqClient::burst()
 {
-   mit->m_mzc->imageThreadExec(mit->m_imageName, mit->m_localImageName);
+   return m_burst;
 }
 
 inline
-int milkzmqClient::imageThreadStart(size_t thno)
+int milkzmqClient::roi( uint32_t x0,
+                        uint32_t y0,
+                        uint32_t width,
+                        uint32_t height
+                      )
 {
-   try
-   {
-      *m_imageThreads[thno].m_thread = std::thread( internal_imageThreadStart, &m_imageThreads[thno]);      
+   m_roiX0 = x0;
+   m_roiY0 = y0;
+   m_roiWidth = width;
+   m_roiHeight = height;
+   
+   return 0;
+}
+
+inline
+uint32_t milkzmqClient::roiX0()
+{
+   return m_roiX0;
+}
+
+inline
+uint32_t milkzmqClient::roiY0()
+{
+   return m_roiY0;
+}
+
+inline
+uint32_t milkzmqClient::roiWidth()
+{
+   return m_roiWidth;
+}
+
+inline
+uint32_t milkzmqClient::roiHeight()
+{
+   return m_roiHeight;
+}
+
+inline
+int milkzmqClient::bin( uint8_t factor,
+                        bool mean
+                      )
+{
+   if(factor < 1) return -1;
+   
+   m_binFactor = factor;
+   m_binMean = mean;
+   
+   return 0;
+}
+
+inline
+uint8_t milkzmqClient::binFactor()
+{
+   return m_binFactor;
+}
+
+inline
+bool milkzmqClient::binMean()
+{
+   return m_binMean;
+}
+
+inline
+int milkzmqClient::convert( uint8_t cv )
+{
+   if(cv > convertBf16) return -1;
+   
+   m_convert = cv;
+   
+   return 0;
+}
+
+inline
+uint8_t milkzmqClient::convert()
+{
+   return m_convert;
+}
+
+inline
+int milkzmqClient::radioEndpoint( const std::string & ep )
+{
+   m_radioEndpoint = ep;
+   return 0;
+}
+
+inline
+std::string milkzmqClient::radioEndpoint()
+{
+   return m_radioEndpoint;
+}
+
+inline
+int milkzmqClient::radioMaxSize( size_t ms )
+{
+   if(ms <= headerSize) return -1;
+   
+   m_radioMaxSize = ms;
+   return 0;
+}
+
+inline
+size_t milkzmqClient::radioMaxSize()
+{
+   return m_radioMaxSize;
+}
+
+inline
+int milkzmqClient::decodeThreads( int dt )
+{
+   if(dt < 0) return -1;
+   
+   m_decodeThreads = dt;
+   return 0;
+}
+
+inline
+int milkzmqClient::decodeThreads()
+{
+   return m_decodeThreads;
+}
+
+inline
+int milkzmqClient::decodeDepth( uint32_t dd )
+{
+   m_decodeDepth = dd;
+   return 0;
+}
+
+inline
+uint32_t milkzmqClient::decodeDepth()
+{
+   return m_decodeDepth;
+}
+
+inline
+int milkzmqClient::creditWindow( uint16_t cw )
+{
+   if(cw < 1) return -1;
+   
+   m_creditWindow = cw;
+   return 0;
+}
+
+inline
+uint16_t milkzmqClient::creditWindow()
+{
+   return m_creditWindow;
+}
+
+inline
+int milkzmqClient::eventLoop( bool el )
+{
+   m_eventLoop = el;
+   return 0;
+}
+
+inline
+bool milkzmqClient::eventLoop()
+{
+   return m_eventLoop;
+}
+
+inline
+int milkzmqClient::shMemImName( const std::string & name )
+{   
+   return shMemImName(name, name);
+}
+
+inline
+int milkzmqClient::shMemImName( const std::string & name,
+                                const std::string & localName
+                              )
+{
+   s_imageThread nt;
+   
+   nt.m_mzc = this;
+   nt.m_imageName = name;
+   nt.m_localImageName = localName;
+   
+   m_imageThreads.push_back(nt);
+   
+   return 0;
+}
+
+inline
+std::string milkzmqClient::shMemImName(size_t imno)
+{
+   if(imno >= m_imageThreads.size()) return "";
+   
+   return m_imageThreads[imno].m_imageName;
+}
+
+inline
+std::string milkzmqClient::localShMemImName(size_t imno)
+{
+   if(imno >= m_imageThreads.size()) return "";
+   
+   return m_imageThreads[imno].m_localImageName;
+}
+
+inline
+void milkzmqClient::internal_imageThreadStart( s_imageThread* mit  )
+{
+   mit->m_mzc->imageThreadExec(mit->m_imageName, mit->m_localImageName);
+}
+
+inline
+int milkzmqClient::imageThreadStart(size_t thno)
+{
+   if(m_radioEndpoint != "")
+   {
+      reportError("the image threads do not receive from a RADIO, use the event loop" , __FILE__, __LINE__);
+      return -1;
+   }
+   
+   if(decodeThreadsStart() < 0) return -1;
+   
+   try
+   {
+      *m_imageThreads[thno].m_thread = std::thread( internal_imageThreadStart, &m_imageThreads[thno]);      
    }
    catch( const std::exception & e )
    {
@@ -359,72 +1093,43 @@ void milkzmqClient::imageThreadExec( const std::string & imageName,
                                      const std::string & localImageName 
                                    )
 {   
-   std::string srvstr = "tcp://" + m_address + ":" + std::to_string(m_imagePort);
+   std::string srvstr = endpoint(); //the server can redirect us to another socket for this stream
    
    reportInfo("Beginning receive at " + srvstr + " for " + imageName);
    
+   s_localStream ls;
+   localStreamSetup(ls, imageName, localImageName);
    
-   std::string shMemImName;
-   if(localImageName == "") shMemImName = imageName;
-   else 
-   {
-      shMemImName = localImageName;
-      reportInfo("Writing " + imageName + " to " + shMemImName);
-   }
-      
-   uint8_t new_atype, atype=0;
-   uint64_t new_nx, nx =0;
-   uint64_t new_ny, ny =0;
-   
-   /* Initialize xrif
-    */
-   xrif_error_t xe;
-   xrif_t xrif;
-   xe = xrif_new(&xrif);
-   
-   /* Initialize ImageStreamIO
-    */
-     
-   IMAGE image;
-   bool opened = false;
-       
-   uint32_t imsize[3];
-       
-   int curr_image;
-      
    //Outer loop, which will periodically refresh the subscription if needed.
    while(!m_timeToDie)
    {
       zmq::socket_t subscriber (*m_ZMQ_context, ZMQ_CLIENT);
    
       #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
-      subscriber.set(zmq::sockopt::linger, 1000);
+      subscriber.set(zmq::sockopt::rcvtimeo, 1000);
       subscriber.set(zmq::sockopt::linger, 0);
       #else
       subscriber.setsockopt(ZMQ_RCVTIMEO, 1000);
       subscriber.setsockopt(ZMQ_LINGER, 0);
       #endif
       
+      localStreamRequest(ls, m_creditWindow);
+      zmq::message_t request(ls.m_reqData, requestSize);
+      
       subscriber.connect(srvstr);
-   
-      zmq::message_t request(imageName.data(), imageName.size());
       
       #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
       subscriber.send(request, zmq::send_flags::none);
       #else
       subscriber.send(request);
       #endif
+      
       bool reconnect = false;
       
       
       bool first = true;
       bool connected = false;
       
-      #ifdef MZMQ_FPS_MONITORING
-      int Nrecvd = 100;
-      double t0 = 0, t1;
-      #endif
-      
       while(!m_timeToDie && !reconnect) //Inner loop waits for each new image and processes it as it comes in.
       {
          zmq::message_t msg;
@@ -457,7 +1162,8 @@ void milkzmqClient::imageThreadExec( const std::string & imageName,
          {
             if(zmq_errno() == EAGAIN) //If we timed out, just re-send the request
             {
-               request.rebuild(imageName.data(), imageName.size());
+               localStreamRequest(ls, m_creditWindow);
+               request.rebuild(ls.m_reqData, requestSize);
                subscriber.send(request, zmq::send_flags::none);
                continue;
             }
@@ -472,7 +1178,8 @@ void milkzmqClient::imageThreadExec( const std::string & imageName,
          {
             if(zmq_errno() == EAGAIN) //If we timed out, just re-send the request
             {
-               request.rebuild(imageName.data(), imageName.size());
+               localStreamRequest(ls, m_creditWindow);
+               request.rebuild(ls.m_reqData, requestSize);
                subscriber.send(request);
                continue;
             }
@@ -484,6 +1191,22 @@ void milkzmqClient::imageThreadExec( const std::string & imageName,
          }
          #endif
          
+         char * msgData = (char *) msg.data();
+         size_t msgSize = msg.size();
+         
+         if(msgSize >= headerSize && (*((uint8_t *) msgData + frameFlagsOffset) & frameFlagRedirect))
+         {
+            uint32_t port = *((uint32_t *) (msgData + redirectPortOffset));
+            
+            //A tcp server binds a wildcard address, so for tcp we keep our host and take only the port.
+            if(port > 0 && srvstr.compare(0, 6, "tcp://") == 0) srvstr = srvstr.substr(0, srvstr.rfind(':') + 1) + std::to_string(port);
+            else srvstr = std::string(msgData + headerSize, msgSize - headerSize);
+            
+            reportInfo("Redirected to " + srvstr + " for " + imageName);
+            reconnect = true;
+            continue;
+         }
+         
          if(first)
          {
             reportNotice("Connected to " + imageName);
@@ -491,87 +1214,21 @@ void milkzmqClient::imageThreadExec( const std::string & imageName,
             first = false;
          }
          
-         if(msg.size() <= headerSize) //If we don't get enough data, we reconnect to the server.
+         if(msgSize <= headerSize) //If we don't get enough data, we reconnect to the server.
          {
+            srvstr = endpoint(); //The restarted server may serve the stream elsewhere.
             sleep(1); //Give server time to finish its shutdown.
             reconnect= true;
             continue;
          }
          
-         char * raw_image= (char *) msg.data();
-         
-         new_atype = *( (uint8_t *) (raw_image + typeOffset) );
-         new_nx = *( (uint32_t *) (raw_image + size0Offset));
-         new_ny = *( (uint32_t *) (raw_image + size1Offset));
-         
-         if( nx != new_nx || ny != new_ny || atype != new_atype)
-         {
-            imsize[0] = new_nx;
-            imsize[1] = new_ny;
-            imsize[2] = 0;
-            
-            if(opened)
-            {
-               ImageStreamIO_destroyIm(&image);
-            }
-            
-            ImageStreamIO_createIm(&image, shMemImName.c_str(), 2, imsize, new_atype, 1, 0, 0);
-            
-            opened = true;
-            
-            xe = xrif_set_size(xrif, new_nx, new_ny, 1, 1, new_atype);
-            xrif_set_difference_method(xrif, *((int16_t *) (raw_image + xrifDifferenceOffset)));
-            xrif_set_reorder_method(xrif, *((int16_t *) (raw_image + xrifReorderOffset)));
-            xrif_set_compress_method(xrif, *((int16_t *) (raw_image+ xrifCompressOffset)));
-            
-            xe = xrif_allocate(xrif);
-         }
-         
-         atype = new_atype;
-         nx = new_nx;
-         ny = new_ny;
-         
-      
-         //This is not a rolling buffer.
-         curr_image = 0;
-         
-         size_t type_size = ImageStreamIO_typesize(image.md[0].datatype);
-      
-         image.md[0].write=1;
-      
-         image.md[0].cnt0 = *( (uint64_t *) (raw_image + cnt0Offset));
-         image.md[0].writetime.tv_sec = *( (uint64_t *) (raw_image + tv_secOffset));
-         image.md[0].writetime.tv_nsec = *( (uint64_t *) (raw_image + tv_nsecOffset));
-         
-         xrif->compressed_size =  *((uint32_t *) (raw_image + xrifSizeOffset));
-         
-         memcpy(xrif->raw_buffer, raw_image + imageOffset, xrif->compressed_size);
-         xe = xrif_decode(xrif);
-         
-         memcpy(image.array.SI8 + curr_image*nx*ny*type_size, xrif->raw_buffer, nx*ny*type_size);
-         
-         image.md[0].cnt1=0;
-         image.md[0].write=0;
-         ImageStreamIO_sempost(&image,-1);
-         
-         #ifdef MZMQ_FPS_MONITORING
-         if(Nrecvd >= 10)
-         {
-            Nrecvd = 0;
-            t0 = get_curr_time();
-         }
-         else ++Nrecvd;
-         
-         if(Nrecvd >= 10)
-         {
-            t1 = get_curr_time() - t0;
-            std::cerr << imageName << " averaging " << Nrecvd/t1 << " FPS received.\n";
-         }
-         #endif
+         localStreamDecode(ls, msg, msgData, msgSize);
 
          //Here is where we can add client-specefic rate control!
          
-         request.rebuild(imageName.data(), imageName.size());
+         //Replace the credit this frame used.
+         localStreamRequest(ls, 1);
+         request.rebuild(ls.m_reqData, requestSize);
          //memcpy( request.data(), imageName.c_str(), imageName.size());
          #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
          subscriber.send(request, zmq::send_flags::dontwait);
@@ -583,32 +1240,1178 @@ void milkzmqClient::imageThreadExec( const std::string & imageName,
       
       subscriber.close(); //close so that unsent messages are dropped.
       
-      //To trigger a full reconnect:
-      
-      if(opened) ImageStreamIO_closeIm(&image);
-      opened = false;
-      
-      atype=0;
-      nx =0;
-      ny =0;
+      //The local stream is kept open, so its readers do not notice the reconnect.  It is only re-created if the 
+      //shape or type of the frames changes.  The server may have restarted, so its sequence numbers start over.
+      ls.m_reconnected.store(true, std::memory_order_release);
     
       first = true;
       connected = false;
       
-      #ifdef MZMQ_FPS_MONITORING
-      Nrecvd = 100;
-      t0 = 0;
-      #endif
-      
       reportNotice("Disconnected from " + imageName);
          
    }// outer loop (checking stale connections)
    
-   if(opened) ImageStreamIO_closeIm(&image);
-   xrif_delete(xrif);
+   localStreamFree(ls);
    
 } // milkzmqClient::imageThreadExec()
 
+inline
+void milkzmqClient::localStreamSetup( s_localStream & ls,
+                                      const std::string & imageName,
+                                      const std::string & localImageName
+                                    )
+{
+   ls.m_imageName = imageName;
+   ls.m_endpoint = endpoint();
+   
+   if(localImageName == "") ls.m_shMemImName = imageName;
+   else 
+   {
+      ls.m_shMemImName = localImageName;
+      reportInfo("Writing " + imageName + " to " + ls.m_shMemImName);
+   }
+   
+   if(m_decodeThreads > 0 && m_decodeDepth > 0) ls.m_waiting.capacity(m_decodeDepth);
+   
+   std::lock_guard<std::mutex> lock(m_localStreamsMutex);
+   m_localStreams.push_back(&ls);
+   
+   /* Initialize xrif
+    */
+   xrif_new(&ls.m_xrif);
+   xrif_new(&ls.m_directXrif); //for decoding straight into the stream, see decodeFrame
+   
+   //The request: the name, followed by our rate and flags.
+   char * reqData = ls.m_reqData;
+   memset(reqData, 0, requestSize);
+   snprintf(reqData, nameSize, "%s", imageName.c_str());
+   float reqFps = m_fpsTgt;
+   memcpy(reqData + reqFpsOffset, &reqFps, sizeof(float));
+   uint8_t & reqFlags = *((uint8_t *) reqData + reqFlagsOffset);
+   if(m_deltaFrames) reqFlags |= reqFlagDelta;
+   if(m_burst) reqFlags |= reqFlagBurst;
+   uint32_t reqRoi[4] = {m_roiX0, m_roiY0, m_roiWidth, m_roiHeight};
+   memcpy(reqData + reqRoiOffset, reqRoi, sizeof(reqRoi));
+   *((uint8_t *) reqData + reqBinOffset) = m_binFactor;
+   if(m_binMean) reqFlags |= reqFlagBinMean;
+   *((uint8_t *) reqData + reqConvertOffset) = m_convert;
+   memcpy(reqData + reqWindowOffset, &m_creditWindow, sizeof(uint16_t));
+   localStreamRequest(ls, m_creditWindow);
+}
+
+inline
+void milkzmqClient::localStreamRequest( s_localStream & ls,
+                                        uint16_t credit
+                                      )
+{
+   memcpy(ls.m_reqData + reqCreditOffset, &credit, sizeof(uint16_t));
+   
+   uint8_t & reqFlags = *((uint8_t *) ls.m_reqData + reqFlagsOffset);
+   if(ls.m_needKey.load(std::memory_order_relaxed)) reqFlags |= reqFlagKeyframe;
+   else reqFlags &= ~reqFlagKeyframe;
+}
+
+inline
+void milkzmqClient::localStreamHangup( s_localStream & ls )
+{
+   if(ls.m_connected) reportNotice("Disconnected from " + ls.m_imageName);
+   ls.m_connected = false;
+   
+   //The restarted server may serve the stream elsewhere, and its sequence numbers start over.
+   ls.m_endpoint = endpoint();
+   ls.m_reconnected.store(true, std::memory_order_release);
+   
+   //Give the server a second to finish its shutdown before requesting again.
+   ls.m_lastRequest = get_mono_nsec();
+}
+
+inline
+void milkzmqClient::localStreamFree( s_localStream & ls )
+{
+   //A decode thread could still be working on the stream.  They all exit on m_timeToDie, as we do.
+   if(m_decodeThreads > 0)
+   {
+      while(m_decodeRunning.load(std::memory_order_acquire) > 0) microsleep(1000);
+      
+      s_frameMsg * fm = ls.m_newest.exchange(nullptr, std::memory_order_acq_rel);
+      if(fm != nullptr) delete fm;
+      while(ls.m_waiting.pop(fm)) delete fm;
+   }
+   
+   {
+      std::lock_guard<std::mutex> lock(m_localStreamsMutex);
+      for(size_t n = 0; n < m_localStreams.size(); ++n)
+      {
+         if(m_localStreams[n] != &ls) continue;
+         m_localStreams.erase(m_localStreams.begin() + n);
+         break;
+      }
+   }
+   
+   if(ls.m_opened) ImageStreamIO_closeIm(&ls.m_image);
+   ls.m_opened = false;
+   
+   xrif_delete(ls.m_xrif);
+   xrif_delete(ls.m_directXrif);
+   if(ls.m_batchXrif != nullptr) xrif_delete(ls.m_batchXrif);
+   
+   ls.m_xrif = nullptr;
+   ls.m_directXrif = nullptr;
+   ls.m_batchXrif = nullptr;
+}
+
+inline
+void milkzmqClient::localStreamDecode( s_localStream & ls,
+                                       zmq::message_t & msg,
+                                       char * msgData,
+                                       size_t msgSize
+                                     )
+{
+   int64_t arrival = get_real_nsec();
+   
+   if(m_decodeThreads == 0)
+   {
+      receiveFrame(ls, msgData, msgSize, arrival);
+      return;
+   }
+   
+   //Take over the message, or copy a reassembled one.
+   s_frameMsg * frame = new s_frameMsg;
+   if(msgData == (char *) msg.data()) frame->m_msg = std::move(msg);
+   else frame->m_msg.rebuild(msgData, msgSize);
+   frame->m_arrival = arrival;
+   
+   if(m_decodeDepth == 0)
+   {
+      //Keep only the newest.  One which the decode threads have not got to yet is replaced.
+      s_frameMsg * old = ls.m_newest.exchange(frame, std::memory_order_acq_rel);
+      if(old != nullptr)
+      {
+         delete old;
+         ls.m_dropped.fetch_add(1, std::memory_order_relaxed);
+      }
+   }
+   else if(!ls.m_waiting.push(frame))
+   {
+      delete frame;
+      ls.m_dropped.fetch_add(1, std::memory_order_relaxed);
+   }
+   
+   //Only the hand-off which sets the flag queues the stream, and the decode thread clears it when it runs out of frames.
+   if(!ls.m_queued.exchange(true, std::memory_order_acq_rel))
+   {
+      //Each stream is on the queue at most once, and it holds them all, so it is never full unless that is broken.
+      if(m_decodeQueue.push(&ls)) sem_post(&m_decodeSem);
+      else
+      {
+         reportError(ls.m_imageName + ": the decode queue is full", __FILE__, __LINE__);
+         ls.m_queued.store(false, std::memory_order_release); //so the next hand-off tries again
+      }
+   }
+   
+   int64_t now = get_mono_nsec();
+   if(now - ls.m_droppedTime > 10000000000LL)
+   {
+      uint64_t dropped = ls.m_dropped.load(std::memory_order_relaxed);
+      if(dropped > ls.m_droppedReported)
+      {
+         reportWarning(ls.m_imageName + ": " + std::to_string(dropped - ls.m_droppedReported) + " frames were dropped waiting to be decoded in the last 10 s");
+      }
+      ls.m_droppedReported = dropped;
+      ls.m_droppedTime = now;
+   }
+}
+
+inline
+std::string milkzmqClient::histogramReport( bool reset )
+{
+   std::string rep;
+   
+   std::lock_guard<std::mutex> lock(m_localStreamsMutex);
+   
+   for(size_t n = 0; n < m_localStreams.size(); ++n)
+   {
+      s_localStream * ls = m_localStreams[n];
+      
+      rep += ls->m_imageName + " latency: " + ls->m_latency.summary() + "\n";
+      rep += ls->m_imageName + " jitter: " + ls->m_jitter.summary() + "\n";
+      rep += ls->m_imageName + " decode: " + ls->m_decodeTime.summary() + "\n";
+      
+      if(reset)
+      {
+         ls->m_latency.reset();
+         ls->m_jitter.reset();
+         ls->m_decodeTime.reset();
+      }
+   }
+   
+   return rep;
+}
+
+inline
+void milkzmqClient::internal_decodeThreadStart( milkzmqClient * mzc )
+{
+   mzc->decodeThreadExec();
+}
+
+inline
+int milkzmqClient::decodeThreadsStart()
+{
+   if(m_decodeThreads == 0 || m_decodeThreadPool.size() > 0) return 0;
+   
+   m_decodeQueue.capacity(m_imageThreads.size());
+   sem_init(&m_decodeSem, 0, 0);
+   
+   for(int n = 0; n < m_decodeThreads; ++n)
+   {
+      m_decodeRunning.fetch_add(1, std::memory_order_acq_rel);
+      
+      try
+      {
+         m_decodeThreadPool.push_back(std::thread( internal_decodeThreadStart, this));
+      }
+      catch( const std::exception & e )
+      {
+         m_decodeRunning.fetch_sub(1, std::memory_order_acq_rel);
+         reportError(std::string("exception in decode thread startup: ") + e.what(), __FILE__, __LINE__);
+         return -1;
+      }
+      catch( ... )
+      {
+         m_decodeRunning.fetch_sub(1, std::memory_order_acq_rel);
+         reportError("unknown exception in decode thread startup" , __FILE__, __LINE__);
+         return -1;
+      }
+   }
+   
+   return 0;
+}
+
+inline
+void milkzmqClient::decodeThreadExec()
+{
+   while(!m_timeToDie)
+   {
+      //Wake up now and then to check m_timeToDie.
+      timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 100000000;
+      if(ts.tv_nsec >= 1000000000)
+      {
+         ts.tv_nsec -= 1000000000;
+         ++ts.tv_sec;
+      }
+      
+      if(sem_timedwait(&m_decodeSem, &ts) < 0) continue;
+      
+      //The post means a stream is on the queue, but the pop fails while a push ahead of it has claimed its cell and 
+      //not yet filled it.  That push is about to finish, so we try again rather than lose the wake-up.
+      s_localStream * ls;
+      bool popped;
+      while(!(popped = m_decodeQueue.pop(ls)) && !m_timeToDie) std::this_thread::yield();
+      
+      if(!popped) break;
+      
+      //We own the stream until we clear m_queued, so no other thread decodes it meanwhile.
+      while(!m_timeToDie)
+      {
+         s_frameMsg * fm = nullptr;
+         
+         if(m_decodeDepth == 0) fm = ls->m_newest.exchange(nullptr, std::memory_order_acq_rel);
+         else ls->m_waiting.pop(fm);
+         
+         if(fm == nullptr)
+         {
+            ls->m_queued.store(false, std::memory_order_seq_cst);
+            
+            //A frame handed off after we looked, but before the flag was cleared, did not queue the stream.  So we go on with it.
+            bool more = (m_decodeDepth == 0) ? (ls->m_newest.load(std::memory_order_seq_cst) != nullptr) : !ls->m_waiting.empty();
+            if(more && !ls->m_queued.exchange(true, std::memory_order_acq_rel)) continue;
+            
+            break;
+         }
+         
+         receiveFrame(*ls, (char *) fm->m_msg.data(), fm->m_msg.size(), fm->m_arrival);
+         delete fm;
+      }
+   }
+   
+   m_decodeRunning.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+inline
+void milkzmqClient::receiveFrame( s_localStream & ls,
+                                  char * msgData,
+                                  size_t msgSize,
+                                  int64_t arrival
+                                )
+{
+   int64_t decodeStart = get_mono_nsec();
+   
+   //The stream's state, by the names used for decoding.
+   const std::string & imageName = ls.m_imageName;
+   const std::string & shMemImName = ls.m_shMemImName;
+   
+   uint8_t new_atype, & atype = ls.m_atype;
+   uint64_t new_nx, & nx = ls.m_nx;
+   uint64_t new_ny, & ny = ls.m_ny;
+   uint32_t new_nz, & nz = ls.m_nz;
+   uint8_t new_naxis, & naxis = ls.m_naxis;
+   uint8_t new_convert, & convert = ls.m_convert;
+   uint8_t new_wire, & wire = ls.m_wire;
+   int16_t new_difference, & difference = ls.m_difference;
+   int16_t new_reorder, & reorder = ls.m_reorder;
+   int16_t new_compress, & compress = ls.m_compress;
+   
+   std::vector<char> & scratch = ls.m_scratch;
+   std::vector<char> & deltaBuf = ls.m_deltaBuf;
+   std::vector<char> & convertBuf = ls.m_convertBuf;
+   uint64_t & heldSeq = ls.m_heldSeq;
+   
+   std::vector<char> & batchBuf = ls.m_batchBuf;
+   std::vector<uint64_t> & batchMeta = ls.m_batchMeta;
+   xrif_t & batchXrif = ls.m_batchXrif;
+   uint32_t & batchFrames = ls.m_batchFrames;
+   int16_t & batchDifference = ls.m_batchDifference;
+   int16_t & batchReorder = ls.m_batchReorder;
+   int16_t & batchCompress = ls.m_batchCompress;
+   
+   xrif_error_t xe;
+   xrif_t xrif = ls.m_xrif;
+   xrif_t directXrif = ls.m_directXrif;
+   
+   IMAGE & image = ls.m_image;
+   bool & opened = ls.m_opened;
+   uint32_t imsize[3];
+   uint32_t curr_image;
+   
+   #ifdef MZMQ_FPS_MONITORING
+   int & Nrecvd = ls.m_Nrecvd;
+   double & t0 = ls.m_t0;
+   double t1;
+   #endif
+   
+   //The server may have restarted, so its sequence numbers start over.
+   if(ls.m_reconnected.exchange(false, std::memory_order_acq_rel))
+   {
+      heldSeq = 0;
+      ls.m_lastSource = 0;
+      
+      #ifdef MZMQ_FPS_MONITORING
+      Nrecvd = 100;
+      t0 = 0;
+      #endif
+   }
+   
+   char * raw_image = msgData;
+   
+   bool posted = false; //whether the message was written to the local stream
+   
+   new_atype = *( (uint8_t *) (raw_image + typeOffset) );
+   new_nx = *( (uint32_t *) (raw_image + size0Offset));
+   new_ny = *( (uint32_t *) (raw_image + size1Offset));
+   new_naxis = *( (uint8_t *) (raw_image + naxisOffset));
+   new_nz = *( (uint32_t *) (raw_image + size2Offset));
+   if(new_naxis < 3 || new_nz < 1)
+   {
+      new_naxis = 2;
+      new_nz = 0;
+   }
+   new_difference = *((int16_t *) (raw_image + xrifDifferenceOffset));
+   new_reorder = *((int16_t *) (raw_image + xrifReorderOffset));
+   new_compress = *((int16_t *) (raw_image + xrifCompressOffset));
+   
+   uint8_t frameFlags = *((uint8_t *) (raw_image + frameFlagsOffset));
+   bool isBatch = (frameFlags & frameFlagBatch);
+   
+   new_convert = *((uint8_t *) (raw_image + convertOffset));
+   if(!(frameFlags & frameFlagRoi) || new_convert > convertBf16 || !convertible(new_atype)) new_convert = convertNone;
+   new_wire = (new_convert != convertNone) ? convertedType(new_convert) : new_atype;
+   
+   if( nx != new_nx || ny != new_ny || nz != new_nz || naxis != new_naxis || atype != new_atype)
+   {
+      imsize[0] = new_nx;
+      imsize[1] = new_ny;
+      imsize[2] = new_nz;
+      
+      //A stream left by an earlier run is reused if it matches, and carries on from its last slice.
+      if(!opened && openLocal(image, shMemImName, new_naxis, imsize, new_atype))
+      {
+         reportInfo("Reusing existing " + shMemImName);
+      }
+      else
+      {
+         if(opened)
+         {
+            ImageStreamIO_destroyIm(&image);
+         }
+         
+         //A circular buffer is mirrored as one, so local readers have the recent history too.
+         ImageStreamIO_createIm(&image, shMemImName.c_str(), new_naxis, imsize, new_atype, 1, 0, 0);
+         image.md[0].cnt1 = (new_nz > 0) ? new_nz - 1 : 0; //so the first frame goes in slice 0
+      }
+      
+      opened = true;
+      heldSeq = 0;
+      batchFrames = 0;
+      
+      if(frameFlags & frameFlagRoi)
+      {
+         const char * convs[] = {"", " as int16", " as fp16", " as bf16"};
+         int bin = *((uint8_t *) (raw_image + binOffset));
+         reportInfo("Region of interest of " + imageName + ": " + std::to_string(new_nx) + "x" + std::to_string(new_ny) + " at " + 
+                      std::to_string(*((uint32_t *) (raw_image + roiX0Offset))) + "," + std::to_string(*((uint32_t *) (raw_image + roiY0Offset))) +
+                      ( bin > 1 ? " binned by " + std::to_string(bin) + (*((uint8_t *) (raw_image + binMeanOffset)) ? " (mean)" : " (sum)") : std::string("")) +
+                      convs[new_convert]);
+      }
+   }
+   
+   if(isBatch)
+   {
+      //Several frames in one cube, with their own xrif handle.
+      uint32_t nframes = *((uint32_t *) (raw_image + nframesOffset));
+      
+      if(new_reorder == reorderByteShuffle)
+      {
+         scratch.resize(nframes*new_nx*new_ny*ImageStreamIO_typesize(new_atype));
+      }
+      else if( nframes != batchFrames || new_difference != batchDifference || new_reorder != batchReorder || new_compress != batchCompress )
+      {
+         if(batchXrif == nullptr) xrif_new(&batchXrif);
+         
+         xe = xrif_set_size(batchXrif, new_nx, new_ny, 1, nframes, new_atype);
+         xrif_set_difference_method(batchXrif, new_difference);
+         xrif_set_reorder_method(batchXrif, new_reorder);
+         xrif_set_compress_method(batchXrif, new_compress);
+         
+         xe = xrif_allocate(batchXrif);
+         
+         batchFrames = nframes;
+         batchDifference = new_difference;
+         batchReorder = new_reorder;
+         batchCompress = new_compress;
+      }
+   }
+   else if(new_reorder == reorderByteShuffle) //our own codec, which xrif does not know about.
+   {
+      scratch.resize(new_nx*new_ny*ImageStreamIO_typesize(new_wire));
+   }
+   else if( nx != new_nx || ny != new_ny || wire != new_wire || difference != new_difference || reorder != new_reorder || compress != new_compress )
+   {
+      xe = xrif_set_size(xrif, new_nx, new_ny, 1, 1, new_wire);
+      xrif_set_difference_method(xrif, new_difference);
+      xrif_set_reorder_method(xrif, new_reorder);
+      xrif_set_compress_method(xrif, new_compress);
+      
+      xe = xrif_allocate(xrif);
+      
+      //The direct handle only owns the reordered buffer.  Its raw buffer is the frame and its compressed buffer the message.
+      xe = xrif_set_size(directXrif, new_nx, new_ny, 1, 1, new_wire);
+      xrif_set_difference_method(directXrif, new_difference);
+      xrif_set_reorder_method(directXrif, new_reorder);
+      xrif_set_compress_method(directXrif, new_compress);
+      directXrif->compress_on_raw = 0;
+      
+      xe = xrif_allocate_reordered(directXrif);
+   }
+   
+   atype = new_atype;
+   nx = new_nx;
+   ny = new_ny;
+   nz = new_nz;
+   naxis = new_naxis;
+   if(!isBatch)
+   {
+      difference = new_difference;
+      reorder = new_reorder;
+      compress = new_compress;
+      wire = new_wire;
+   }
+   convert = new_convert;
+   
+   
+   size_t type_size = ImageStreamIO_typesize(image.md[0].datatype);
+
+   uint32_t compressedSize = *((uint32_t *) (raw_image + xrifSizeOffset));
+   uint64_t seq = *((uint64_t *) (raw_image + seqOffset));
+   uint64_t refSeq = *((uint64_t *) (raw_image + refSeqOffset));
+   
+   size_t nbytes = nx*ny*type_size;
+   
+   //The slice the next frame is written to.  For a circular buffer this advances cnt1 the way the source does.
+   //The slice holding the last frame written is needed as the reference of a delta frame.
+   uint32_t prev_image = image.md[0].cnt1;
+   curr_image = (nz > 0) ? (prev_image + 1) % nz : 0;
+   char * frame = (char *) image.array.SI8 + curr_image*nbytes;
+   
+   if(isBatch)
+   {
+      //Consecutive frames encoded together.  The payload starts with the table of their counters and times.
+      uint32_t nframes = *((uint32_t *) (raw_image + nframesOffset));
+      size_t tableSize = 3*((size_t) nframes)*sizeof(uint64_t);
+      
+      bool good = (nframes > 0 && compressedSize >= tableSize && msgSize >= imageOffset + compressedSize);
+      
+      if(good)
+      {
+         batchMeta.resize(3*nframes);
+         memcpy(batchMeta.data(), raw_image + imageOffset, tableSize);
+         
+         batchBuf.resize(nframes*nbytes);
+         if( decodeFrame(batchBuf.data(), raw_image + imageOffset + tableSize, compressedSize - tableSize, batchXrif, nullptr, new_difference, new_reorder, 
+                           new_compress, scratch, nframes*nx*ny, type_size) < 0 ) good = false;
+      }
+      
+      if(good && new_reorder == reorderByteShuffle && new_difference == XRIF_DIFFERENCE_PREVIOUS)
+      {
+         //Each frame after the first is its delta from the one before.  Both XOR and modular addition commute, 
+         //so undelta-ing the delta by the previous frame gives the frame in place.
+         for(uint32_t k = 1; k < nframes; ++k)
+         {
+            frameUndelta(batchBuf.data() + k*nbytes, batchBuf.data() + (k-1)*nbytes, nbytes, type_size, deltaIsXor(atype));
+         }
+      }
+      
+      if(good)
+      {
+         for(uint32_t k = 0; k < nframes; ++k)
+         {
+            image.md[0].write=1;
+            memcpy(frame, batchBuf.data() + k*nbytes, nbytes);
+            image.md[0].cnt0 = batchMeta[3*k];
+            image.md[0].writetime.tv_sec = batchMeta[3*k + 1];
+            image.md[0].writetime.tv_nsec = batchMeta[3*k + 2];
+            image.md[0].cnt1 = curr_image;
+            image.md[0].write=0;
+            ImageStreamIO_sempost(&image,-1);
+         }
+         
+         ls.m_needKey.store(false, std::memory_order_relaxed);
+         posted = true;
+      }
+      else reportError("error decoding batch for " + imageName, __FILE__, __LINE__);
+      
+      heldSeq = 0; //batches are never delta references
+   }
+   else if(frameFlags & frameFlagBurst)
+   {
+      //Every frame written to the server's circular buffer since the last we got, oldest first.
+      uint32_t nframes = *((uint32_t *) (raw_image + nframesOffset));
+      uint64_t cnt0 = *( (uint64_t *) (raw_image + cnt0Offset));
+      
+      const char * slice = raw_image + imageOffset;
+      const char * end = raw_image + msgSize;
+      
+      bool good = true;
+      for(uint32_t n = 0; n < nframes; ++n)
+      {
+         if(slice + burstSliceHeaderSize > end)
+         {
+            good = false;
+            break;
+         }
+         
+         uint32_t sliceSize = *((uint32_t *) slice);
+         int16_t sliceCompress = *((int16_t *) (slice + sizeof(uint32_t)));
+         
+         image.md[0].write=1;
+         
+         if(slice + burstSliceHeaderSize + sliceSize > end ||
+               decodeFrame(frame, slice + burstSliceHeaderSize, sliceSize, xrif, directXrif, difference, reorder, sliceCompress, scratch, nx*ny, type_size) < 0)
+         {
+            image.md[0].write=0;
+            good = false;
+            break;
+         }
+         
+         //Each frame has its own count and time.  One whose time the server did not know gets the newest frame's.
+         uint64_t sliceCnt0, sliceSec, sliceNsec;
+         memcpy(&sliceCnt0, slice + burstSliceCnt0Offset, sizeof(uint64_t));
+         memcpy(&sliceSec, slice + burstSliceSecOffset, sizeof(uint64_t));
+         memcpy(&sliceNsec, slice + burstSliceNsecOffset, sizeof(uint64_t));
+         if(sliceSec == 0 && sliceNsec == 0)
+         {
+            sliceSec = *( (uint64_t *) (raw_image + tv_secOffset));
+            sliceNsec = *( (uint64_t *) (raw_image + tv_nsecOffset));
+         }
+         
+         image.md[0].cnt0 = (sliceCnt0 != 0) ? sliceCnt0 : cnt0 - (nframes - 1 - n);
+         image.md[0].writetime.tv_sec = sliceSec;
+         image.md[0].writetime.tv_nsec = sliceNsec;
+         image.md[0].cnt1 = curr_image;
+         image.md[0].write=0;
+         ImageStreamIO_sempost(&image,-1);
+         
+         //Each frame goes in the next slice of a mirrored circular buffer
+         if(nz > 0)
+         {
+            curr_image = (curr_image + 1) % nz;
+            frame = (char *) image.array.SI8 + curr_image*nbytes;
+         }
+         
+         slice += burstSliceHeaderSize + sliceSize;
+      }
+      
+      if(!good) reportError("error decoding burst for " + imageName, __FILE__, __LINE__);
+      
+      heldSeq = good ? seq : 0;
+      posted = good;
+   }
+   else
+   {
+      //A delta frame is decoded separately, then applied to the frame we hold.
+      bool isDelta = (frameFlags & frameFlagDelta);
+      bool good = true;
+      
+      char * dest = frame;
+      if(isDelta)
+      {
+         if(refSeq == 0 || refSeq != heldSeq) good = false; //we don't have its reference
+         
+         deltaBuf.resize(nbytes);
+         dest = deltaBuf.data();
+      }
+      
+      image.md[0].write=1;
+      
+      //A converted frame is decoded as its 16 bit type, then converted back to the local type.
+      char * decodeDest = dest;
+      size_t decodeTypeSize = type_size;
+      if(convert != convertNone)
+      {
+         convertBuf.resize(nx*ny*sizeof(uint16_t));
+         decodeDest = convertBuf.data();
+         decodeTypeSize = sizeof(uint16_t);
+      }
+      
+      if(good)
+      {
+         if(msgSize < imageOffset + compressedSize || 
+               decodeFrame(decodeDest, raw_image + imageOffset, compressedSize, xrif, directXrif, difference, reorder, compress, scratch, nx*ny, decodeTypeSize) < 0)
+         {
+            reportError("error decoding frame for " + imageName, __FILE__, __LINE__);
+            good = false;
+         }
+      }
+      
+      if(good && convert != convertNone)
+      {
+         double convertScale = *((double *) (raw_image + convertScaleOffset));
+         double convertZero = *((double *) (raw_image + convertZeroOffset));
+         unconvertFrame(dest, decodeDest, atype, nx*ny, convert, convertScale, convertZero);
+      }
+      
+      if(good && isDelta)
+      {
+         //In a circular buffer the reference is in the previous slice.
+         if(curr_image != prev_image) memcpy(frame, (char *) image.array.SI8 + prev_image*nbytes, nbytes);
+         frameUndelta(frame, dest, nbytes, type_size, deltaIsXor(atype));
+      }
+      
+      if(good)
+      {
+         image.md[0].cnt0 = *( (uint64_t *) (raw_image + cnt0Offset));
+         image.md[0].writetime.tv_sec = *( (uint64_t *) (raw_image + tv_secOffset));
+         image.md[0].writetime.tv_nsec = *( (uint64_t *) (raw_image + tv_nsecOffset));
+         image.md[0].cnt1 = curr_image;
+         image.md[0].write=0;
+         ImageStreamIO_sempost(&image,-1);
+         
+         heldSeq = seq;
+         ls.m_needKey.store(false, std::memory_order_relaxed);
+         posted = true;
+      }
+      else
+      {
+         //Ask for a keyframe with the next request.  Until we get it the local stream is not updated.
+         image.md[0].write=0;
+         heldSeq = 0;
+         ls.m_needKey.store(true, std::memory_order_relaxed);
+      }
+   }
+   
+   if(posted)
+   {
+      ls.m_decodeTime.record(get_mono_nsec() - decodeStart);
+      
+      //The time the source wrote the frame, or the newest frame of a batch or burst.
+      int64_t source = *((uint64_t *) (raw_image + tv_secOffset))*1000000000LL + *((uint64_t *) (raw_image + tv_nsecOffset));
+      
+      if(source > 0)
+      {
+         ls.m_latency.record(get_real_nsec() - source);
+         
+         //The jitter only uses differences of each clock, so it does not need them synchronized.
+         if(ls.m_lastSource > 0) ls.m_jitter.record(std::abs((arrival - ls.m_lastArrival) - (source - ls.m_lastSource)));
+         
+         ls.m_lastSource = source;
+         ls.m_lastArrival = arrival;
+      }
+   }
+   
+   #ifdef MZMQ_FPS_MONITORING
+   if(Nrecvd >= 10)
+   {
+      Nrecvd = 0;
+      t0 = get_curr_time();
+   }
+   else ++Nrecvd;
+   
+   if(Nrecvd >= 10)
+   {
+      t1 = get_curr_time() - t0;
+      std::cerr << imageName << " averaging " << Nrecvd/t1 << " FPS received.\n";
+   }
+   #endif
+} // milkzmqClient::receiveFrame()
+
+inline
+void milkzmqClient::internal_eventLoopStart( milkzmqClient * mzc )
+{
+   if(mzc->m_radioEndpoint != "") mzc->radioLoopExec();
+   else mzc->eventLoopExec();
+}
+
+inline
+int milkzmqClient::eventLoopStart()
+{
+   if(decodeThreadsStart() < 0) return -1;
+   
+   try
+   {
+      m_eventLoopThread = std::thread( internal_eventLoopStart, this);
+   }
+   catch( const std::exception & e )
+   {
+      reportError(std::string("exception in event loop startup: ") + e.what(), __FILE__, __LINE__);
+      return -1;
+   }
+   catch( ... )
+   {
+      reportError("unknown exception in event loop startup" , __FILE__, __LINE__);
+      return -1;
+   }
+   
+   if(!m_eventLoopThread.joinable())
+   {
+      reportError("event loop thread did not start" , __FILE__, __LINE__);
+      return -1;      
+   }
+   
+   return 0;
+}
+
+inline
+void milkzmqClient::eventLoopExec()
+{
+   if(m_imageThreads.size() == 0) return;
+   
+   reportInfo("Beginning receive at " + endpoint() + " for " + std::to_string(m_imageThreads.size()) + " streams in one event loop");
+   
+   //Constructed in place and never resized, so the pointers to them stay valid.
+   std::vector<s_localStream> streams(m_imageThreads.size());
+   std::unordered_map<std::string, s_localStream *> byName; //the streams by remote name, which the server puts in the header of each message
+   
+   for(size_t n = 0; n < streams.size(); ++n)
+   {
+      localStreamSetup(streams[n], m_imageThreads[n].m_imageName, m_imageThreads[n].m_localImageName);
+      byName[streams[n].m_imageName] = &streams[n];
+   }
+   
+   //One socket for each server socket we are sent to, which is just one unless the server shards its streams.
+   std::map<std::string, zmq::socket_t *> sockets;
+   
+   void * poller = zmq_poller_new();
+   std::vector<zmq_poller_event_t> events;
+   
+   while(!m_timeToDie)
+   {
+      try
+      {
+         //Request each stream not heard from for a second, which also starts them.  This is what the image threads do when their receive times out.
+         int64_t now = get_mono_nsec();
+         
+         for(size_t n = 0; n < streams.size(); ++n)
+         {
+            s_localStream & ls = streams[n];
+            
+            if(now - ls.m_lastRequest < 1000000000LL) continue;
+            
+            zmq::socket_t * sock = sockets[ls.m_endpoint];
+            if(sock == nullptr)
+            {
+               sock = new zmq::socket_t(*m_ZMQ_context, ZMQ_CLIENT);
+               #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+               sock->set(zmq::sockopt::linger, 0);
+               #else
+               sock->setsockopt(ZMQ_LINGER, 0);
+               #endif
+               sock->connect(ls.m_endpoint);
+               
+               zmq_poller_add(poller, (void *) *sock, sock, ZMQ_POLLIN);
+               sockets[ls.m_endpoint] = sock;
+               events.resize(sockets.size());
+            }
+            
+            localStreamRequest(ls, m_creditWindow);
+            zmq::message_t request(ls.m_reqData, requestSize);
+            #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+            sock->send(request, zmq::send_flags::dontwait);
+            #else
+            sock->send(request, ZMQ_DONTWAIT);
+            #endif
+            
+            ls.m_lastRequest = now;
+         }
+         
+         int nev = zmq_poller_wait_all(poller, events.data(), events.size(), 100);
+         
+         if(nev < 0)
+         {
+            if(m_timeToDie) break;
+            if(zmq_errno() == EAGAIN || zmq_errno() == EINTR) continue; //timed out, or signaled
+            
+            reportError(std::string("error polling: ") + zmq_strerror(zmq_errno()), __FILE__, __LINE__);
+            break;
+         }
+         
+         for(int e = 0; e < nev; ++e)
+         {
+            zmq::socket_t * sock = (zmq::socket_t *) events[e].user_data;
+            
+            //Take everything waiting on this socket, each message for whichever stream it names.
+            while(!m_timeToDie)
+            {
+               zmq::message_t msg;
+               
+               #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+               if(!sock->recv(msg, zmq::recv_flags::dontwait)) break;
+               #else
+               if(!sock->recv(&msg, ZMQ_DONTWAIT)) break;
+               #endif
+               
+               char * msgData = (char *) msg.data();
+               size_t msgSize = msg.size();
+               
+               //An older server hangs up with a single byte, which does not name the stream, so all of this socket's streams hang up.
+               if(msgSize < nameSize)
+               {
+                  for(size_t n = 0; n < streams.size(); ++n)
+                  {
+                     if(sockets[streams[n].m_endpoint] == sock) localStreamHangup(streams[n]);
+                  }
+                  continue;
+               }
+               
+               auto it = byName.find(std::string(msgData, strnlen(msgData, nameSize)));
+               if(it == byName.end()) continue;
+               
+               s_localStream & ls = *it->second;
+               
+               if(msgSize >= headerSize && (*((uint8_t *) msgData + frameFlagsOffset) & frameFlagRedirect))
+               {
+                  uint32_t port = *((uint32_t *) (msgData + redirectPortOffset));
+                  
+                  //A tcp server binds a wildcard address, so for tcp we keep our host and take only the port.
+                  if(port > 0 && ls.m_endpoint.compare(0, 6, "tcp://") == 0) ls.m_endpoint = ls.m_endpoint.substr(0, ls.m_endpoint.rfind(':') + 1) + std::to_string(port);
+                  else ls.m_endpoint = std::string(msgData + headerSize, msgSize - headerSize);
+                  
+                  reportInfo("Redirected to " + ls.m_endpoint + " for " + ls.m_imageName);
+                  
+                  ls.m_reconnected.store(true, std::memory_order_release);
+                  ls.m_lastRequest = 0; //request from the new socket right away
+                  continue;
+               }
+               
+               if(msgSize <= headerSize)
+               {
+                  localStreamHangup(ls);
+                  continue;
+               }
+               
+               if(!ls.m_connected)
+               {
+                  reportNotice("Connected to " + ls.m_imageName);
+                  ls.m_connected = true;
+               }
+               
+               localStreamDecode(ls, msg, msgData, msgSize);
+               
+               //The next request goes out as soon as this frame is handled, as in the image threads, replacing the credit it used.
+               localStreamRequest(ls, 1);
+               zmq::message_t request(ls.m_reqData, requestSize);
+               #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+               sock->send(request, zmq::send_flags::dontwait);
+               #else
+               sock->send(request, ZMQ_DONTWAIT);
+               #endif
+               
+               ls.m_lastRequest = get_mono_nsec();
+            }
+         }
+      }
+      catch(...)
+      {
+         if(m_timeToDie) break; //This will be true if signaled during shutdown
+         //otherwise, this is an error
+         throw;
+      }
+   }
+   
+   zmq_poller_destroy(&poller);
+   
+   for(auto it = sockets.begin(); it != sockets.end(); ++it)
+   {
+      if(it->second == nullptr) continue;
+      it->second->close();
+      delete it->second;
+   }
+   
+   for(size_t n = 0; n < streams.size(); ++n)
+   {
+      if(streams[n].m_connected) reportNotice("Disconnected from " + streams[n].m_imageName);
+      localStreamFree(streams[n]);
+   }
+   
+} // milkzmqClient::eventLoopExec()
+
+inline
+void milkzmqClient::radioLoopExec()
+{
+   if(m_imageThreads.size() == 0) return;
+   
+   reportInfo("Beginning receive at " + m_radioEndpoint + " for " + std::to_string(m_imageThreads.size()) + " streams");
+   
+   //Constructed in place and never resized, so the pointers to them stay valid.
+   std::vector<s_localStream> streams(m_imageThreads.size());
+   std::vector<radioAssembler> assemblers(m_imageThreads.size());
+   std::unordered_map<uint32_t, size_t> byId; //the streams by the id in the fragment header
+   
+   for(size_t n = 0; n < streams.size(); ++n)
+   {
+      localStreamSetup(streams[n], m_imageThreads[n].m_imageName, m_imageThreads[n].m_localImageName);
+      
+      uint32_t id = radioStreamId(streams[n].m_imageName);
+      assemblers[n].streamId(id);
+      assemblers[n].maxSize(m_radioMaxSize);
+      
+      if(!byId.emplace(id, n).second)
+      {
+         reportError(streams[n].m_imageName + " has the same radio stream id as " + streams[byId[id]].m_imageName + ", and will not be received", __FILE__, __LINE__);
+      }
+   }
+   
+   zmq::socket_t dish(*m_ZMQ_context, ZMQ_DISH);
+   
+   #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+   dish.set(zmq::sockopt::rcvtimeo, 1000);
+   dish.set(zmq::sockopt::linger, 0);
+   #else
+   dish.setsockopt(ZMQ_RCVTIMEO, 1000);
+   dish.setsockopt(ZMQ_LINGER, 0);
+   #endif
+   
+   bool ok = true;
+   
+   try
+   {
+      dish.bind(m_radioEndpoint);
+   }
+   catch(const zmq::error_t & e)
+   {
+      reportError("exception binding DISH to " + m_radioEndpoint + ": " + e.what(), __FILE__, __LINE__);
+      ok = false;
+   }
+   
+   for(size_t n = 0; ok && n < streams.size(); ++n)
+   {
+      std::string group = radioGroup(streams[n].m_imageName);
+      if(zmq_join((void *) dish, group.c_str()) < 0)
+      {
+         reportError("error joining " + group + " for " + streams[n].m_imageName + ": " + zmq_strerror(zmq_errno()), __FILE__, __LINE__);
+      }
+   }
+   
+   int64_t reported = get_mono_nsec(); //when the lost frames were last reported
+   std::vector<uint64_t> reportedComplete(streams.size(), 0), reportedIncomplete(streams.size(), 0); //the counts when last reported
+   
+   while(ok && !m_timeToDie)
+   {
+      int64_t now = get_mono_nsec();
+      if(now - reported > 10000000000LL)
+      {
+         for(size_t n = 0; n < streams.size(); ++n)
+         {
+            uint64_t lost = assemblers[n].incomplete() - reportedIncomplete[n];
+            if(lost > 0)
+            {
+               reportWarning(streams[n].m_imageName + ": " + std::to_string(lost) + " of " + std::to_string(lost + assemblers[n].complete() - reportedComplete[n]) 
+                                + " frames were incomplete and dropped in the last 10 s");
+            }
+            reportedComplete[n] = assemblers[n].complete();
+            reportedIncomplete[n] = assemblers[n].incomplete();
+         }
+         reported = now;
+      }
+      
+      zmq::message_t msg;
+      
+      try
+      {
+         #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+         if(!dish.recv(msg))
+         #else
+         if(!dish.recv(&msg))
+         #endif
+         {
+            if(zmq_errno() == EAGAIN || zmq_errno() == EINTR) continue; //Frames just come, so there is nothing to re-send.
+            
+            reportError(std::string("error receiving: ") + zmq_strerror(zmq_errno()), __FILE__, __LINE__);
+            break;
+         }
+      }
+      catch(...)
+      {
+         if(m_timeToDie) break; //This will be true if signaled during shutdown
+         //otherwise, this is an error
+         throw;
+      }
+      
+      if(msg.size() <= radioHeaderSize) continue;
+      
+      uint32_t id;
+      memcpy(&id, (char *) msg.data() + radioStreamIdOffset, sizeof(uint32_t));
+      
+      auto it = byId.find(id);
+      if(it == byId.end()) continue;
+      
+      s_localStream & ls = streams[it->second];
+      radioAssembler & assembler = assemblers[it->second];
+      
+      //Each message is a fragment of a frame, and we go on once the frame is complete.
+      if(!assembler.add((char *) msg.data(), msg.size())) continue;
+      
+      char * msgData = (char *) assembler.data();
+      size_t msgSize = assembler.size();
+      
+      if(msgSize <= headerSize) continue;
+      
+      //Only keyframes are sent, so the frame's size bounds the rest of the session's messages.  Compression can add
+      //a little to a frame which does not compress, so allow for twice it.
+      int typeSize = ImageStreamIO_typesize(*((uint8_t *) (msgData + typeOffset)));
+      if(assembler.sessionMaxSize() == 0 && typeSize > 0)
+      {
+         size_t nbytes = ((size_t) *((uint32_t *) (msgData + size0Offset))) * *((uint32_t *) (msgData + size1Offset)) * typeSize;
+         assembler.sessionMaxSize(headerSize + 2*nbytes + 1024);
+      }
+      
+      if(!ls.m_connected)
+      {
+         reportNotice("Connected to " + ls.m_imageName);
+         ls.m_connected = true;
+      }
+      
+      localStreamDecode(ls, msg, msgData, msgSize);
+   }
+   
+   dish.close();
+   
+   for(size_t n = 0; n < streams.size(); ++n)
+   {
+      if(streams[n].m_connected) reportNotice("Disconnected from " + streams[n].m_imageName);
+      localStreamFree(streams[n]);
+   }
+   
+} // milkzmqClient::radioLoopExec()
+
+inline
+int milkzmqClient::eventLoopKill()
+{
+   if(!m_eventLoopThread.joinable()) return 0;
+   
+   pthread_kill(m_eventLoopThread.native_handle(), SIGTERM);
+   return 0;
+}
+
+
+inline
+int milkzmqClient::decodeFrame( char * dest,
+                                const char * src,
+                                size_t srcSize,
+                                xrif_t xrif,
+                                xrif_t direct,
+                                int16_t difference,
+                                int16_t reorder,
+                                int16_t compress,
+                                std::vector<char> & scratch,
+                                size_t nel,
+                                size_t typeSize
+                              )
+{
+   if(reorder == reorderByteShuffle)
+   {
+      return shuffleDecompress(dest, src, srcSize, (compress != XRIF_COMPRESS_NONE), scratch.data(), nel, typeSize);
+   }
+   
+   //Nothing to decode, so just one copy.
+   if(difference == XRIF_DIFFERENCE_NONE && reorder == XRIF_REORDER_NONE && compress == XRIF_COMPRESS_NONE)
+   {
+      if(srcSize != nel*typeSize) return -1;
+      memcpy(dest, src, srcSize);
+      return 0;
+   }
+   
+   //xrif reads the message where it is, and decodes into dest.  It is not asked to write to src.
+   if(direct != nullptr && xrif_set_raw(direct, dest, nel*typeSize) == XRIF_NOERROR)
+   {
+      direct->compressed_buffer = (char *) src;
+      direct->compressed_buffer_size = srcSize;
+      direct->compressed_size = srcSize;
+      
+      return (xrif_decode(direct) == XRIF_NOERROR) ? 0 : -1;
+   }
+   
+   //Otherwise the message goes through the raw buffer, since compress_on_raw is set.
+   if(srcSize > xrif->raw_buffer_size) return -1;
+   
+   xrif->compressed_size = srcSize;
+   
+   memcpy(xrif->raw_buffer, src, xrif->compressed_size);
+   if(xrif_decode(xrif) != XRIF_NOERROR) return -1;
+   
+   memcpy(dest, xrif->raw_buffer, nel*typeSize);
+   
+   return 0;
+}
+
+inline
+bool milkzmqClient::openLocal( IMAGE & image,
+                               const std::string & name,
+                               uint8_t naxis,
+                               const uint32_t * imsize,
+                               uint8_t atype
+                             )
+{
+   //ImageStreamIO prints an error if it does not exist, which is the normal case, so check first.
+   char fname[512];
+   ImageStreamIO_filename(fname, sizeof(fname), name.c_str());
+   
+   int SM_fd = open(fname, O_RDWR);
+   if(SM_fd == -1) return false;
+   close(SM_fd);
+   
+   if(ImageStreamIO_openIm(&image, name.c_str()) != IMAGESTREAMIO_SUCCESS) return false;
+   
+   if( image.md[0].datatype != atype || image.md[0].naxis != naxis || image.md[0].size[0] != imsize[0] || 
+          image.md[0].size[1] != imsize[1] || (naxis > 2 && image.md[0].size[2] != imsize[2]) )
+   {
+      ImageStreamIO_closeIm(&image);
+      return false;
+   }
+   
+   return true;
+}
+
 inline
 int milkzmqClient::imageThreadKill(size_t thno)
 {
@@ -0,0 +1,266 @@
+/** \file milkzmqCodec.hpp
+  * \brief Byte-shuffle plus LZ4 compression for the types xrif does not compress, and temporal delta frames.
+  * \author milkzmq contributors
+  *
+  * History:
+  * - 2026 created
+  */
+
+//***********************************************************************//
+// Copyright 2026 the milkzmq contributors
+//
+// This file is part of milkzmq.
+//
+// milkzmq is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// milkzmq is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with milkzmq.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef milkzmqCodec_hpp
+#define milkzmqCodec_hpp
+
+#include <cstdint>
+#include <cstring>
+
+#include <lz4.h>
+
+#include <ImageStreamIO/ImageStreamIO.h>
+
+namespace milkzmq
+{
+
+/// The reorder code in the xrifReorderOffset header field marking a byte-shuffled frame.
+/** xrif does not use this value.  When it is set the compress field is XRIF_COMPRESS_LZ4 for a shuffled and
+  * LZ4 compressed frame, or XRIF_COMPRESS_NONE for a raw frame which did not compress, and the difference field
+  * is XRIF_DIFFERENCE_NONE.  The size field is the size of the payload after the header.
+  */
+constexpr int16_t reorderByteShuffle = 1000;
+
+/// Whether delta frames of a data type are formed with XOR rather than subtraction.
+/** Floating point types are XOR-ed, since subtraction would not be exactly reversible.
+  *
+  * \returns true for the floating point ImageStreamIO data types
+  */
+inline
+bool deltaIsXor( uint8_t atype /**< [in] the ImageStreamIO data type code */)
+{
+   return (atype == _DATATYPE_FLOAT || atype == _DATATYPE_DOUBLE || atype == _DATATYPE_HALF ||
+              atype == _DATATYPE_COMPLEX_FLOAT || atype == _DATATYPE_COMPLEX_DOUBLE);
+}
+
+/// Form the delta of a frame from a reference frame, element by element.
+/** Integers are subtracted modulo 2^bits, which is exactly reversed by frameUndelta. Complex types are treated as pairs.
+  */
+template<typename uintT>
+void frameDelta( uintT * delta,      ///< [out] the delta
+                 const uintT * cur,  ///< [in] the frame
+                 const uintT * ref,  ///< [in] the reference frame
+                 size_t nel,         ///< [in] the number of elements of type uintT
+                 bool isXor          ///< [in] if true XOR, otherwise subtract
+               )
+{
+   if(isXor) for(size_t n = 0; n < nel; ++n) delta[n] = cur[n] ^ ref[n];
+   else for(size_t n = 0; n < nel; ++n) delta[n] = cur[n] - ref[n];
+}
+
+/// Reverse frameDelta in place.
+template<typename uintT>
+void frameUndelta( uintT * frame,        ///< [in/out] on input the reference frame, on output the frame
+                   const uintT * delta,  ///< [in] the delta
+                   size_t nel,           ///< [in] the number of elements of type uintT
+                   bool isXor            ///< [in] if true XOR, otherwise add
+                 )
+{
+   if(isXor) for(size_t n = 0; n < nel; ++n) frame[n] ^= delta[n];
+   else for(size_t n = 0; n < nel; ++n) frame[n] += delta[n];
+}
+
+/// Form the delta of a frame from a reference frame.
+/** Dispatches to frameDelta by the size of the type.
+  */
+inline
+void frameDelta( char * delta,      ///< [out] the delta
+                 const char * cur,  ///< [in] the frame
+                 const char * ref,  ///< [in] the reference frame
+                 size_t nbytes,     ///< [in] the size of the frame in bytes
+                 size_t typeSize,   ///< [in] the size of each element in bytes
+                 bool isXor         ///< [in] if true XOR, otherwise subtract
+               )
+{
+   switch(typeSize)
+   {
+      case 1:
+         frameDelta((uint8_t *) delta, (const uint8_t *) cur, (const uint8_t *) ref, nbytes, isXor);
+         break;
+      case 2:
+         frameDelta((uint16_t *) delta, (const uint16_t *) cur, (const uint16_t *) ref, nbytes/2, isXor);
+         break;
+      case 4:
+         frameDelta((uint32_t *) delta, (const uint32_t *) cur, (const uint32_t *) ref, nbytes/4, isXor);
+         break;
+      default: //8 and 16 byte complex
+         frameDelta((uint64_t *) delta, (const uint64_t *) cur, (const uint64_t *) ref, nbytes/8, isXor);
+   }
+}
+
+/// Reverse frameDelta in place.
+/** Dispatches to frameUndelta by the size of the type.
+  */
+inline
+void frameUndelta( char * frame,        ///< [in/out] on input the reference frame, on output the frame
+                   const char * delta,  ///< [in] the delta
+                   size_t nbytes,       ///< [in] the size of the frame in bytes
+                   size_t typeSize,     ///< [in] the size of each element in bytes
+                   bool isXor           ///< [in] if true XOR, otherwise add
+                 )
+{
+   switch(typeSize)
+   {
+      case 1:
+         frameUndelta((uint8_t *) frame, (const uint8_t *) delta, nbytes, isXor);
+         break;
+      case 2:
+         frameUndelta((uint16_t *) frame, (const uint16_t *) delta, nbytes/2, isXor);
+         break;
+      case 4:
+         frameUndelta((uint32_t *) frame, (const uint32_t *) delta, nbytes/4, isXor);
+         break;
+      default: //8 and 16 byte complex
+         frameUndelta((uint64_t *) frame, (const uint64_t *) delta, nbytes/8, isXor);
+   }
+}
+
+/// Byte-shuffle an array.
+/** Byte b of each element is gathered into the b-th block of dest, so the slowly varying high bytes
+  * of floats and wide integers end up next to each other where LZ4 can find them.
+  */
+inline
+void byteShuffle( uint8_t * dest,       ///< [out] the shuffled bytes, nel*typeSize in size
+                  const uint8_t * src,  ///< [in] the array to shuffle
+                  size_t nel,           ///< [in] the number of elements
+                  size_t typeSize       ///< [in] the size of each element in bytes
+                )
+{
+   if(typeSize == 1)
+   {
+      memcpy(dest, src, nel);
+      return;
+   }
+
+   for(size_t b = 0; b < typeSize; ++b)
+   {
+      uint8_t * d = dest + b*nel;
+      const uint8_t * s = src + b;
+      for(size_t n = 0; n < nel; ++n) d[n] = s[n*typeSize];
+   }
+}
+
+/// Reverse byteShuffle.
+inline
+void byteUnshuffle( uint8_t * dest,       ///< [out] the array, nel*typeSize in size
+                    const uint8_t * src,  ///< [in] the shuffled bytes
+                    size_t nel,           ///< [in] the number of elements
+                    size_t typeSize       ///< [in] the size of each element in bytes
+                  )
+{
+   if(typeSize == 1)
+   {
+      memcpy(dest, src, nel);
+      return;
+   }
+
+   for(size_t b = 0; b < typeSize; ++b)
+   {
+      const uint8_t * s = src + b*nel;
+      uint8_t * d = dest + b;
+      for(size_t n = 0; n < nel; ++n) d[n*typeSize] = s[n];
+   }
+}
+
+/// The size of the destination buffer needed by shuffleCompress.
+/**
+  * \returns the maximum compressed size of nbytes of data.
+  */
+inline
+size_t shuffleCompressBound( size_t nbytes /**< [in] the size of the raw array */)
+{
+   return LZ4_compressBound(nbytes);
+}
+
+/// Shuffle and compress an array.
+/** If the array does not compress, it is copied raw into dest and compressed is set to false.
+  *
+  * \returns the number of bytes written to dest
+  */
+inline
+size_t shuffleCompress( char * dest,         ///< [out] the compressed data, at least shuffleCompressBound(nel*typeSize) in size
+                        bool & compressed,   ///< [out] true if dest is compressed, false if it is raw
+                        const char * src,    ///< [in] the array to compress
+                        char * scratch,      ///< [in] working space, nel*typeSize in size
+                        size_t nel,          ///< [in] the number of elements
+                        size_t typeSize,     ///< [in] the size of each element in bytes
+                        int acceleration = 1 ///< [in] the LZ4 acceleration, larger is faster but compresses less
+                      )
+{
+   size_t nbytes = nel*typeSize;
+
+   byteShuffle((uint8_t *) scratch, (const uint8_t *) src, nel, typeSize);
+
+   int csz = LZ4_compress_fast(scratch, dest, nbytes, shuffleCompressBound(nbytes), acceleration);
+
+   if(csz <= 0 || (size_t) csz >= nbytes)
+   {
+      memcpy(dest, src, nbytes);
+      compressed = false;
+      return nbytes;
+   }
+
+   compressed = true;
+   return csz;
+}
+
+/// Decompress and unshuffle an array.
+/**
+  * \returns 0 on success
+  * \returns -1 on error
+  */
+inline
+int shuffleDecompress( char * dest,         ///< [out] the array, nel*typeSize in size
+                       const char * src,    ///< [in] the compressed data
+                       size_t srcSize,      ///< [in] the size of the compressed data
+                       bool compressed,     ///< [in] false if src is the raw array
+                       char * scratch,      ///< [in] working space, nel*typeSize in size
+                       size_t nel,          ///< [in] the number of elements
+                       size_t typeSize      ///< [in] the size of each element in bytes
+                     )
+{
+   size_t nbytes = nel*typeSize;
+
+   if(!compressed)
+   {
+      if(srcSize != nbytes) return -1;
+      memcpy(dest, src, nbytes);
+      return 0;
+   }
+
+   int dsz = LZ4_decompress_safe(src, scratch, srcSize, nbytes);
+
+   if(dsz < 0 || (size_t) dsz != nbytes) return -1;
+
+   byteUnshuffle((uint8_t *) dest, (const uint8_t *) scratch, nel, typeSize);
+
+   return 0;
+}
+
+} //namespace milkzmq
+
+#endif //milkzmqCodec_hpp
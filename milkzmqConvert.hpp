@@ -0,0 +1,345 @@
+/** \file milkzmqConvert.hpp
+  * \brief Conversion of floating point frames to 16 bit types for sending, and back.
+  * \author milkzmq contributors
+  *
+  * History:
+  * - 2026 created
+  */
+
+//***********************************************************************//
+// Copyright 2026 the milkzmq contributors
+//
+// This file is part of milkzmq.
+//
+// milkzmq is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// milkzmq is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with milkzmq.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef milkzmqConvert_hpp
+#define milkzmqConvert_hpp
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include <ImageStreamIO/ImageStreamIO.h>
+
+namespace milkzmq
+{
+
+/** \name Conversions
+  * The codes for the conversion of a floating point frame to a 16 bit type on the wire.
+  * @{
+  */
+constexpr uint8_t convertNone = 0;  ///< No conversion.
+constexpr uint8_t convertInt16 = 1; ///< Scaled to int16, as (value - zero)/scale rounded, with zero and scale chosen from each frame's finite range.  See convertInt16NaN.
+constexpr uint8_t convertFp16 = 2;  ///< IEEE half precision, sent as uint16.
+constexpr uint8_t convertBf16 = 3;  ///< bfloat16, the high 16 bits of a float rounded to nearest even, sent as uint16.
+///@}
+
+constexpr int16_t convertInt16NaN = -32768; ///< The convertInt16 code of NaN.  Infinities are sent as +/-32767, the ends of the range.
+
+/// Whether a value is finite, from its exponent bits, so that it holds when compiled with -ffast-math.
+inline
+bool finiteBits( float v /**< [in] the value */)
+{
+   uint32_t u;
+   memcpy(&u, &v, sizeof(u));
+   return (u & 0x7f800000u) != 0x7f800000u;
+}
+
+/// Whether a value is finite, from its exponent bits, so that it holds when compiled with -ffast-math.
+inline
+bool finiteBits( double v /**< [in] the value */)
+{
+   uint64_t u;
+   memcpy(&u, &v, sizeof(u));
+   return (u & 0x7ff0000000000000ULL) != 0x7ff0000000000000ULL;
+}
+
+/// Whether a value is NaN, from its bits, so that it holds when compiled with -ffast-math.
+inline
+bool nanBits( float v /**< [in] the value */)
+{
+   uint32_t u;
+   memcpy(&u, &v, sizeof(u));
+   return (u & 0x7fffffffu) > 0x7f800000u;
+}
+
+/// Whether a value is NaN, from its bits, so that it holds when compiled with -ffast-math.
+inline
+bool nanBits( double v /**< [in] the value */)
+{
+   uint64_t u;
+   memcpy(&u, &v, sizeof(u));
+   return (u & 0x7fffffffffffffffULL) > 0x7ff0000000000000ULL;
+}
+
+/// Whether a data type can be converted.
+/**
+  * \returns true for float and double
+  */
+inline
+bool convertible( uint8_t atype /**< [in] the ImageStreamIO data type code */)
+{
+   return (atype == _DATATYPE_FLOAT || atype == _DATATYPE_DOUBLE);
+}
+
+/// The data type a conversion sends.
+/**
+  * \returns the ImageStreamIO data type code on the wire, which xrif can compress
+  */
+inline
+uint8_t convertedType( uint8_t convert /**< [in] the conversion code */)
+{
+   return (convert == convertInt16) ? _DATATYPE_INT16 : _DATATYPE_UINT16;
+}
+
+/// Convert a float to IEEE half precision, rounding to nearest even.
+/** Values too large become infinity.  Branches only on the range, so the loops using it vectorize.
+  */
+inline
+uint16_t floatToHalf( float f /**< [in] the value */)
+{
+   uint32_t u;
+   memcpy(&u, &f, sizeof(u));
+
+   uint32_t sign = u & 0x80000000u;
+   u ^= sign;
+
+   uint16_t h;
+   if(u >= 0x47800000u) //65536 and up, infinity and NaN
+   {
+      h = (u > 0x7f800000u) ? 0x7e00 : 0x7c00;
+   }
+   else if(u < 0x38800000u) //below the smallest normal half, so denormal or zero
+   {
+      //Adding 0.5 puts the half's mantissa, rounded by the FPU, in the low bits
+      float t;
+      memcpy(&t, &u, sizeof(t));
+      t += 0.5f;
+      uint32_t tu;
+      memcpy(&tu, &t, sizeof(tu));
+      h = tu - 0x3f000000u;
+   }
+   else
+   {
+      uint32_t mantOdd = (u >> 13) & 1;
+      u += 0xc8000fffu; //rebias the exponent, (15-127) << 23, and round half up
+      u += mantOdd;     //then to even
+      h = u >> 13;
+   }
+
+   return h | (sign >> 16);
+}
+
+/// Convert IEEE half precision to a float.
+inline
+float halfToFloat( uint16_t h /**< [in] the half */)
+{
+   uint32_t u = ((uint32_t) (h & 0x7fff)) << 13;
+   uint32_t exp = u & 0x0f800000u;
+
+   u += (127 - 15) << 23; //rebias the exponent
+
+   if(exp == 0x0f800000u) u += (128 - 16) << 23; //infinity and NaN
+   else if(exp == 0) //denormal, renormalize
+   {
+      u += 1 << 23;
+      float f;
+      memcpy(&f, &u, sizeof(f));
+      f -= 6.103515625e-05f; //2^-14
+      memcpy(&u, &f, sizeof(u));
+   }
+
+   u |= ((uint32_t) (h & 0x8000)) << 16;
+
+   float f;
+   memcpy(&f, &u, sizeof(f));
+   return f;
+}
+
+/// Convert a float to bfloat16, rounding to nearest even.
+inline
+uint16_t floatToBf16( float f /**< [in] the value */)
+{
+   uint32_t u;
+   memcpy(&u, &f, sizeof(u));
+
+   if((u & 0x7fffffffu) > 0x7f800000u) return (u >> 16) | 0x0040; //keep NaN a NaN
+
+   return (u + 0x7fffu + ((u >> 16) & 1)) >> 16;
+}
+
+/// Convert bfloat16 to a float.
+inline
+float bf16ToFloat( uint16_t b /**< [in] the bfloat16 */)
+{
+   uint32_t u = ((uint32_t) b) << 16;
+
+   float f;
+   memcpy(&f, &u, sizeof(f));
+   return f;
+}
+
+/// Convert a frame to a 16 bit type.
+/** For convertInt16 the zero is the middle of the range of the frame's finite values, and the scale maps the range
+  * onto +/-32767.  NaN is sent as convertInt16NaN, and infinities as +/-32767.
+  */
+template<typename realT>
+void convertFrame( uint16_t * dest,     ///< [out] the converted frame, as int16 or uint16 bits
+                   const realT * src,   ///< [in] the frame
+                   size_t nel,          ///< [in] the number of elements
+                   uint8_t convert,     ///< [in] the conversion code
+                   double & scale,      ///< [out] for convertInt16, the scale
+                   double & zero        ///< [out] for convertInt16, the zero
+                 )
+{
+   scale = 1;
+   zero = 0;
+
+   if(convert == convertInt16)
+   {
+      if(nel == 0) return;
+
+      //The range of the finite values.  One NaN or infinity would otherwise make the zero and scale useless.
+      bool any = false;
+      realT mn = 0;
+      realT mx = 0;
+      for(size_t n = 0; n < nel; ++n)
+      {
+         if(!finiteBits(src[n])) continue;
+
+         if(!any)
+         {
+            mn = src[n];
+            mx = src[n];
+            any = true;
+            continue;
+         }
+
+         mn = (src[n] < mn) ? src[n] : mn;
+         mx = (src[n] > mx) ? src[n] : mx;
+      }
+
+      zero = 0.5*((double) mx + (double) mn);
+      scale = ((double) mx - (double) mn)/65534.0;
+      if(!(scale > 0) || !finiteBits(scale)) scale = 1; //a flat frame, or a range beyond double's
+      if(!finiteBits(zero)) zero = 0;
+
+      realT z = zero;
+      realT inv = 1.0/scale;
+      int16_t * d = (int16_t *) dest;
+      for(size_t n = 0; n < nel; ++n)
+      {
+         if(!finiteBits(src[n]))
+         {
+            if(nanBits(src[n])) d[n] = convertInt16NaN;
+            else d[n] = std::signbit(src[n]) ? -32767 : 32767;
+            continue;
+         }
+
+         //Clamped, since rounding at the ends of the range could otherwise overflow the cast.
+         realT t = (src[n] - z)*inv;
+         if(t > (realT) 32767) t = 32767;
+         else if(t < (realT) -32767) t = -32767;
+         d[n] = (int16_t) (t + ((t >= 0) ? 0.5 : -0.5));
+      }
+   }
+   else if(convert == convertFp16)
+   {
+      for(size_t n = 0; n < nel; ++n) dest[n] = floatToHalf(src[n]);
+   }
+   else
+   {
+      for(size_t n = 0; n < nel; ++n) dest[n] = floatToBf16(src[n]);
+   }
+}
+
+/// Convert a frame back from a 16 bit type.
+template<typename realT>
+void unconvertFrame( realT * dest,          ///< [out] the frame
+                     const uint16_t * src,  ///< [in] the converted frame, as int16 or uint16 bits
+                     size_t nel,            ///< [in] the number of elements
+                     uint8_t convert,       ///< [in] the conversion code
+                     double scale,          ///< [in] for convertInt16, the scale
+                     double zero            ///< [in] for convertInt16, the zero
+                   )
+{
+   if(convert == convertInt16)
+   {
+      realT s = scale;
+      realT z = zero;
+      const int16_t * q = (const int16_t *) src;
+      for(size_t n = 0; n < nel; ++n) dest[n] = (q[n] == convertInt16NaN) ? std::numeric_limits<realT>::quiet_NaN() : q[n]*s + z;
+   }
+   else if(convert == convertFp16)
+   {
+      for(size_t n = 0; n < nel; ++n) dest[n] = halfToFloat(src[n]);
+   }
+   else
+   {
+      for(size_t n = 0; n < nel; ++n) dest[n] = bf16ToFloat(src[n]);
+   }
+}
+
+/// Convert a frame to a 16 bit type.
+/** Dispatches to convertFrame by the data type, which must be convertible.
+  *
+  * \returns 0 on success
+  * \returns -1 if the type can not be converted
+  */
+inline
+int convertFrame( char * dest,         ///< [out] the converted frame, nel*2 bytes
+                  const char * src,    ///< [in] the frame
+                  uint8_t atype,       ///< [in] the ImageStreamIO data type code of the frame
+                  size_t nel,          ///< [in] the number of elements
+                  uint8_t convert,     ///< [in] the conversion code
+                  double & scale,      ///< [out] for convertInt16, the scale
+                  double & zero        ///< [out] for convertInt16, the zero
+                )
+{
+   if(atype == _DATATYPE_FLOAT) convertFrame((uint16_t *) dest, (const float *) src, nel, convert, scale, zero);
+   else if(atype == _DATATYPE_DOUBLE) convertFrame((uint16_t *) dest, (const double *) src, nel, convert, scale, zero);
+   else return -1;
+
+   return 0;
+}
+
+/// Convert a frame back from a 16 bit type.
+/** Dispatches to unconvertFrame by the data type, which must be convertible.
+  *
+  * \returns 0 on success
+  * \returns -1 if the type can not be converted
+  */
+inline
+int unconvertFrame( char * dest,         ///< [out] the frame
+                    const char * src,    ///< [in] the converted frame, nel*2 bytes
+                    uint8_t atype,       ///< [in] the ImageStreamIO data type code of the frame
+                    size_t nel,          ///< [in] the number of elements
+                    uint8_t convert,     ///< [in] the conversion code
+                    double scale,        ///< [in] for convertInt16, the scale
+                    double zero          ///< [in] for convertInt16, the zero
+                  )
+{
+   if(atype == _DATATYPE_FLOAT) unconvertFrame((float *) dest, (const uint16_t *) src, nel, convert, scale, zero);
+   else if(atype == _DATATYPE_DOUBLE) unconvertFrame((double *) dest, (const uint16_t *) src, nel, convert, scale, zero);
+   else return -1;
+
+   return 0;
+}
+
+} //namespace milkzmq
+
+#endif //milkzmqConvert_hpp
@@ -0,0 +1,201 @@
+/** \file milkzmqFrameScheduler.hpp
+  * \brief A deadline based frame rate scheduler.
+  * \author milkzmq contributors
+  *
+  * History:
+  * - 2026 created
+  */
+
+//***********************************************************************//
+// Copyright 2026 the milkzmq contributors
+//
+// This file is part of milkzmq.
+//
+// milkzmq is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// milkzmq is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with milkzmq.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef milkzmqFrameScheduler_hpp
+#define milkzmqFrameScheduler_hpp
+
+#include <cstdint>
+
+namespace milkzmq
+{
+
+/// A deadline based frame rate scheduler.
+/** Deadlines are absolute CLOCK_MONOTONIC times in nanoseconds (see get_mono_nsec), and each send advances 
+  * the deadline by exactly one period, so the average rate is the target without drift.  If a send is more 
+  * than one period late, e.g. because there were no new frames or no subscribers, the schedule restarts 
+  * from the time of the send so that there is no burst to catch up.
+  *
+  * The achieved rate is measured over a window of at least 1 second and 4 periods.
+  */
+class frameScheduler
+{
+protected:
+
+   double m_fpsTgt {0}; ///< The target rate.  If <= 0 there is no limit.
+
+   int64_t m_period {0}; ///< The period in nanoseconds.
+
+   int64_t m_next {0}; ///< The next deadline.  0 means send as soon as possible.
+
+   int64_t m_windowStart {0}; ///< Start of the achieved rate measurement window.
+
+   uint64_t m_windowSends {0}; ///< Number of sends in the current window.
+
+   double m_fpsAchieved {0}; ///< The achieved rate measured over the last complete window.
+
+public:
+
+   /// Set the target rate.
+   /** Resets the schedule so the next frame is due now.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int fpsTgt( double fps /**< [in] the new target rate in frames per second.  <= 0 means no limit.*/);
+
+   /// Get the target rate.
+   /**
+     * \returns the current value of m_fpsTgt
+     */
+   double fpsTgt();
+
+   /// Get the period.
+   /**
+     * \returns the current value of m_period, in nanoseconds
+     */
+   int64_t period();
+
+   /// Reset the schedule so the next frame is due now.
+   void reset();
+
+   /// Check if a frame is due.
+   /**
+     * \returns true if the deadline has been reached
+     */
+   bool due( int64_t now /**< [in] the current monotonic time in nanoseconds */);
+
+   /// Get the next deadline.
+   /**
+     * \returns the current value of m_next, in monotonic nanoseconds
+     */
+   int64_t next();
+
+   /// Get the time until the next deadline.
+   /**
+     * \returns the time until the next deadline in nanoseconds, <= 0 if due now
+     */
+   int64_t wait( int64_t now /**< [in] the current monotonic time in nanoseconds */);
+
+   /// Record a send and advance the deadline.
+   void sent( int64_t now /**< [in] the monotonic time of the send in nanoseconds */);
+
+   /// Get the achieved rate.
+   /** 
+     * \returns the rate measured over the last complete window, in frames per second
+     */
+   double fpsAchieved();
+};
+
+inline
+int frameScheduler::fpsTgt( double fps )
+{
+   m_fpsTgt = fps;
+
+   if(m_fpsTgt > 0) m_period = 1e9/m_fpsTgt + 0.5;
+   else m_period = 0;
+
+   reset();
+
+   return 0;
+}
+
+inline
+double frameScheduler::fpsTgt()
+{
+   return m_fpsTgt;
+}
+
+inline
+int64_t frameScheduler::period()
+{
+   return m_period;
+}
+
+inline
+void frameScheduler::reset()
+{
+   m_next = 0;
+   m_windowStart = 0;
+   m_windowSends = 0;
+}
+
+inline
+bool frameScheduler::due( int64_t now )
+{
+   return now >= m_next;
+}
+
+inline
+int64_t frameScheduler::next()
+{
+   return m_next;
+}
+
+inline
+int64_t frameScheduler::wait( int64_t now )
+{
+   return m_next - now;
+}
+
+inline
+void frameScheduler::sent( int64_t now )
+{
+   m_next += m_period;
+
+   //More than a period late, so restart the schedule instead of bursting to catch up.
+   if(m_next <= now) m_next = now + m_period;
+
+   //---- Measure the achieved rate
+   if(m_windowStart == 0)
+   {
+      m_windowStart = now;
+      m_windowSends = 0;
+      return;
+   }
+
+   ++m_windowSends;
+
+   int64_t window = 4*m_period;
+   if(window < 1000000000) window = 1000000000;
+
+   if(now - m_windowStart >= window)
+   {
+      m_fpsAchieved = m_windowSends / (1e-9*(now - m_windowStart));
+      m_windowStart = now;
+      m_windowSends = 0;
+   }
+}
+
+inline
+double frameScheduler::fpsAchieved()
+{
+   return m_fpsAchieved;
+}
+
+} //namespace milkzmq
+
+#endif //milkzmqFrameScheduler_hpp
@@ -0,0 +1,283 @@
+/** \file milkzmqHistogram.hpp
+  * \brief Log-linear histograms of times, for latency and jitter statistics.
+  * \author milkzmq contributors
+  *
+  * History:
+  * - 2026 created
+  */
+
+//***********************************************************************//
+// Copyright 2026 the milkzmq contributors
+//
+// This file is part of milkzmq.
+//
+// milkzmq is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// milkzmq is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with milkzmq.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef milkzmqHistogram_hpp
+#define milkzmqHistogram_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace milkzmq
+{
+
+/// A histogram of times in nanoseconds, with buckets of constant relative width.
+/** As in HdrHistogram, values below 2^histSubBits ns each have their own bucket, and each power of 2 above that is
+  * split into 2^(histSubBits-1) equal buckets.  So any value is known to within 1/64 of itself, with a fixed and small
+  * number of buckets.  Values from 2^histMaxBits ns, about 18 minutes, go in the top bucket.
+  *
+  * Recording is a few integer operations and relaxed atomic adds, so it can be left on.  One thread records, and any
+  * thread can read the statistics at the same time.  They are then consistent to within the values being recorded.
+  */
+class timeHistogram
+{
+public:
+
+   static constexpr int histSubBits = 7;  ///< The bits of precision of each bucket.
+   static constexpr int histMaxBits = 40; ///< The highest power of 2 with its own buckets.
+
+   static constexpr size_t histBuckets = (1 << histSubBits) + (histMaxBits - histSubBits)*(1 << (histSubBits - 1)); ///< The number of buckets.
+
+protected:
+
+   std::atomic<uint64_t> m_counts[histBuckets]; ///< The count of each bucket.
+
+   std::atomic<uint64_t> m_count {0};    ///< The number of values recorded.
+   std::atomic<uint64_t> m_negative {0}; ///< The number of negative values, which are recorded as 0.
+   std::atomic<int64_t> m_max {0};       ///< The largest value recorded.
+   std::atomic<int64_t> m_min {0};       ///< The smallest value recorded, valid if m_count > 0.
+   std::atomic<double> m_sum {0};        ///< The sum of the values recorded, for the mean.
+
+public:
+
+   /// C'tor, empties the histogram.
+   timeHistogram();
+
+   /// Empty the histogram.
+   /** Values being recorded at the same time may be lost.
+     */
+   void reset();
+
+   /// Record a value.
+   void record( int64_t ns /**< [in] the value in nanoseconds */);
+
+   /// The bucket of a value.
+   /**
+     * \returns the index of the bucket
+     */
+   static size_t bucket( int64_t ns /**< [in] the value, at least 0 */);
+
+   /// The largest value in a bucket.
+   /** The top bucket also holds every larger value, so for it this is only the largest below 2^histMaxBits.
+     *
+     * \returns the value in nanoseconds
+     */
+   static int64_t bucketMax( size_t idx /**< [in] the index of the bucket */);
+
+   /// Get the number of values recorded.
+   /**
+     * \returns the current value of m_count
+     */
+   uint64_t count();
+
+   /// Get the number of negative values recorded, such as latencies from a source whose clock is ahead of ours.
+   /**
+     * \returns the current value of m_negative
+     */
+   uint64_t negative();
+
+   /// Get the smallest value recorded.
+   /**
+     * \returns the value in nanoseconds, 0 if none
+     */
+   int64_t min();
+
+   /// Get the largest value recorded.
+   /**
+     * \returns the value in nanoseconds, 0 if none
+     */
+   int64_t max();
+
+   /// Get the mean of the values recorded.
+   /**
+     * \returns the mean in nanoseconds, 0 if none
+     */
+   double mean();
+
+   /// Get a percentile of the values recorded.
+   /** The largest value of the bucket holding it, so at most 1/64 above, but never below, the true value.  The top
+     * bucket has no upper bound, so for it this is the largest value recorded.
+     *
+     * \returns the value in nanoseconds, 0 if none
+     */
+   int64_t percentile( double pct /**< [in] the percentile, 0 to 100 */);
+
+   /// Summarize the histogram in one line.
+   /**
+     * \returns the count, the mean, the minimum, the 50th, 90th, 99th and 99.9th percentiles, and the maximum, in microseconds
+     */
+   std::string summary();
+};
+
+inline
+timeHistogram::timeHistogram()
+{
+   reset();
+}
+
+inline
+void timeHistogram::reset()
+{
+   for(size_t n = 0; n < histBuckets; ++n) m_counts[n].store(0, std::memory_order_relaxed);
+
+   m_count.store(0, std::memory_order_relaxed);
+   m_negative.store(0, std::memory_order_relaxed);
+   m_max.store(0, std::memory_order_relaxed);
+   m_min.store(0, std::memory_order_relaxed);
+   m_sum.store(0, std::memory_order_relaxed);
+}
+
+inline
+void timeHistogram::record( int64_t ns )
+{
+   if(ns < 0)
+   {
+      m_negative.fetch_add(1, std::memory_order_relaxed);
+      ns = 0;
+   }
+
+   m_counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+
+   //Only one thread records, so the read-modify-writes need not be atomic.
+   uint64_t cnt = m_count.load(std::memory_order_relaxed);
+   if(cnt == 0 || ns < m_min.load(std::memory_order_relaxed)) m_min.store(ns, std::memory_order_relaxed);
+   if(ns > m_max.load(std::memory_order_relaxed)) m_max.store(ns, std::memory_order_relaxed);
+   m_sum.store(m_sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+   m_count.store(cnt + 1, std::memory_order_release);
+}
+
+inline
+size_t timeHistogram::bucket( int64_t ns )
+{
+   uint64_t v = ns;
+
+   if(v < (1ULL << histSubBits)) return v;
+
+   int msb = 63 - __builtin_clzll(v);
+   if(msb >= histMaxBits) return histBuckets - 1;
+
+   int shift = msb - histSubBits + 1;
+   size_t top = v >> shift; //in [2^(histSubBits-1), 2^histSubBits)
+
+   return (1 << histSubBits) + (msb - histSubBits)*(1 << (histSubBits - 1)) + (top - (1 << (histSubBits - 1)));
+}
+
+inline
+int64_t timeHistogram::bucketMax( size_t idx )
+{
+   if(idx < (1 << histSubBits)) return idx;
+
+   size_t j = idx - (1 << histSubBits);
+   int msb = histSubBits + j/(1 << (histSubBits - 1));
+   int64_t top = (1 << (histSubBits - 1)) + j % (1 << (histSubBits - 1));
+   int shift = msb - histSubBits + 1;
+
+   return ((top + 1) << shift) - 1;
+}
+
+inline
+uint64_t timeHistogram::count()
+{
+   return m_count.load(std::memory_order_acquire);
+}
+
+inline
+uint64_t timeHistogram::negative()
+{
+   return m_negative.load(std::memory_order_relaxed);
+}
+
+inline
+int64_t timeHistogram::min()
+{
+   return m_min.load(std::memory_order_relaxed);
+}
+
+inline
+int64_t timeHistogram::max()
+{
+   return m_max.load(std::memory_order_relaxed);
+}
+
+inline
+double timeHistogram::mean()
+{
+   uint64_t cnt = count();
+   if(cnt == 0) return 0;
+
+   return m_sum.load(std::memory_order_relaxed)/cnt;
+}
+
+inline
+int64_t timeHistogram::percentile( double pct )
+{
+   //Count the buckets rather than using m_count, so the total matches what we add up.
+   uint64_t total = 0;
+   for(size_t n = 0; n < histBuckets; ++n) total += m_counts[n].load(std::memory_order_relaxed);
+
+   if(total == 0) return 0;
+
+   uint64_t rank = pct/100.0*total + 0.5;
+   if(rank < 1) rank = 1;
+   if(rank > total) rank = total;
+
+   uint64_t sum = 0;
+   for(size_t n = 0; n < histBuckets; ++n)
+   {
+      sum += m_counts[n].load(std::memory_order_relaxed);
+      if(sum >= rank)
+      {
+         if(n == histBuckets - 1) return max(); //the top bucket has no upper bound
+         
+         int64_t v = bucketMax(n);
+         int64_t mx = max();
+         return (v < mx) ? v : mx;
+      }
+   }
+
+   return max();
+}
+
+inline
+std::string timeHistogram::summary()
+{
+   char line[256];
+   snprintf(line, sizeof(line), "n=%llu mean=%.1f min=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f us",
+               (unsigned long long) count(), mean()/1e3, min()/1e3, percentile(50)/1e3, percentile(90)/1e3, percentile(99)/1e3,
+               percentile(99.9)/1e3, max()/1e3);
+
+   std::string s = line;
+
+   if(negative() > 0) s += " (" + std::to_string(negative()) + " negative, counted as 0)";
+
+   return s;
+}
+
+} //namespace milkzmq
+
+#endif //milkzmqHistogram_hpp
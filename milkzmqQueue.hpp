@@ -0,0 +1,185 @@
+/** \file milkzmqQueue.hpp
+  * \brief A bounded lock-free queue for handing work between threads.
+  * \author milkzmq contributors
+  *
+  * History:
+  * - 2026 created
+  */
+
+//***********************************************************************//
+// Copyright 2026 the milkzmq contributors
+//
+// This file is part of milkzmq.
+//
+// milkzmq is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// milkzmq is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with milkzmq.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef milkzmqQueue_hpp
+#define milkzmqQueue_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace milkzmq
+{
+
+/// A bounded queue for any number of producers and consumers, without locks.
+/** Each cell carries a sequence number which says whether it is free for the push of a given position, or full for
+  * its pop, so producers and consumers only contend on the position they claim.  A push to a full queue and a pop
+  * from an empty one fail rather than wait.
+  *
+  * The capacity must be set before the queue is used, and is rounded up to a power of 2.
+  */
+template<typename T>
+class mpmcQueue
+{
+protected:
+
+   ///A cell of the queue.
+   struct s_cell
+   {
+      std::atomic<size_t> m_seq {0}; ///< The position this cell is next free for, or that plus one when it is full.
+      T m_data;                      ///< The item.
+   };
+
+   std::unique_ptr<s_cell[]> m_cells; ///< The cells.
+
+   size_t m_mask {0}; ///< The capacity minus one.
+
+   alignas(64) std::atomic<size_t> m_pushPos {0}; ///< The position of the next push.  Kept on its own cache line.
+
+   alignas(64) std::atomic<size_t> m_popPos {0}; ///< The position of the next pop.  Kept on its own cache line.
+
+public:
+
+   /// Set the capacity, and empty the queue.
+   /** Not thread safe, so must not be called while the queue is in use.
+     */
+   void capacity( size_t cap /**< [in] the minimum capacity, rounded up to a power of 2 */);
+
+   /// Get the capacity
+   /**
+     * \returns the number of items the queue can hold
+     */
+   size_t capacity();
+
+   /// Add an item to the back of the queue.
+   /**
+     * \returns true if the item was added
+     * \returns false if the queue is full
+     */
+   bool push( const T & data /**< [in] the item */);
+
+   /// Take the item at the front of the queue.
+   /**
+     * \returns true if an item was taken
+     * \returns false if the queue is empty
+     */
+   bool pop( T & data /**< [out] the item */);
+
+   /// Check whether the queue is empty.
+   /** Only a hint while other threads are pushing and popping.
+     *
+     * \returns true if there is nothing to pop
+     */
+   bool empty();
+};
+
+template<typename T>
+void mpmcQueue<T>::capacity( size_t cap )
+{
+   size_t n = 1;
+   while(n < cap) n <<= 1;
+
+   m_cells.reset(new s_cell[n]);
+   for(size_t i = 0; i < n; ++i) m_cells[i].m_seq.store(i, std::memory_order_relaxed);
+
+   m_mask = n - 1;
+   m_pushPos.store(0, std::memory_order_relaxed);
+   m_popPos.store(0, std::memory_order_release);
+}
+
+template<typename T>
+size_t mpmcQueue<T>::capacity()
+{
+   return m_cells ? m_mask + 1 : 0;
+}
+
+template<typename T>
+bool mpmcQueue<T>::push( const T & data )
+{
+   if(!m_cells) return false;
+
+   size_t pos = m_pushPos.load(std::memory_order_relaxed);
+
+   for(;;)
+   {
+      s_cell & cell = m_cells[pos & m_mask];
+      size_t seq = cell.m_seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+      if(diff == 0) //free for this position, so claim it
+      {
+         if(m_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+         {
+            cell.m_data = data;
+            cell.m_seq.store(pos + 1, std::memory_order_release);
+            return true;
+         }
+      }
+      else if(diff < 0) return false; //still full from the last time around
+      else pos = m_pushPos.load(std::memory_order_relaxed); //another producer got it
+   }
+}
+
+template<typename T>
+bool mpmcQueue<T>::pop( T & data )
+{
+   if(!m_cells) return false;
+
+   size_t pos = m_popPos.load(std::memory_order_relaxed);
+
+   for(;;)
+   {
+      s_cell & cell = m_cells[pos & m_mask];
+      size_t seq = cell.m_seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+      if(diff == 0) //full for this position, so claim it
+      {
+         if(m_popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+         {
+            data = cell.m_data;
+            cell.m_seq.store(pos + m_mask + 1, std::memory_order_release); //free for the next time around
+            return true;
+         }
+      }
+      else if(diff < 0) return false; //not pushed yet
+      else pos = m_popPos.load(std::memory_order_relaxed); //another consumer got it
+   }
+}
+
+template<typename T>
+bool mpmcQueue<T>::empty()
+{
+   if(!m_cells) return true;
+
+   size_t pos = m_popPos.load(std::memory_order_acquire);
+   return (m_cells[pos & m_mask].m_seq.load(std::memory_order_acquire) != pos + 1);
+}
+
+} //namespace milkzmq
+
+#endif //milkzmqQueue_hpp
@@ -0,0 +1,308 @@
+/** \file milkzmqRadio.hpp
+  * \brief Fragmentation and reassembly of messages sent to many clients at once with ZeroMQ RADIO/DISH over UDP.
+  * \author milkzmq contributors
+  *
+  * History:
+  * - 2026 created
+  */
+
+//***********************************************************************//
+// Copyright 2026 the milkzmq contributors
+//
+// This file is part of milkzmq.
+//
+// milkzmq is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// milkzmq is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with milkzmq.  If not, see <http://www.gnu.org/licenses/>.
+//***********************************************************************//
+
+#ifndef milkzmqRadio_hpp
+#define milkzmqRadio_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace milkzmq
+{
+
+//Each message, i.e. a frame with its milkzmq header, is split into datagrams, each a fragment header followed by
+//a piece of the message:
+/*
+ *  0-3      stream id (uint32_t), see radioStreamId
+ *  4-7      server session (uint32_t), which changes when the server restarts
+ *  8-15     the server's sequence number of the message (uint64_t)
+ *  16-19    the size of the message (uint32_t)
+ *  20-23    the number of fragments (uint32_t)
+ *  24-27    the index of this fragment (uint32_t)
+ *  28-31    the size of the piece of the message in each fragment but the last (uint32_t)
+ */
+//So fragment n holds the message from n times the fragment size, and the number of fragments follows from the sizes.
+constexpr size_t radioHeaderSize = 32;      ///< The size of the fragment header.
+constexpr size_t radioStreamIdOffset = 0;   ///< Start of the stream id field.
+constexpr size_t radioSessionOffset = 4;    ///< Start of the server session field.
+constexpr size_t radioSeqOffset = 8;        ///< Start of the sequence number field.
+constexpr size_t radioSizeOffset = 16;      ///< Start of the message size field.
+constexpr size_t radioNfragsOffset = 20;    ///< Start of the number of fragments field.
+constexpr size_t radioIndexOffset = 24;     ///< Start of the fragment index field.
+constexpr size_t radioFragSizeOffset = 28;  ///< Start of the fragment size field.
+
+constexpr size_t radioMaxDatagram = 8000;   ///< The largest datagram, which with the group must fit in ZeroMQ's 8192 byte UDP messages.
+
+constexpr size_t radioMaxMessage = 16*1024*1024; ///< The default largest message reassembled, see radioAssembler::maxSize.
+
+/// The id of a stream in the fragment header.
+/** The 32 bit FNV-1a hash of the name.
+  *
+  * \returns the stream id
+  */
+inline
+uint32_t radioStreamId( const std::string & name /**< [in] the name of the stream */)
+{
+   uint32_t h = 2166136261u;
+   for(size_t n = 0; n < name.size(); ++n)
+   {
+      h ^= (uint8_t) name[n];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+/// The RADIO/DISH group a stream is sent to.
+/** Derived from radioStreamId, since ZeroMQ limits the length of group names.
+  *
+  * \returns the group name
+  */
+inline
+std::string radioGroup( const std::string & name /**< [in] the name of the stream */)
+{
+   char grp[16];
+   snprintf(grp, sizeof(grp), "mz%08x", radioStreamId(name));
+   return grp;
+}
+
+/// Reassembles messages from their fragments.
+/** Fragments of one message may arrive in any order.  A fragment of a newer message abandons the message being
+  * assembled, which is counted as incomplete and dropped.  Fragments of older messages are ignored.  So only one
+  * message is ever assembled at a time, and the memory held is that of the largest message accepted.
+  *
+  * Datagrams come from anyone who can reach the endpoint, so a fragment whose header does not describe the 
+  * fragmentation the server does, or a message larger than the limit, is ignored before anything is allocated.
+  * The limit is maxSize() until a frame's header gives the size of the stream's messages, see sessionMaxSize(),
+  * and then that until the server session changes.
+  */
+class radioAssembler
+{
+protected:
+   uint32_t m_streamId {0};     ///< The stream id fragments must have.
+   uint32_t m_session {0};      ///< The server session of the message being assembled.
+   uint64_t m_seq {0};          ///< The sequence number of the message being assembled, 0 if none.
+   size_t m_size {0};           ///< The size of the message being assembled.
+   uint32_t m_nfrags {0};       ///< The number of fragments of the message being assembled.
+   uint32_t m_fragSize {0};     ///< The size of the piece of the message in each fragment but the last.
+   uint32_t m_got {0};          ///< The number of fragments received so far.
+   bool m_done {false};         ///< Whether the message being assembled is complete.
+   std::vector<char> m_data;    ///< The message being assembled.
+   std::vector<uint8_t> m_have; ///< Whether each fragment has been received.
+
+   size_t m_maxSize {radioMaxMessage}; ///< The largest message reassembled.
+   size_t m_sessionMaxSize {0};        ///< The largest message reassembled in the current server session, 0 if not known.
+
+   uint64_t m_complete {0};     ///< The number of messages completed.
+   uint64_t m_incomplete {0};   ///< The number of messages dropped because fragments were lost.
+
+public:
+
+   /// Set the stream id fragments must have.
+   void streamId( uint32_t id /**< [in] the stream id, see radioStreamId */);
+
+   /// Set the largest message reassembled
+   /** This should be the header plus the largest frame expected.  Fragments of larger messages are ignored.
+     */
+   void maxSize( size_t ms /**< [in] the new largest message size, in bytes */);
+
+   /// Get the largest message reassembled
+   /**
+     * \returns the current value of m_maxSize
+     */
+   size_t maxSize();
+
+   /// Set the largest message reassembled in the current server session
+   /** Set from the header of a complete message, this is usually far smaller than maxSize().  It is cleared when
+     * the server session changes, since a restarted server may send a different stream.
+     */
+   void sessionMaxSize( size_t ms /**< [in] the new largest message size, in bytes, 0 for maxSize() */);
+
+   /// Get the largest message reassembled in the current server session
+   /**
+     * \returns the current value of m_sessionMaxSize
+     */
+   size_t sessionMaxSize();
+
+   /// Add a fragment.
+   /**
+     * \returns true if this completed a message, which is then available from data() and size() until the next call
+     * \returns false otherwise
+     */
+   bool add( const char * frag, ///< [in] the fragment, with its header
+             size_t sz          ///< [in] the size of the fragment
+           );
+
+   /// Get the message.
+   /**
+     * \returns a pointer to the message
+     */
+   const char * data();
+
+   /// Get the size of the message.
+   /**
+     * \returns the size of the message
+     */
+   size_t size();
+
+   /// Get the number of messages completed.
+   /**
+     * \returns the current value of m_complete
+     */
+   uint64_t complete();
+
+   /// Get the number of messages dropped because fragments were lost.
+   /**
+     * \returns the current value of m_incomplete
+     */
+   uint64_t incomplete();
+};
+
+inline
+void radioAssembler::streamId( uint32_t id )
+{
+   m_streamId = id;
+}
+
+inline
+void radioAssembler::maxSize( size_t ms )
+{
+   m_maxSize = ms;
+}
+
+inline
+size_t radioAssembler::maxSize()
+{
+   return m_maxSize;
+}
+
+inline
+void radioAssembler::sessionMaxSize( size_t ms )
+{
+   m_sessionMaxSize = ms;
+}
+
+inline
+size_t radioAssembler::sessionMaxSize()
+{
+   return m_sessionMaxSize;
+}
+
+inline
+bool radioAssembler::add( const char * frag,
+                          size_t sz
+                        )
+{
+   if(sz <= radioHeaderSize) return false;
+
+   uint32_t streamId, session, size, nfrags, index, fragSize;
+   uint64_t seq;
+   memcpy(&streamId, frag + radioStreamIdOffset, sizeof(uint32_t));
+   memcpy(&session, frag + radioSessionOffset, sizeof(uint32_t));
+   memcpy(&seq, frag + radioSeqOffset, sizeof(uint64_t));
+   memcpy(&size, frag + radioSizeOffset, sizeof(uint32_t));
+   memcpy(&nfrags, frag + radioNfragsOffset, sizeof(uint32_t));
+   memcpy(&index, frag + radioIndexOffset, sizeof(uint32_t));
+   memcpy(&fragSize, frag + radioFragSizeOffset, sizeof(uint32_t));
+
+   size_t len = sz - radioHeaderSize;
+
+   if(streamId != m_streamId) return false;
+
+   //The header must describe how the server fragments, which also bounds what we allocate and where we write.
+   size_t maxSize = m_maxSize;
+   if(session == m_session && m_sessionMaxSize > 0) maxSize = std::min(maxSize, m_sessionMaxSize);
+   
+   if(size == 0 || size > maxSize || fragSize == 0 || fragSize > radioMaxDatagram - radioHeaderSize) return false;
+   if(nfrags != ((size_t) size + fragSize - 1)/fragSize || index >= nfrags) return false;
+
+   size_t offset = (size_t) index*fragSize;
+   if(len != std::min<size_t>(fragSize, size - offset)) return false;
+
+   //A new session starts the sequence numbers over.
+   if(session != m_session || seq > m_seq)
+   {
+      if(m_seq != 0 && !m_done) ++m_incomplete;
+
+      if(session != m_session) m_sessionMaxSize = 0;
+      
+      m_session = session;
+      m_seq = seq;
+      m_size = size;
+      m_nfrags = nfrags;
+      m_fragSize = fragSize;
+      m_got = 0;
+      m_done = false;
+      m_data.resize(m_size);
+      if(m_data.capacity() > maxSize) m_data.shrink_to_fit(); //give back what a larger message took
+      m_have.assign(m_nfrags, 0);
+   }
+   else if(seq < m_seq) return false; //late, the message was already dropped or completed
+
+   if(m_done || size != m_size || fragSize != m_fragSize || m_have[index]) return false;
+
+   memcpy(m_data.data() + offset, frag + radioHeaderSize, len);
+   m_have[index] = 1;
+   ++m_got;
+
+   if(m_got < m_nfrags) return false;
+
+   m_done = true;
+   ++m_complete;
+   return true;
+}
+
+inline
+const char * radioAssembler::data()
+{
+   return m_data.data();
+}
+
+inline
+size_t radioAssembler::size()
+{
+   return m_size;
+}
+
+inline
+uint64_t radioAssembler::complete()
+{
+   return m_complete;
+}
+
+inline
+uint64_t radioAssembler::incomplete()
+{
+   return m_incomplete;
+}
+
+} //namespace milkzmq
+
+#endif //milkzmqRadio_hpp
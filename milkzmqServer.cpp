@@ -53,7 +53,7 @@ void sigSegvHandler( int signum,
    static_cast<void>(siginf);
    static_cast<void>(ucont);
 
-   milkzmq::milkzmqServer::m_restart = true;
+   ++milkzmq::milkzmqServer::m_restartCount; //lock-free, so safe in a handler.  Every publisher sees the change.
 }
 
 int setSigTermHandler()
@@ -131,9 +131,27 @@ void usage( const char * msg = 0 )
    std::cerr << "options:\n";
    std::cerr << "    -h    print this message and exit.\n";
    std::cerr << "    -p    specify the port number of the server [default = 5556].\n";
+   std::cerr << "    -e    specify the endpoint as a full ZeroMQ URI instead, e.g. ipc:///tmp/milkzmq for clients on this host.\n";
+   std::cerr << "          With -S, socket n binds the tcp port plus n, or the URI with -n appended [default is tcp on the port].\n";
    std::cerr << "    -u    specify the loop sleep time in usecs [default = 1000].\n";
    std::cerr << "    -f    specify the F.P.S. target [default = 10.0].\n";
-   std::cerr << "    -x    turn on compression for INT16 and UINT16 types [default is off].\n";
+   std::cerr << "    -s    wait on the stream semaphore for new frames instead of polling [default is off].\n";
+   std::cerr << "    -x    turn on compression [default is off].  INT16 and UINT16 use xrif, other types byte-shuffle plus LZ4.\n";
+   std::cerr << "    -c    choose the compression for each stream adaptively, by trialing the codecs on live frames [default is off].\n";
+   std::cerr << "    -l    specify the link rate in MB/s used to weigh message size against encode time with -c [default = 100].\n";
+   std::cerr << "    -k    specify the number of frames between keyframes for clients which take delta frames [default = 100].\n";
+   std::cerr << "    -n    specify the number of frames of 2D streams to batch into each message, encoded together.\n";
+   std::cerr << "          -f limits the rate of messages, so set it to at least the frame rate / n.  Use with -s.  At most 1000,\n";
+   std::cerr << "          and fewer for streams whose frames would take more than 256 MB [default = 1].\n";
+   std::cerr << "    -w    specify the number of watcher threads, each publishing a share of the streams.\n";
+   std::cerr << "          0 starts one thread per stream [default = 0].\n";
+   std::cerr << "    -S    specify the number of server sockets, on ports port, port+1, etc.  Each has its own server thread [default = 1].\n";
+   std::cerr << "    -R    assign streams to a socket, as glob=n, e.g. \"camsci*=1\".  May be repeated, and the first match wins.\n";
+   std::cerr << "          Streams which match no rule are served on socket 0.  Clients are redirected to the right socket.\n";
+   std::cerr << "    -I    specify the number of ZeroMQ I/O threads [default = 1].\n";
+   std::cerr << "    -U    also send every frame once, for any number of clients, to this UDP endpoint with a RADIO socket,\n";
+   std::cerr << "          e.g. the multicast udp://239.192.0.1:5600.  Frames are keyframes at the F.P.S. target [default is off].\n";
+   std::cerr << "    -F    specify the size of the datagrams sent with -U, at most 8000.  Keep it under the MTU [default = 1400].\n";
    std::cerr << "    -a    If no shm-names are listed, export all from MILK_SHM_DIR.\n";
 }
 
@@ -143,16 +161,28 @@ int main( int argc,
 {
    
    int port = 5556;
+   std::string endpoint;
    int usecSleep = 1000;
    float fpsTgt = 10.0;
    bool compress = false;
+   bool adaptive = false;
+   float linkRate = 100;
+   int keyframeInterval = 100;
+   int batchFrames = 1;
+   bool semWait = false;
+   int numWatchers = 0;
+   int numSockets = 1;
+   std::vector<std::string> socketRules;
+   int ioThreads = 1;
+   std::string radioEndpoint;
+   int radioFragment = 1400;
    bool exportAll = false;
    bool help = false;
    argv0 = argv[0];
    opterr = 0;
    int c;
 
-   while ((c = getopt (argc, argv, "ahxp:u:f:")) != -1)
+   while ((c = getopt (argc, argv, "ahscxp:e:u:f:w:l:k:n:S:R:I:U:F:")) != -1)
    {
       if(c == 'h')
       {
@@ -174,18 +204,54 @@ int main( int argc,
          case 'p':
             port = atoi(optarg);
             break;
+         case 'e':
+            endpoint = optarg;
+            break;
          case 'u':
             usecSleep = atoi(optarg);
             break;
          case 'f':
            fpsTgt = atof(optarg);
            break;
+         case 'w':
+            numWatchers = atoi(optarg);
+            break;
+         case 's':
+            semWait = true;
+            break;
          case 'x':
             compress = true;
             break;
+         case 'c':
+            adaptive = true;
+            break;
+         case 'l':
+            linkRate = atof(optarg);
+            break;
+         case 'k':
+            keyframeInterval = atoi(optarg);
+            break;
+         case 'n':
+            batchFrames = atoi(optarg);
+            break;
+         case 'S':
+            numSockets = atoi(optarg);
+            break;
+         case 'R':
+            socketRules.push_back(optarg);
+            break;
+         case 'I':
+            ioThreads = atoi(optarg);
+            break;
+         case 'U':
+            radioEndpoint = optarg;
+            break;
+         case 'F':
+            radioFragment = atoi(optarg);
+            break;
          case '?':
             char errm[256];
-            if (optopt == 'p' || optopt == 'u' || optopt == 'f' || optopt == 's')
+            if (optopt == 'p' || optopt == 'e' || optopt == 'u' || optopt == 'f' || optopt == 'w' || optopt == 'l' || optopt == 'k' || optopt == 'n' || optopt == 'S' || optopt == 'R' || optopt == 'I' || optopt == 'U' || optopt == 'F')
                snprintf(errm, 256, "Option -%c requires an argument.", optopt);
             else if (isprint (optopt))
                snprintf(errm, 256, "Unknown option `-%c'.", optopt);
@@ -237,9 +303,50 @@ int main( int argc,
    milkzmq::milkzmqServer mzs;
    mzs.argv0(argv0);
    mzs.imagePort(port);
-   if(compress) mzs.defaultCompression();
+   mzs.endpoint(endpoint);
+   if(compress || adaptive) mzs.defaultCompression();
+   mzs.adaptiveCodec(adaptive);
+   mzs.keyframeInterval(keyframeInterval);
+   //Checked while still an int, since -1 would become a huge uint32_t.
+   if(batchFrames < 1 || batchFrames > (int) milkzmq::milkzmqServer::maxBatchFrames || mzs.batchFrames(batchFrames) < 0)
+   {
+      usage(("batch frames must be between 1 and " + std::to_string(milkzmq::milkzmqServer::maxBatchFrames)).c_str());
+      return -1;
+   }
+   if(mzs.codecLinkRate(linkRate) < 0)
+   {
+      usage("link rate must be > 0");
+      return -1;
+   }
    mzs.fpsTgt(fpsTgt);
    mzs.usecSleep(usecSleep);
+   mzs.semWait(semWait);
+   mzs.numWatchers(numWatchers);
+   if(mzs.numSockets(numSockets) < 0)
+   {
+      usage("number of sockets must be >= 1");
+      return -1;
+   }
+   for(size_t n = 0; n < socketRules.size(); ++n)
+   {
+      size_t eq = socketRules[n].rfind('=');
+      if(eq == std::string::npos || mzs.socketRule(socketRules[n].substr(0, eq), atoi(socketRules[n].c_str() + eq + 1)) < 0)
+      {
+         usage("socket rules must be glob=n, with n less than the number of sockets");
+         return -1;
+      }
+   }
+   if(mzs.ioThreads(ioThreads) < 0)
+   {
+      usage("I/O threads must be >= 1");
+      return -1;
+   }
+   mzs.radioEndpoint(radioEndpoint);
+   if(radioFragment < 0 || mzs.radioFragment(radioFragment) < 0)
+   {
+      usage("datagram size must be more than 32 and at most 8000");
+      return -1;
+   }
    setSigTermHandler();
    setSigSegvHandler();
    
@@ -254,7 +361,7 @@ int main( int argc,
    }
  
    // Start the threads.
-   mzs.serverThreadStart();
+   if(mzs.serverThreadStart() < 0) return -1;
    size_t n = 0;
    for(; n < argc-optind; n++) mzs.imageThreadStart(n);
    for(; n < static_cast<int>(argc-optind + streams.size()); n++) mzs.imageThreadStart(n);
@@ -306,5 +413,5 @@ int main( int argc,
    
    // Stop everything.
    mzs.serverThreadKill();
-   for(size_t m=0; m < n; n++) mzs.imageThreadKill(n);
+   for(size_t m=0; m < n; m++) mzs.imageThreadKill(m);
 }
@@ -33,8 +33,14 @@
 #include <sys/inotify.h>
 #include <sys/stat.h> //for stat (inodes)
 
+#include <fnmatch.h> //for matching stream names to sockets
+
 #include <boost/algorithm/string/predicate.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <filesystem>
+#include <limits>
 #include <list>
 #include <mutex>
 #include <unordered_map>
@@ -44,6 +50,12 @@
 #include <zmq.hpp>
 
 #include "milkzmqUtils.hpp"
+#include "milkzmqBufferPool.hpp"
+#include "milkzmqFrameScheduler.hpp"
+#include "milkzmqCodec.hpp"
+#include "milkzmqBinning.hpp"
+#include "milkzmqConvert.hpp"
+#include "milkzmqRadio.hpp"
 
 namespace milkzmq 
 {
@@ -64,13 +76,21 @@ protected:
    
    int m_imagePort{5556}; ///< The port number to use for the image server.
    
+   std::string m_endpoint; ///< The ZeroMQ endpoint URI to bind, e.g. ipc:///tmp/milkzmq.  If empty (the default) tcp://*:m_imagePort is bound.
+   
    std::string m_shMemImName; ///< The name of the ImageStreamIO shared memory image
    
    int m_usecSleep {100}; ///< The number of microseconds to sleep on each loop.  Default 100.
    
+   bool m_semWait {false}; ///< If true, wait on an image stream semaphore for new frames instead of polling cnt0.
+   
+   int m_semTimeout {100000}; ///< Timeout in microseconds for the semaphore wait, after which the stream liveness checks are run.  Default 100000.
+   
+   int m_numWatchers {0}; ///< The number of watcher threads.  If 0 (the default) each stream gets its own image thread.
+   
    float m_fpsTgt{10}; ///< The max frames per second (f.p.s.) to transmit data.
    
-   float m_fpsGain{0.1}; ///< Integrator gain on the fps trigger delta.
+   float m_fpsGain{0.1}; ///< Unused.  Formerly the integrator gain on the fps trigger delta.
    
    int m_xrifDifferenceMethod {XRIF_DIFFERENCE_NONE}; ///< The difference method to use.
    
@@ -78,6 +98,28 @@ protected:
    
    int m_xrifCompressMethod {XRIF_COMPRESS_NONE}; ///< The compression method used.
    
+   bool m_adaptiveCodec {false}; ///< If true, the available codecs are trialed on live frames and the best is chosen for each stream.
+   
+   float m_codecLinkRate {100}; ///< The link rate [MB/s] used to weigh message size against encode time when choosing a codec.
+   
+   float m_codecTrialInterval {60}; ///< The interval [sec] between codec trials.
+   
+   float m_codecDrift {0.2}; ///< The fractional change in compression ratio since the last trial which triggers a new one.
+   
+   uint32_t m_keyframeInterval {100}; ///< The number of frames between keyframes sent to clients which take delta frames.
+   
+   uint32_t m_batchFrames {1}; ///< The number of consecutive frames of 2D streams to send in each message.  1 means no batching.
+   
+   int m_numSockets {1}; ///< The number of server sockets, bound to m_imagePort, m_imagePort+1, etc.  Each has its own server thread.
+   
+   std::vector<std::pair<std::string, int>> m_socketRules; ///< Glob patterns of stream names and the sockets they are served on, in order of precedence.  Others go to socket 0.
+   
+   int m_ioThreads {1}; ///< The number of ZeroMQ I/O threads.
+   
+   std::string m_radioEndpoint; ///< If set, the UDP endpoint every frame is also sent to with a RADIO socket, e.g. udp://239.192.0.1:5600.
+   
+   size_t m_radioFragment {1400}; ///< The size of each datagram sent to m_radioEndpoint, including the fragment header.
+   
    ///@}
    
    /** \name Internal State 
@@ -88,18 +130,66 @@ protected:
    
    zmq::context_t * m_ZMQ_context {nullptr}; ///< The ZeroMQ context, allocated on construction.
 
-   zmq::socket_t * m_server {nullptr};  ///< The ZeroMQ server, allocated when the server thread starts up.
+   std::vector<zmq::socket_t *> m_servers; ///< The ZeroMQ server sockets, allocated and bound by serverThreadStart.  Not changed after.
    
-   std::thread m_serverThread;
+   std::atomic<bool> m_serving {false}; ///< Set once m_servers is ready.
+   
+   std::vector<std::thread> m_serverThreads; ///< The server threads, one per socket.
+   
+   zmq::socket_t * m_radio {nullptr}; ///< The RADIO socket, if m_radioEndpoint is set.  Allocated by serverThreadStart.
+   
+   uint32_t m_radioSession {0}; ///< Identifies this run of the server to DISH clients, so they notice a restart.
    
    typedef uint32_t routing_id_t;
    
-   typedef std::unordered_map< std::string, bool> imageReceivedFlagMap_t;
+   ///A client's subscription to one stream.
+   struct s_subscription
+   {
+      routing_id_t m_routingId {0};        ///< The zmq routing id of the client.
+      std::atomic<bool> m_ready {false};   ///< True if the client has requested a frame, in which case it is on its stream's ready list.
+      std::atomic<int32_t> m_credit {0};   ///< The number of frames the client has granted and not been sent.  Ready while > 0.
+      std::atomic<bool> m_dead {false};    ///< Set by the image thread when a send fails.  Once it is also not ready, the image thread no longer touches this subscription.
+      s_subscription * m_next {nullptr};   ///< The next subscription in the ready list.
+      std::atomic<float> m_fpsReq {0};     ///< The max rate requested by the client.  <= 0 means the server's rate.
+      frameScheduler m_sched;              ///< Schedules the sends to this client.  Only accessed by the image thread.
+      uint64_t m_lastSeq {0};              ///< Sequence number of the last frame sent to this client.  Only accessed by the image thread.
+      std::atomic<bool> m_wantsDelta {false}; ///< The client can reconstruct delta frames.
+      std::atomic<bool> m_needKey {false}; ///< The client could not apply a delta, and needs a keyframe.
+      uint32_t m_sinceKey {0};             ///< The number of delta frames sent since the last keyframe.  Only accessed by the image thread.
+      std::atomic<bool> m_wantsBurst {false}; ///< The client wants every frame of a circular buffer.
+      uint64_t m_lastCnt0 {0};             ///< cnt0 of the last frame sent to this client, 0 if none.  Only accessed by the image thread.
+      std::atomic<uint32_t> m_roiX0 {0};   ///< The first column of the region of interest requested by the client.
+      std::atomic<uint32_t> m_roiY0 {0};   ///< The first row of the region of interest requested by the client.
+      std::atomic<uint32_t> m_roiWidth {0};  ///< The width of the region of interest requested by the client, 0 for the full frame.
+      std::atomic<uint32_t> m_roiHeight {0}; ///< The height of the region of interest requested by the client, 0 for the full frame.
+      std::atomic<uint32_t> m_bin {1};     ///< The binning factor requested by the client.
+      std::atomic<bool> m_binMean {false}; ///< Whether the client wants the mean of each bin rather than the sum.
+      std::atomic<uint8_t> m_convert {convertNone}; ///< The conversion of floating point frames to 16 bits requested by the client.
+      std::atomic<uint64_t> m_cachedSeq {0}; ///< The sequence number of the cached frame the server thread sent on the first request, 0 if none.
+   };
+   
+   ///A stream, identified by its interned integer id, and its subscribers.
+   struct s_stream
+   {
+      size_t m_id {0};                                   ///< The interned id of this stream, its index in m_streams.
+      std::string m_name;                                ///< The name of the stream.
+      std::atomic<s_subscription *> m_readyList {nullptr}; ///< Lock-free list of subscriptions which have requested the next frame.
+      std::atomic<double> m_fpsAchieved {0};             ///< The achieved send rate, updated by the publisher.
+      std::atomic<int64_t> m_lastRequest {0};            ///< Monotonic time of the last request from any client, in nanoseconds.
+      size_t m_socket {0};                               ///< The index of the socket this stream is served on, from m_socketRules.
+      std::mutex m_cacheMutex;                           ///< Mutex for the cached frame.
+      msgBuffer * m_cacheBuf {nullptr};                  ///< The newest keyframe, sent at once to new subscribers.  We hold a reference.
+      size_t m_cacheSize {0};                            ///< The size of the cached frame message.
+      uint64_t m_cacheSeq {0};                           ///< The publisher's sequence number of the cached frame.
+      std::unordered_map<routing_id_t, s_subscription *> m_subscriptions; ///< All subscriptions to this stream.  Only accessed by the server thread.
+   };
+   
+   std::vector<s_stream *> m_streams; ///< The streams, indexed by interned id.  Entries are not deleted until destruction.
    
-   std::unordered_map<routing_id_t, imageReceivedFlagMap_t> m_requestorMap;
+   std::unordered_map<std::string, size_t> m_streamIds; ///< Map of stream names to interned ids.
    
-   ///Mutex for locking map operations (allows asynchronous deletes).
-   std::mutex m_mapMutex;
+   ///Mutex for the stream name lookup (never taken on the send path).
+   std::mutex m_streamMutex;
    
    ///Structure to manage the image threads, including startup.
    struct s_imageThread
@@ -107,6 +197,7 @@ protected:
       std::thread * m_thread {nullptr}; ///< Thread for publishing image slice updates.  A pointer to allow copying, but must be deleted in d'tor of parent.
       milkzmqServer * m_mzs;            ///< a pointer to a milkzmqServer instance (normally this)
       std::string m_imageName;          ///< the name of the image to serve from this thread
+      s_stream * m_stream {nullptr};    ///< the interned stream served by this thread
       
       ///C'tor to create the thread object
       s_imageThread()
@@ -117,6 +208,159 @@ protected:
 
    std::vector<s_imageThread> m_imageThreads; ///< The image threads, one per shared memory streamm being served.
    
+   ///A codec setting which can be chosen for a stream.
+   struct s_codec
+   {
+      int m_differenceMethod {XRIF_DIFFERENCE_NONE}; ///< The xrif difference method.
+      int m_reorderMethod {XRIF_REORDER_NONE};       ///< The xrif reorder method, or reorderByteShuffle for byte-shuffle plus LZ4.
+      int m_compressMethod {XRIF_COMPRESS_NONE};     ///< The xrif compress method.
+      int m_lz4Accel {1};                            ///< The LZ4 acceleration.
+   };
+   
+   ///The maximum number of frames kept by each publisher as references for delta frames.
+   static constexpr size_t maxRefFrames = 4;
+   
+   ///A frame which has been sent to clients which take delta frames, kept to difference later frames against.
+   struct s_refFrame
+   {
+      uint64_t m_seq {0};              ///< The sequence number of the frame.
+      std::vector<char> m_raw;         ///< The frame.
+      size_t m_users {0};              ///< The number of clients which were last sent this frame.
+      msgBuffer * m_delta {nullptr};   ///< The delta from this frame to frame m_deltaSeq.  We hold a reference.
+      size_t m_deltaSize {0};          ///< The size of the delta message.
+      uint64_t m_deltaSeq {0};         ///< The sequence number of the frame m_delta reconstructs.
+   };
+   
+   ///What a subscriber asked to be sent in place of the full frame.
+   struct s_productKey
+   {
+      uint32_t m_x0 {0};      ///< The first column of the region of interest.
+      uint32_t m_y0 {0};      ///< The first row of the region of interest.
+      uint32_t m_width {0};   ///< The width of the region of interest.
+      uint32_t m_height {0};  ///< The height of the region of interest.
+      uint32_t m_bin {1};     ///< The binning factor.
+      bool m_binMean {false}; ///< Whether each bin is the mean rather than the sum.
+      uint8_t m_convert {convertNone}; ///< The conversion to a 16 bit type for sending.
+      
+      bool operator==( const s_productKey & ) const = default;
+   };
+   
+   ///The maximum number of products kept by each publisher.
+   static constexpr size_t maxProducts = 8;
+   
+   ///The longest a stream's cached frame goes without being updated while frames are only copied, in nanoseconds.
+   static constexpr int64_t cacheRefresh = 100000000;
+   
+   ///A product derived from the newest frame, encoded once and shared by every subscriber which asked for it.
+   struct s_product
+   {
+      s_productKey m_key;                   ///< What this product is.
+      uint32_t m_nx {0};                    ///< The width of the product.
+      uint32_t m_ny {0};                    ///< The height of the product.
+      uint8_t m_atype {0};                  ///< The data type of the product, before any conversion.
+      uint8_t m_wireType {0};               ///< The data type sent, after any conversion.
+      s_codec m_codecUsed;                  ///< The codec used for the product.
+      xrif_t m_xrif {nullptr};              ///< The xrif handle used for encoding.
+      size_t m_codec {(size_t) -1};         ///< The index of the publisher's codec m_xrif and m_pool are set up for.
+      std::shared_ptr<msgBufferPool> m_pool; ///< The pool of message buffers.
+      std::vector<char> m_raw;              ///< The product before encoding.
+      std::vector<char> m_unconverted;      ///< The cropped and binned frame, before conversion.
+      std::vector<char> m_scratch;          ///< Working space for the byte-shuffle and binning.
+      msgBuffer * m_buf {nullptr};          ///< The encoded product of frame m_seq.  We hold a reference.
+      size_t m_size {0};                    ///< The size of the encoded product message.
+      uint64_t m_seq {0};                   ///< The sequence number of the frame in m_buf, 0 if none.
+      int64_t m_lastUsed {0};               ///< Monotonic time of the last send of this product.
+   };
+   
+   ///The state of one stream being published.  Used by both the image threads and the watcher threads.
+   struct s_imagePublisher
+   {
+      std::string m_imageName;              ///< The name of the stream.
+      s_stream * m_stream {nullptr};        ///< The interned stream, with its subscribers.
+      char m_fname[512];                    ///< The shared memory file name.
+      bool m_useSem {false};                ///< Whether to claim a semaphore on open.
+      
+      IMAGE m_image;                        ///< The ImageStreamIO image.
+      bool m_opened {false};                ///< Whether m_image is open.
+      bool m_printed {false};               ///< Whether the not-found warning has been printed.
+      ino_t m_inode {0};                    ///< The inode of the shared memory file when opened.
+      int m_semIndex {-1};                  ///< The claimed semaphore, -1 if polling.
+      
+      size_t m_typeSize {0};                ///< The size, in bytes, of the image data type.
+      uint8_t m_atype {0};                  ///< The data type when opened.
+      uint32_t m_snx {0};                   ///< size[0] when opened.
+      uint32_t m_sny {0};                   ///< size[1] when opened.
+      uint32_t m_snz {0};                   ///< size[2] when opened.
+      
+      xrif_t m_xrif {nullptr};              ///< The xrif handle used for encoding.
+      bool m_shuffle {false};               ///< Whether to encode with byte-shuffle plus LZ4 instead of xrif.
+      int m_lz4Accel {1};                   ///< The LZ4 acceleration for the byte-shuffle.
+      std::vector<char> m_scratch;          ///< Working space for the byte-shuffle.
+      
+      std::vector<s_codec> m_codecs;        ///< The codecs available for this stream.  Only one unless m_adaptiveCodec is set.
+      size_t m_codec {0};                   ///< The index of the codec in use.
+      std::vector<char> m_trialBuf;         ///< Destination for codec trials.
+      int64_t m_lastTrial {0};              ///< Monotonic time of the last codec trial, 0 if never.
+      double m_trialRatio {1};              ///< The compression ratio measured in the last trial.
+      double m_ratio {1};                   ///< Running average of the compression ratio since the last trial.
+      std::shared_ptr<msgBufferPool> m_pool; ///< The pool of message buffers.
+      std::shared_ptr<msgBufferPool> m_burstPool; ///< The pool of message buffers for bursts, large enough for every slice of the circular buffer.
+      size_t m_msgSz {0};                   ///< The maximum message size.
+      
+      frameScheduler m_sched;               ///< Schedules the sends at m_fpsTgt.
+      frameScheduler m_radioSched;          ///< Schedules the frames encoded for the RADIO socket at m_fpsTgt.
+      uint64_t m_radioSeq {0};              ///< Sequence number of the last frame sent to the RADIO socket.
+      uint32_t m_radioId {0};               ///< The stream id in the fragment header, see radioStreamId.
+      int64_t m_lastLiveCheck {0};          ///< Monotonic time of the last liveness check, in nanoseconds.
+      int64_t m_cacheTime {0};              ///< Monotonic time the stream's cached frame was last updated, 0 if there is none.
+      int64_t m_lastOpenTry {0};            ///< Monotonic time of the last attempt to open the stream, in nanoseconds.
+      unsigned m_restartCount {0};          ///< The value of m_restartCount when the stream was last opened.
+      uint64_t m_lastCnt0 {0};              ///< cnt0 of the newest encoded frame.
+      uint64_t m_seq {0};                   ///< Sequence number of the newest frame, starting from 1.
+      bool m_haveFrame {false};             ///< Whether there is a newest frame.
+      uint64_t m_frameCnt0 {0};             ///< cnt0 of the newest frame, for the header.
+      uint32_t m_frameSlice {0};            ///< The slice of the circular buffer holding the newest frame.
+      timespec m_frameTime {0,0};           ///< The write time of the newest frame, for the header.
+      msgBuffer * m_lastBuf {nullptr};      ///< The newest frame, encoded as a keyframe.  We hold a reference.  May be nullptr until needed if m_curRawSeq == m_seq.
+      size_t m_lastSize {0};                ///< The size of the newest encoded frame message.
+      int64_t m_nextDue {0};                ///< When publisherUpdate returns 1, the monotonic time at which a send may next be possible.
+      
+      std::vector<s_subscription *> m_subs; ///< Subscriptions taken from the ready list, kept across a restart until sent to.
+      
+      std::vector<char> m_curRaw;           ///< Copy of the newest frame, made when a subscriber takes delta frames.
+      uint64_t m_curRawSeq {0};             ///< The sequence number of the frame in m_curRaw, 0 if none.
+      std::vector<s_refFrame> m_refs;       ///< Frames kept to difference against, at most maxRefFrames.
+      std::vector<char> m_deltaRaw;         ///< Working space for the delta.
+      
+      xrif_t m_batchXrif {nullptr};         ///< The xrif handle used for encoding batches.
+      std::shared_ptr<msgBufferPool> m_batchPool; ///< The pool of message buffers for batches.
+      std::vector<char> m_batchRaw;         ///< The frames collected for the next batch.
+      std::vector<char> m_batchDelta;       ///< Working space for the frame to frame deltas of a batch.
+      std::vector<uint64_t> m_batchMeta;    ///< cnt0, tv_sec and tv_nsec of each frame collected for the next batch.
+      uint32_t m_batchCount {0};            ///< The number of frames collected for the next batch.
+      uint32_t m_batchFrames {1};           ///< The number of frames in each batch, the server's m_batchFrames limited by maxBatchBytes.
+      uint64_t m_batchCnt0 {0};             ///< cnt0 of the last frame collected.
+      bool m_batchShuffle {false};          ///< Whether batches are encoded with byte-shuffle plus LZ4 instead of xrif.
+      
+      msgBuffer * m_burstBuf {nullptr};     ///< The burst ending with the newest frame.  We hold a reference.
+      size_t m_burstSize {0};               ///< The size of the burst message.
+      uint64_t m_burstFrom {0};             ///< The cnt0 the burst starts after.
+      
+      std::vector<s_product> m_products;    ///< The products subscribers have asked for, at most maxProducts.
+   };
+   
+   ///Structure to manage a watcher thread, which publishes a shard of the streams.
+   struct s_watcherThread
+   {
+      std::thread m_thread;                     ///< The thread.
+      milkzmqServer * m_mzs {nullptr};          ///< a pointer to a milkzmqServer instance (normally this)
+      int m_wno {0};                            ///< The number of this watcher.
+      std::mutex m_mutex;                       ///< Mutex for m_newStreams.
+      std::vector<std::string> m_newStreams;    ///< Streams assigned to this watcher but not yet picked up by it.
+   };
+   
+   std::vector<s_watcherThread *> m_watcherThreads; ///< The watcher threads, if m_numWatchers > 0.
+   
    
    ///@}
    
@@ -156,6 +400,37 @@ public:
      */ 
    int imagePort();
    
+   /// Set the endpoint of the image server
+   /** This is a full ZeroMQ URI, such as tcp://192.168.1.10:5556, ipc:///tmp/milkzmq or inproc://milkzmq, and overrides the port.
+     * With more than one socket, socket n binds the tcp port plus n, or for other transports the URI with "-n" appended.
+     * Use ipc:// for clients on the same host, and inproc:// for a client in the same process sharing context().
+     * 
+     * This sets the value of m_endpoint.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */ 
+   int endpoint( const std::string & ep /**< [in] the new endpoint URI, empty for tcp on imagePort() of all interfaces */);
+   
+   /// Get the endpoint of the image server
+   /**
+     * \returns the current value of m_endpoint
+     */ 
+   std::string endpoint();
+   
+   /// Get the endpoint a socket is bound to.
+   /**
+     * \returns the URI of socket sock
+     */ 
+   std::string endpoint( size_t sock /**< [in] the socket */);
+   
+   /// Get the ZeroMQ context.
+   /** A client in the same process must use this context to connect to an inproc:// endpoint.
+     *
+     * \returns the context, which is owned by the server
+     */
+   zmq::context_t * context();
+   
    /// Add the name of the ImageStreamIO shared memory image to the list
    /** This is just the root.  E.g. for a complete path of '/tmp/image00.im.shm' the argument should be "image00".
      * This extends the m_imageThreads vector.
@@ -193,8 +468,64 @@ public:
      */ 
    int usecSleep();
    
-   /// Set the target F.P.S. served.
+   /// Set whether the image threads wait on a semaphore for new frames.
+   /** If true, each image thread claims a semaphore with ImageStreamIO_getsemwaitindex and blocks on it,
+     * rather than polling cnt0 every m_usecSleep microseconds.  If no semaphore is available the thread
+     * falls back to polling.
+     * 
+     * This sets the value of m_semWait.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int semWait( const bool & sw /**< [in] the new semaphore wait flag*/);
+   
+   /// Get whether the image threads wait on a semaphore for new frames.
+   /**
+     * \returns the current value of m_semWait.
+     */
+   bool semWait();
+   
+   /// Set the semaphore wait timeout.
+   /** The stream liveness checks (inode and semaphore count) are run each time the wait times out.
+     * 
+     * This sets the value of m_semTimeout.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int semTimeout( const int & usec /**< [in] the new timeout in microseconds*/);
+   
+   /// Get the semaphore wait timeout.
+   /**
+     * \returns the current value of m_semTimeout.
+     */
+   int semTimeout();
+   
+   /// Set the number of watcher threads.
+   /** If greater than 0, streams are assigned round-robin to this many watcher threads, each of which
+     * scans cnt0 of its streams and publishes new frames, in place of one image thread per stream.
+     * Watcher threads poll every m_usecSleep microseconds and do not wait on semaphores.  The stream 
+     * liveness checks are run every m_semTimeout microseconds.
+     * 
+     * Must be set before the first call to imageThreadStart.
+     * 
+     * This sets the value of m_numWatchers.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int numWatchers( const int & nw /**< [in] the new number of watcher threads*/);
+   
+   /// Get the number of watcher threads.
    /**
+     * \returns the current value of m_numWatchers.
+     */
+   int numWatchers();
+   
+   /// Set the target F.P.S. served.
+   /** Frames are sent at absolute deadlines spaced by 1/fps on CLOCK_MONOTONIC.  If fps <= 0 there is no limit.
+     * 
      * \returns 0 on success
      * \returns -1 on error
      */
@@ -206,8 +537,15 @@ public:
      */ 
    float fpsTgt();
    
+   /// Get the achieved F.P.S. of a stream.
+   /** This is measured over a window of at least 1 second, and is 0 until a window has completed.
+     * 
+     * \returns the achieved rate at which frames of the stream were sent.
+     */
+   float fpsAchieved( size_t n /**< [in] the stream number */);
+   
    /// Set the gain of the F.P.S. error loop.
-   /** Uses an integrator controller to keep the image serving rate as close to m_fpsTgt as possible.
+   /** Deprecated.  Sends are now scheduled by absolute deadlines, so this has no effect.
      * 
      * \returns 0 on success
      * \returns -1 on error
@@ -215,8 +553,9 @@ public:
    int fpsGain(const float & gain /**< [in] the new fps gain value*/);
    
    /// Get the gain of the F.P.S. error loop.
-   /**
-     * \returns the gain of the fps integrator, m_fpsGain.
+   /** Deprecated, see fpsGain(const float &).
+     * 
+     * \returns m_fpsGain.
      */ 
    float fpsGain();
    
@@ -227,6 +566,7 @@ public:
    
    /// Enable default compression.
    /** Default compression is XRIF_DIFFERENCE_PIXEL, XRIF_REORDER_BYTEPACK_RENIBBLE, XRIF_COMPRESS_LZ4.
+     * Types other than INT16 and UINT16, which xrif does not compress well, are byte-shuffled and compressed with LZ4.
      */
    void defaultCompression();
 
@@ -269,21 +609,224 @@ public:
      */ 
    int xrifCompressMethod();
    
+   /// Set whether the codec is chosen adaptively for each stream.
+   /** If true, compression is on and each stream periodically trials the available difference/reorder/compress
+     * combinations on a live frame, choosing the one which minimizes encode time plus transmission time at m_codecLinkRate.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int adaptiveCodec( const bool & ac /**< [in] the new value of the flag */);
+   
+   /// Get whether the codec is chosen adaptively for each stream.
+   /**
+     * \returns the current value of m_adaptiveCodec.
+     */ 
+   bool adaptiveCodec();
+   
+   /// Set the link rate used to choose codecs.
+   /** A slower link favors smaller messages, a faster link favors faster encoding.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int codecLinkRate( const float & lr /**< [in] the new link rate [MB/s], must be > 0 */);
+   
+   /// Get the link rate used to choose codecs.
+   /**
+     * \returns the current value of m_codecLinkRate.
+     */ 
+   float codecLinkRate();
+   
+   /// Set the interval between codec trials.
+   /** 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int codecTrialInterval( const float & ti /**< [in] the new interval [sec] */);
+   
+   /// Get the interval between codec trials.
+   /**
+     * \returns the current value of m_codecTrialInterval.
+     */ 
+   float codecTrialInterval();
+   
+   /// Set the change in compression ratio which triggers a codec trial.
+   /** 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int codecDrift( const float & cd /**< [in] the new fractional change in compression ratio */);
+   
+   /// Get the change in compression ratio which triggers a codec trial.
+   /**
+     * \returns the current value of m_codecDrift.
+     */ 
+   float codecDrift();
+   
+   /// Set the keyframe interval for clients which take delta frames.
+   /** 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int keyframeInterval( const uint32_t & ki /**< [in] the new number of frames between keyframes */);
+   
+   /// Get the keyframe interval for clients which take delta frames.
+   /**
+     * \returns the current value of m_keyframeInterval.
+     */ 
+   uint32_t keyframeInterval();
+   
+   ///The largest number of frames in a batch.
+   static constexpr uint32_t maxBatchFrames = 1000;
+   
+   ///The largest size of the frames of a batch, in bytes.  Streams with larger frames get fewer frames per batch.
+   static constexpr size_t maxBatchBytes = 256*1024*1024;
+   
+   /// Set the number of consecutive frames of 2D streams to send in each message.
+   /** Every frame is collected, and each message holds batchFrames frames encoded together, so temporal structure 
+     * is exploited by the compression.  The publisher waits on every frame rather than the send deadline, so use semaphore 
+     * waits or a fast enough poll.  The F.P.S. target limits the rate of messages, not of frames.  Each stream batches
+     * no more frames than fit in maxBatchBytes.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int batchFrames( const uint32_t & bf /**< [in] the new number of frames per message, from 1 to maxBatchFrames */);
+   
+   /// Get the number of consecutive frames of 2D streams to send in each message.
+   /**
+     * \returns the current value of m_batchFrames.
+     */ 
+   uint32_t batchFrames();
+   
+   /// Set the number of server sockets.
+   /** Socket n is bound to port imagePort()+n, and has its own server thread.  Streams are assigned to sockets with
+     * socketRule, and a client which asks for a stream on the wrong socket is redirected to the right one.
+     * Must be set before serverThreadStart.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int numSockets( const int & ns /**< [in] the new number of sockets, must be >= 1 */);
+   
+   /// Get the number of server sockets.
+   /**
+     * \returns the current value of m_numSockets.
+     */ 
+   int numSockets();
+   
+   /// Add a rule assigning streams to a server socket.
+   /** Rules are checked in the order added, and the first whose pattern matches the stream name wins.  Streams which match
+     * no rule are served on socket 0.  Must be added before the streams are started.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int socketRule( const std::string & glob, ///< [in] the fnmatch pattern for stream names
+                   const int & sock          ///< [in] the socket, from 0 to numSockets()-1
+                 );
+   
+   /// Set the number of ZeroMQ I/O threads.
+   /** Must be set before serverThreadStart.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int ioThreads( const int & it /**< [in] the new number of I/O threads, must be >= 1 */);
+   
+   /// Get the number of ZeroMQ I/O threads.
+   /**
+     * \returns the current value of m_ioThreads.
+     */ 
+   int ioThreads();
+   
+   /// Set the UDP endpoint every frame is also sent to, once, for any number of DISH clients.
+   /** Each newest frame is encoded as a keyframe at the F.P.S. target, fragmented into datagrams, and sent with a
+     * RADIO socket to the group radioGroup(name).  A multicast address reaches every client on the LAN for the cost
+     * of one.  Must be set before serverThreadStart.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int radioEndpoint( const std::string & ep /**< [in] the new endpoint, e.g. udp://239.192.0.1:5600, empty for none */);
+   
+   /// Get the UDP endpoint every frame is also sent to.
+   /**
+     * \returns the current value of m_radioEndpoint.
+     */ 
+   std::string radioEndpoint();
+   
+   /// Set the size of the datagrams sent to the RADIO endpoint.
+   /** Keep it under the network MTU, so a lost IP fragment does not lose the whole datagram.
+     * 
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int radioFragment( const size_t & rf /**< [in] the new datagram size, including the fragment header, at most radioMaxDatagram */);
+   
+   /// Get the size of the datagrams sent to the RADIO endpoint.
+   /**
+     * \returns the current value of m_radioFragment.
+     */ 
+   size_t radioFragment();
+   
+protected:
+   
+   /// Get the stream for a name, interning it if it does not exist yet.
+   /** 
+     * \returns a pointer to the stream, which is valid for the lifetime of the server.
+     */
+   s_stream * stream( const std::string & name /**< [in] the name of the stream */);
+   
+   /// Add a subscription to its stream's ready list.
+   /** The caller must have set m_ready from false to true, which guarantees the subscription is not already on the list.
+     */
+   static void pushReady( s_stream * st,        ///< [in] the stream 
+                          s_subscription * sub  ///< [in] the subscription to add
+                        );
+   
+   /// Take all subscriptions from a stream's ready list.
+   /** The subscriptions are appended to subs.  Their m_ready flags are still true.
+     */
+   static void takeReady( std::vector<s_subscription *> & subs, ///< [out] the ready subscriptions are appended to this vector
+                          s_stream * st                         ///< [in] the stream
+                        );
+   
 private:
    
    ///Server thread starter, called by serverThreadStart on thread construction.  Calls serverThreadExec.
-   static void internal_serverThreadStart( milkzmqServer * mzs /**< [in] a pointer to a milkzmqServer instance, usually this */);
+   static void internal_serverThreadStart( milkzmqServer * mzs, ///< [in] a pointer to a milkzmqServer instance, usually this
+                                           size_t sock          ///< [in] the socket the thread serves
+                                         );
 
 public:
-   /// Start the server thread.
+   /// Bind the server sockets and start a server thread for each.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
    int serverThreadStart();
 
-   /// Execute the image thread.
-   void serverThreadExec();
+   /// Execute a server thread.
+   void serverThreadExec( size_t sock /**< [in] the socket to serve */);
    
-   /// Signal the server thread to kill it.
+   /// Signal the server threads to kill them.
    int serverThreadKill( );
    
+protected:
+   
+   /// Tell a client which asked for a stream on the wrong socket where to find it.
+   /** Sends a header with frameFlagRedirect set and the stream's tcp port in the redirectPort field, followed by the
+     * URI of the stream's socket.
+     */
+   void sendRedirect( zmq::socket_t * server, ///< [in] the socket the request came in on
+                      routing_id_t routingId, ///< [in] the client
+                      s_stream * st           ///< [in] the stream asked for
+                    );
+   
+public:
+   
 private:
    
    ///Image thread starter, called by imageThreadStart on thread construction.  Calls imageThreadExec.
@@ -302,49 +845,306 @@ public:
    /// Signal the image thread to kill it.
    int imageThreadKill( size_t thno /**< [in] the thread to kill */ );
    
-   /// Flag to indicate a restart of the image thread loop is needed.
-   /** This is intended to be set after a SIGSEGV or SIGBUS is recieved, which tends
-     * to occur if the source of the images exits, causing the
-     * shared mem stream to go wonky.
-     */ 
-   static bool m_restart;
+protected:
    
-   /** \name Status and Error Handling
-     * Status updates, warnings, and errors are reported using virtual functions, so that custom handling can be implemented.
-     *
-     * @{
+   /// Initialize a publisher for a stream.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
      */
+   int publisherInit( s_imagePublisher & pub,        ///< [out] the publisher to initialize
+                      const std::string & imageName  ///< [in] the name of the stream
+                    );
    
-   /// Report status (with LOG_INFO level of priority) to the user using stderr.
-   virtual void reportInfo( const std::string & msg /**< [in] the status message */);
+   /// Make one attempt to open the stream and configure encoding for it.
+   /**
+     * \returns 0 on success
+     * \returns -1 if the stream is not available (yet)
+     */
+   int publisherOpen( s_imagePublisher & pub /**< [in/out] the publisher */);
    
-   /// Report status (with LOG_NOTICE level of priority) to the user using stderr.
-   virtual void reportNotice( const std::string & msg /**< [in] the status message */);
+   /// Fill in the codecs available for the stream's type, and size the buffers for them.
+   void publisherCodecs( s_imagePublisher & pub /**< [in/out] the publisher */);
    
-   /// Report a warning to the user using stderr.
-   virtual void reportWarning( const std::string & msg /**< [in] the warning message */);
+   /// Switch the stream to one of its codecs.
+   void publisherCodec( s_imagePublisher & pub, ///< [in/out] the publisher
+                        size_t n                ///< [in] the index of the codec in pub.m_codecs
+                      );
    
-   /// Report an error to the user using stderr.
-   virtual void reportError( const std::string & msg,  ///< [in] the error message 
-                             const std::string & file, ///< [in] the name of the file where the error occurred
-                             int line                  ///< [in] the line number of the error
+   /// Trial each of the stream's codecs on a frame, and switch to the best.
+   void publisherTrial( s_imagePublisher & pub, ///< [in/out] the publisher
+                        const char * src,       ///< [in] the frame
+                        int64_t now             ///< [in] the current monotonic time in nanoseconds
+                      );
+   
+   /// Encode a frame with the current codec.
+   /**
+     * \returns the encoded size
+     */
+   size_t publisherCompress( s_imagePublisher & pub,   ///< [in/out] the publisher
+                             char * dest,              ///< [out] the encoded frame, pub.m_msgSz - headerSize in size
+                             const char * src,         ///< [in] the frame
+                             int16_t & differenceMethod, ///< [out] the difference method for the header
+                             int16_t & reorderMethod,  ///< [out] the reorder method for the header
+                             int16_t & compressMethod  ///< [out] the compress method for the header
                            );
-
-   ///@}
-};
-
-bool milkzmqServer::m_timeToDie = false;
-bool milkzmqServer::m_restart = false;
-
-inline
-milkzmqServer::milkzmqServer()
-{
-   milkzmq_argv0 = m_argv0; //set the global
-   ImageStreamIO_set_printError(milkzmq_printError);
-      
-   m_ZMQ_context = new zmq::context_t;
-}
-
+   
+   /// Check if a subscription is due to be sent a frame, given its requested rate.
+   /**
+     * \returns true if the subscription is due
+     */
+   bool subscriptionDue( s_subscription * sub, ///< [in] the subscription
+                         int64_t now           ///< [in] the current monotonic time in nanoseconds
+                       );
+   
+   /// Take one credit from a subscription, for a frame about to be sent to it.
+   /** Taking the last credit clears the ready flag, unless more were granted meanwhile.
+     *
+     * \returns true if the subscription is still ready, so the publisher keeps it for the next frame
+     * \returns false if it is no longer ready, and must be dropped by the publisher
+     */
+   static bool takeCredit( s_subscription * sub /**< [in] the subscription */);
+   
+   /// Send the newest frame to the ready subscribers which are due and have not had it yet.
+   /** A new frame is encoded once, and shared by all subscribers which are sent it.
+     *
+     * \returns 2 if a frame was sent
+     * \returns 1 if a frame is waiting to be sent, but no one is due yet.  pub.m_nextDue is set.
+     * \returns 0 if there is nothing to send, i.e. no new frame for any subscriber
+     * \returns -1 if the stream must be closed and re-opened
+     */
+   int publisherUpdate( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Take the current frame, which becomes the newest frame.
+   /** The keyframe is encoded now, unless a subscriber takes delta frames, in which case the frame is copied
+     * and the keyframe and deltas are encoded when first needed.
+     * 
+     * \returns 0 on success
+     * \returns -1 if the stream must be closed and re-opened
+     */
+   int publisherEncode( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Encode the newest frame as a keyframe, in pub.m_lastBuf.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int publisherKeyframe( s_imagePublisher & pub, ///< [in/out] the publisher
+                          const char * src        ///< [in] the frame
+                        );
+   
+   /// Encode the newest frame, which must be in pub.m_curRaw, as a delta from a reference frame.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int publisherDelta( s_imagePublisher & pub, ///< [in/out] the publisher
+                       s_refFrame & ref        ///< [in/out] the reference frame, which holds the delta
+                     );
+   
+   /// Set up batch encoding for the stream, if batching is on.
+   void publisherBatchSetup( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Collect the current frame into the batch, if it is new and anyone has asked for the stream recently.
+   /** When the batch is full it is encoded, and becomes the newest frame.
+     * 
+     * \returns 1 if a batch was completed
+     * \returns 0 if not
+     * \returns -1 if the stream must be closed and re-opened
+     */
+   int publisherBatch( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Encode the slices of a circular buffer written after a given frame, up to the newest, as a burst in pub.m_burstBuf.
+   /** The slices are encoded straight from the stream, so any the source reached while we encoded them are dropped.
+     *
+     * \returns 0 on success
+     * \returns 1 if the source overwrote even the newest frame, so there is no burst
+     * \returns -1 on error
+     */
+   int publisherBurst( s_imagePublisher & pub, ///< [in/out] the publisher
+                       uint64_t from           ///< [in] the cnt0 of the last frame the client has, 0 if none
+                     );
+   
+   /// Write the header for the newest frame.
+   void publisherHeader( s_imagePublisher & pub,   ///< [in] the publisher
+                         uint8_t * msg,            ///< [out] the message buffer
+                         uint32_t compressedSize,  ///< [in] the encoded size
+                         int16_t differenceMethod, ///< [in] the difference method
+                         int16_t reorderMethod,    ///< [in] the reorder method
+                         int16_t compressMethod,   ///< [in] the compress method
+                         uint8_t flags,            ///< [in] the frame flags
+                         uint64_t refSeq           ///< [in] the sequence number of the reference frame for a delta
+                       );
+   
+   /// Find a reference frame.
+   /**
+     * \returns a pointer to the reference frame, nullptr if it is not kept.
+     */
+   s_refFrame * publisherRef( s_imagePublisher & pub, ///< [in] the publisher
+                              uint64_t seq            ///< [in] the sequence number of the frame
+                            );
+   
+   /// Keep the newest frame as a reference for a client which was sent it, and release its previous one.
+   void publisherRetain( s_imagePublisher & pub, ///< [in/out] the publisher
+                         uint64_t oldSeq         ///< [in] the sequence number of the frame the client had before
+                       );
+   
+   /// Drop the reference frames and deltas.
+   void publisherDropRefs( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Get the product a subscriber asked for, clipped to the frame.
+   /**
+     * \returns true if the subscriber asked for a product
+     * \returns false if the subscriber gets the full frame
+     */
+   bool subscriptionProduct( s_imagePublisher & pub, ///< [in] the publisher
+                             s_subscription * sub,   ///< [in] the subscriber
+                             s_productKey & key      ///< [out] the product
+                           );
+   
+   /// Find a product, adding it if it is new.
+   /** If there are already maxProducts, the least recently sent is replaced.
+     * 
+     * \returns a pointer to the product
+     */
+   s_product * publisherProduct( s_imagePublisher & pub,   ///< [in/out] the publisher
+                                 const s_productKey & key  ///< [in] the product
+                               );
+   
+   /// Encode the newest frame as a product.
+   /** The product is cut from pub.m_curRaw, never from the stream, which the source may be writing the next frame to.
+     *
+     * \returns 0 on success
+     * \returns 1 if the frame was not copied, and has since been overwritten, so there is nothing to send
+     * \returns -1 on error
+     */
+   int publisherProductEncode( s_imagePublisher & pub, ///< [in/out] the publisher
+                               s_product & p           ///< [in/out] the product
+                             );
+   
+   /// Drop all of the products.
+   void publisherDropProducts( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Send the newest frame to a subscriber.
+   /** Sends a product, such as a region of interest, if the subscriber asked for one.  Sends a burst if the subscriber wants them and the stream is a circular buffer.  Sends a delta if the subscriber takes them, it still has a frame we kept, and no keyframe is due.  Otherwise sends the keyframe.
+     * 
+     * \returns 0 on success
+     * \returns -1 on an encoding error
+     */
+   int publisherSend( s_imagePublisher & pub, ///< [in/out] the publisher
+                      s_subscription * sub    ///< [in] the subscriber, which is removed from the ready list
+                    );
+   
+   /// Update the stream's cached frame to the publisher's newest keyframe, which may be none.
+   void publisherCache( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Send the stream's cached frame to a new subscriber, from the server thread.
+   /**
+     * \returns true if the cached frame was sent
+     * \returns false if there is none, or the send failed
+     */
+   bool sendCached( s_stream * st,       ///< [in] the stream
+                    s_subscription * sub ///< [in] the new subscriber
+                  );
+   
+   /// Send the newest frame to the RADIO socket if it has not been sent.
+   /** If there is a new frame and it is due at the F.P.S. target, it is encoded first.
+     *
+     * \returns 0 if nothing is pending
+     * \returns 1 if a new frame is waiting for its deadline, in which case m_radioSched.next() is when
+     * \returns -1 on error
+     */
+   int publisherRadio( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Fragment a message and send it to the RADIO socket.
+   void radioSend( s_imagePublisher & pub, ///< [in] the publisher
+                   const char * data,      ///< [in] the message
+                   size_t sz,              ///< [in] the size of the message
+                   uint64_t seq            ///< [in] the sequence number of the message
+                 );
+   
+   /// Send a message buffer to a subscriber.
+   void sendBuffer( s_stream * st,        ///< [in] the stream
+                    s_subscription * sub, ///< [in] the subscriber, which must not be touched after this if the send fails
+                    msgBuffer * buf,      ///< [in] the buffer, a reference is taken for the message
+                    size_t sz             ///< [in] the size of the message
+                  );
+   
+
+   /// Check that the stream is still alive, i.e. has not been cleaned up or re-created.
+   /**
+     * \returns 0 if the stream is alive
+     * \returns -1 if the stream must be closed and re-opened
+     */
+   int publisherCheck( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Close the stream, releasing any claimed semaphore.
+   void publisherClose( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Send a 0 message to all ready subscribers to tell them to hangup.
+   void publisherHangup( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+   /// Close the stream and free the encoding resources.
+   void publisherFree( s_imagePublisher & pub /**< [in/out] the publisher */);
+   
+private:
+   
+   ///Watcher thread starter, called by watcherThreadsStart on thread construction.  Calls watcherThreadExec.
+   static void internal_watcherThreadStart( s_watcherThread * wt /**< [in] a pointer to an s_watcherThread structure */);
+   
+public:
+   
+   /// Start the watcher threads, if not already started.
+   int watcherThreadsStart();
+   
+   /// Execute a watcher thread.
+   void watcherThreadExec( s_watcherThread * wt /**< [in] the watcher thread's structure */);
+   
+   /// Count of the restarts of the image thread loops requested.
+   /** This is intended to be incremented after a SIGSEGV or SIGBUS is recieved, which tends
+     * to occur if the source of the images exits, causing the
+     * shared mem stream to go wonky.  Each publisher compares it with its copy from when it opened
+     * its stream, so every image thread and watcher sees the restart, not just the first to look.
+     */ 
+   static std::atomic<unsigned> m_restartCount;
+   
+   /** \name Status and Error Handling
+     * Status updates, warnings, and errors are reported using virtual functions, so that custom handling can be implemented.
+     *
+     * @{
+     */
+   
+   /// Report status (with LOG_INFO level of priority) to the user using stderr.
+   virtual void reportInfo( const std::string & msg /**< [in] the status message */);
+   
+   /// Report status (with LOG_NOTICE level of priority) to the user using stderr.
+   virtual void reportNotice( const std::string & msg /**< [in] the status message */);
+   
+   /// Report a warning to the user using stderr.
+   virtual void reportWarning( const std::string & msg /**< [in] the warning message */);
+   
+   /// Report an error to the user using stderr.
+   virtual void reportError( const std::string & msg,  ///< [in] the error message 
+                             const std::string & file, ///< [in] the name of the file where the error occurred
+                             int line                  ///< [in] the line number of the error
+                           );
+
+   ///@}
+};
+
+bool milkzmqServer::m_timeToDie = false;
+std::atomic<unsigned> milkzmqServer::m_restartCount {0};
+static_assert(std::atomic<unsigned>::is_always_lock_free, "m_restartCount is incremented in a signal handler");
+
+inline
+milkzmqServer::milkzmqServer()
+{
+   milkzmq_argv0 = m_argv0; //set the global
+   ImageStreamIO_set_printError(milkzmq_printError);
+      
+   m_ZMQ_context = new zmq::context_t;
+}
+
 inline
 milkzmqServer::~milkzmqServer()
 {
@@ -360,15 +1160,38 @@ milkzmqServer::~milkzmqServer()
       }
    }
    
-   if(m_server) m_server->close();
+   for(size_t n = 0; n < m_watcherThreads.size(); ++n)
+   {
+      if(m_watcherThreads[n]->m_thread.joinable()) m_watcherThreads[n]->m_thread.join();
+      delete m_watcherThreads[n];
+   }
+   
+   for(size_t n = 0; n < m_servers.size(); ++n) m_servers[n]->close();
+   
+   if(m_radio) m_radio->close();
    
    if(m_ZMQ_context) delete m_ZMQ_context;
    
-   pthread_kill(m_serverThread.native_handle(), SIGINT);
-   if(m_serverThread.joinable()) m_serverThread.join();
+   for(size_t n = 0; n < m_serverThreads.size(); ++n)
+   {
+      pthread_kill(m_serverThreads[n].native_handle(), SIGINT);
+      if(m_serverThreads[n].joinable()) m_serverThreads[n].join();
+   }
    
-  
+   for(size_t n = 0; n < m_servers.size(); ++n) delete m_servers[n];
+   
+   if(m_radio) delete m_radio;
    
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      if(m_streams[n]->m_cacheBuf) msgBufferPool::release(m_streams[n]->m_cacheBuf);
+      
+      for(auto it = m_streams[n]->m_subscriptions.begin(); it != m_streams[n]->m_subscriptions.end(); ++it)
+      {
+         delete it->second;
+      }
+      delete m_streams[n];
+   }
 }
 
 inline 
@@ -400,6 +1223,42 @@ int milkzmqServer::imagePort()
    return m_imagePort;
 }
 
+inline
+int milkzmqServer::endpoint( const std::string & ep )
+{
+   m_endpoint = ep;
+   
+   return 0;
+}
+
+inline
+std::string milkzmqServer::endpoint()
+{
+   return m_endpoint;
+}
+
+inline
+std::string milkzmqServer::endpoint( size_t sock )
+{
+   if(m_endpoint == "") return "tcp://*:" + std::to_string(m_imagePort + sock);
+   
+   if(sock == 0) return m_endpoint;
+   
+   if(m_endpoint.compare(0, 6, "tcp://") == 0)
+   {
+      size_t colon = m_endpoint.rfind(':');
+      return m_endpoint.substr(0, colon+1) + std::to_string(atoi(m_endpoint.c_str() + colon + 1) + sock);
+   }
+   
+   return m_endpoint + "-" + std::to_string(sock);
+}
+
+inline
+zmq::context_t * milkzmqServer::context()
+{
+   return m_ZMQ_context;
+}
+
 
 inline
 int milkzmqServer::shMemImName( const std::string & name )
@@ -408,6 +1267,7 @@ int milkzmqServer::shMemImName( const std::string & name )
    
    nt.m_mzs = this;
    nt.m_imageName = name;
+   nt.m_stream = stream(name);
    
    m_imageThreads.push_back(nt);
    
@@ -439,6 +1299,49 @@ int milkzmqServer::usecSleep()
    return m_usecSleep;
 }
 
+inline
+int milkzmqServer::semWait( const bool & sw )
+{
+   m_semWait = sw;
+   return 0;
+}
+
+inline
+bool milkzmqServer::semWait()
+{
+   return m_semWait;
+}
+
+inline
+int milkzmqServer::semTimeout( const int & usec )
+{
+   if(usec <= 0) return -1;
+   
+   m_semTimeout = usec;
+   return 0;
+}
+
+inline
+int milkzmqServer::semTimeout()
+{
+   return m_semTimeout;
+}
+
+inline
+int milkzmqServer::numWatchers( const int & nw )
+{
+   if(nw < 0) return -1;
+   
+   m_numWatchers = nw;
+   return 0;
+}
+
+inline
+int milkzmqServer::numWatchers()
+{
+   return m_numWatchers;
+}
+
 inline
 int milkzmqServer::fpsTgt(const float & fps )
 {
@@ -452,6 +1355,14 @@ float milkzmqServer::fpsTgt()
    return m_fpsTgt;
 }
  
+inline
+float milkzmqServer::fpsAchieved( size_t n )
+{
+   if(n >= m_imageThreads.size()) return 0;
+   
+   return m_imageThreads[n].m_stream->m_fpsAchieved.load(std::memory_order_relaxed);
+}
+
 inline
 int milkzmqServer::fpsGain(const float & gain )
 {
@@ -519,134 +1430,2087 @@ int milkzmqServer::xrifCompressMethod()
 {
    return m_xrifCompressMethod;
 }
-   
+
 inline
-void milkzmqServer::internal_serverThreadStart( milkzmqServer * mzs )
+int milkzmqServer::adaptiveCodec( const bool & ac )
 {
-   mzs->serverThreadExec();
+   m_adaptiveCodec = ac;
+   return 0;
 }
 
 inline
-int milkzmqServer::serverThreadStart()
+bool milkzmqServer::adaptiveCodec()
 {
-   try
-   {
-      m_serverThread = std::thread( internal_serverThreadStart, this);
-   }
-   catch( const std::exception & e )
-   {
-      reportError(std::string("exception in server thread startup: ") +e.what(), __FILE__, __LINE__);
-      return -1;
-   }
-   catch( ... )
-   {
-      reportError("unknown exception in server thread startup", __FILE__, __LINE__);
-      return -1;
-   }
-   
-   if(!m_serverThread.joinable())
-   {
-      reportError("server thread did not start", __FILE__, __LINE__);
-      return -1;
-   }
-   
-   return 0;
+   return m_adaptiveCodec;
 }
 
 inline
-void milkzmqServer::serverThreadExec()
-{   
-   std::string srvstr = "tcp://*:" + std::to_string(m_imagePort);
-   
-   reportInfo("Beginning service at " + srvstr);
-   
-   //Should be nullptr, but in case this gets called twice.
-   if(m_server)
-   {
-      m_server->close();
-      delete m_server;
-      m_server = nullptr;
-   }
-      
-   m_server = new zmq::socket_t(*m_ZMQ_context, ZMQ_SERVER);
-     
-   m_server->bind(srvstr);
+int milkzmqServer::codecLinkRate( const float & lr )
+{
+   if(lr <= 0) return -1;
    
-   char reqShmim[1024];
-  
-   std::cerr << "here we go\n";
- 
-   while(!m_timeToDie) //loop on timeToDie in case this gets interrupted by SIGSEGV/SIGBUS
-   {
-      zmq::message_t request;
+   m_codecLinkRate = lr;
+   return 0;
+}
 
-      try
-      {
-         //Wait for next request from a client
-         #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
-         static_cast<void>(m_server->recv (request)); // method has nodiscard attribute.
-         #else
-         m_server->recv(&request);
-         #endif
-      }
-      catch(...)
-      {
-         if(m_timeToDie) break; //If an exception is thrown we check for timeToDie
-         throw;
-      }
-      
-      uint32_t routing_id = request.routing_id();
-      
-      size_t sz = sizeof(reqShmim);
-      if(request.size() +1 < sz) sz = request.size()+1;
-      snprintf(reqShmim, sz, "%s", (char*)request.data());
-      
-      //Scope for map mutex
-      {
-         std::lock_guard<std::mutex> guard(m_mapMutex);
-      
-         //All we do is set the received flag to true for this client and shmim, which tells the image thread to go ahead and send next time.
-         m_requestorMap[routing_id][reqShmim] = true;
-      }
-   }
-            
-   
-} // milkzmqServer::serverThreadExec()
+inline
+float milkzmqServer::codecLinkRate()
+{
+   return m_codecLinkRate;
+}
 
 inline
-int milkzmqServer::serverThreadKill()
+int milkzmqServer::codecTrialInterval( const float & ti )
 {
-   pthread_kill(m_serverThread.native_handle(), SIGQUIT);
+   m_codecTrialInterval = ti;
    return 0;
 }
 
 inline
-void milkzmqServer::internal_imageThreadStart( s_imageThread * mit )
+float milkzmqServer::codecTrialInterval()
 {
-   mit->m_mzs->imageThreadExec(mit->m_imageName);
+   return m_codecTrialInterval;
 }
 
 inline
-int milkzmqServer::imageThreadStart(size_t thno)
+int milkzmqServer::codecDrift( const float & cd )
 {
+   m_codecDrift = cd;
+   return 0;
+}
+
+inline
+float milkzmqServer::codecDrift()
+{
+   return m_codecDrift;
+}
+
+inline
+int milkzmqServer::keyframeInterval( const uint32_t & ki )
+{
+   m_keyframeInterval = ki;
+   return 0;
+}
+
+inline
+uint32_t milkzmqServer::keyframeInterval()
+{
+   return m_keyframeInterval;
+}
+
+inline
+int milkzmqServer::batchFrames( const uint32_t & bf )
+{
+   if(bf < 1 || bf > maxBatchFrames) return -1;
+   
+   m_batchFrames = bf;
+   return 0;
+}
+
+inline
+uint32_t milkzmqServer::batchFrames()
+{
+   return m_batchFrames;
+}
+
+inline
+int milkzmqServer::numSockets( const int & ns )
+{
+   if(ns < 1) return -1;
+   
+   m_numSockets = ns;
+   return 0;
+}
+
+inline
+int milkzmqServer::numSockets()
+{
+   return m_numSockets;
+}
+
+inline
+int milkzmqServer::socketRule( const std::string & glob,
+                               const int & sock
+                             )
+{
+   if(sock < 0 || sock >= m_numSockets) return -1;
+   
+   m_socketRules.push_back({glob, sock});
+   return 0;
+}
+
+inline
+int milkzmqServer::ioThreads( const int & it )
+{
+   if(it < 1) return -1;
+   
+   m_ioThreads = it;
+   return 0;
+}
+
+inline
+int milkzmqServer::ioThreads()
+{
+   return m_ioThreads;
+}
+
+inline
+int milkzmqServer::radioEndpoint( const std::string & ep )
+{
+   m_radioEndpoint = ep;
+   return 0;
+}
+
+inline
+std::string milkzmqServer::radioEndpoint()
+{
+   return m_radioEndpoint;
+}
+
+inline
+int milkzmqServer::radioFragment( const size_t & rf )
+{
+   if(rf <= radioHeaderSize || rf > radioMaxDatagram) return -1;
+   
+   m_radioFragment = rf;
+   return 0;
+}
+
+inline
+size_t milkzmqServer::radioFragment()
+{
+   return m_radioFragment;
+}
+   
+inline
+milkzmqServer::s_stream * milkzmqServer::stream( const std::string & name )
+{
+   std::lock_guard<std::mutex> guard(m_streamMutex);
+   
+   auto it = m_streamIds.find(name);
+   if(it != m_streamIds.end()) return m_streams[it->second];
+   
+   s_stream * st = new s_stream;
+   st->m_id = m_streams.size();
+   st->m_name = name;
+   
+   for(size_t n = 0; n < m_socketRules.size(); ++n)
+   {
+      if(fnmatch(m_socketRules[n].first.c_str(), name.c_str(), 0) == 0)
+      {
+         st->m_socket = m_socketRules[n].second;
+         break;
+      }
+   }
+   
+   m_streams.push_back(st);
+   m_streamIds[name] = st->m_id;
+   
+   return st;
+}
+
+inline
+void milkzmqServer::pushReady( s_stream * st,
+                               s_subscription * sub
+                             )
+{
+   s_subscription * head = st->m_readyList.load(std::memory_order_relaxed);
+   do
+   {
+      sub->m_next = head;
+   } while(!st->m_readyList.compare_exchange_weak(head, sub, std::memory_order_release, std::memory_order_relaxed));
+}
+
+inline
+void milkzmqServer::takeReady( std::vector<s_subscription *> & subs,
+                               s_stream * st
+                             )
+{
+   //Take the whole list at once, so there is no ABA problem with the concurrent pushes.
+   s_subscription * sub = st->m_readyList.exchange(nullptr, std::memory_order_acquire);
+   
+   while(sub != nullptr)
+   {
+      subs.push_back(sub);
+      sub = sub->m_next;
+   }
+}
+
+inline
+void milkzmqServer::internal_serverThreadStart( milkzmqServer * mzs,
+                                                size_t sock
+                                              )
+{
+   mzs->serverThreadExec(sock);
+}
+
+inline
+int milkzmqServer::serverThreadStart()
+{
+   if(m_servers.size() > 0)
+   {
+      reportError("server threads already started", __FILE__, __LINE__);
+      return -1;
+   }
+   
+   //The I/O threads are created with the first socket, so this must come first.
+   if(zmq_ctx_set((void *) *m_ZMQ_context, ZMQ_IO_THREADS, m_ioThreads) != 0)
+   {
+      reportError(std::string("error setting I/O threads: ") + zmq_strerror(zmq_errno()), __FILE__, __LINE__);
+      return -1;
+   }
+   
+   for(int n = 0; n < m_numSockets; ++n)
+   {
+      std::string srvstr = endpoint(n);
+      
+      try
+      {
+         m_servers.push_back(new zmq::socket_t(*m_ZMQ_context, ZMQ_SERVER));
+         m_servers.back()->bind(srvstr);
+      }
+      catch( const std::exception & e )
+      {
+         reportError("exception binding " + srvstr + ": " + e.what(), __FILE__, __LINE__);
+         return -1;
+      }
+      
+      reportInfo("Beginning service at " + srvstr);
+   }
+   
+   if(m_radioEndpoint != "")
+   {
+      try
+      {
+         m_radio = new zmq::socket_t(*m_ZMQ_context, ZMQ_RADIO);
+         
+         //A frame is many datagrams, all sent at once, so the default high water mark would drop most of a large one.
+         //Frames are limited to the F.P.S. target, so this can not grow without bound.
+         #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 7, 0))
+         m_radio->set(zmq::sockopt::sndhwm, 0);
+         #else
+         m_radio->setsockopt(ZMQ_SNDHWM, 0);
+         #endif
+         
+         m_radio->connect(m_radioEndpoint);
+      }
+      catch( const std::exception & e )
+      {
+         reportError("exception connecting RADIO to " + m_radioEndpoint + ": " + e.what(), __FILE__, __LINE__);
+         return -1;
+      }
+      
+      m_radioSession = get_mono_nsec() | 1; //never 0, which DISH clients start with
+      
+      reportInfo("Sending all frames to " + m_radioEndpoint);
+   }
+   
+   m_serving = true;
+   
+   for(size_t n = 0; n < m_servers.size(); ++n)
+   {
+      try
+      {
+         m_serverThreads.push_back(std::thread( internal_serverThreadStart, this, n));
+      }
+      catch( const std::exception & e )
+      {
+         reportError(std::string("exception in server thread startup: ") +e.what(), __FILE__, __LINE__);
+         return -1;
+      }
+      catch( ... )
+      {
+         reportError("unknown exception in server thread startup", __FILE__, __LINE__);
+         return -1;
+      }
+      
+      if(!m_serverThreads.back().joinable())
+      {
+         reportError("server thread did not start", __FILE__, __LINE__);
+         return -1;
+      }
+   }
+   
+   return 0;
+}
+
+inline
+void milkzmqServer::serverThreadExec( size_t sock )
+{   
+   zmq::socket_t * server = m_servers[sock];
+   
+   char reqShmim[1024];
+  
+   std::cerr << "here we go\n";
+ 
+   while(!m_timeToDie) //loop on timeToDie in case this gets interrupted by SIGSEGV/SIGBUS
+   {
+      zmq::message_t request;
+
+      try
+      {
+         //Wait for next request from a client
+         #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+         static_cast<void>(server->recv (request)); // method has nodiscard attribute.
+         #else
+         server->recv(&request);
+         #endif
+      }
+      catch(...)
+      {
+         if(m_timeToDie) break; //If an exception is thrown we check for timeToDie
+         throw;
+      }
+      
+      uint32_t routing_id = request.routing_id();
+      
+      size_t sz = sizeof(reqShmim);
+      if(request.size() +1 < sz) sz = request.size()+1;
+      snprintf(reqShmim, sz, "%s", (char*)request.data());
+      
+      //Older clients send just the name.
+      float reqFps = 0;
+      uint8_t reqFlags = 0;
+      uint32_t reqRoi[4] = {0,0,0,0};
+      uint8_t reqBin = 1;
+      uint8_t reqConvert = convertNone;
+      uint16_t reqCredit = 1;
+      uint16_t reqWindow = 1;
+      if(request.size() >= requestSize)
+      {
+         reqFps = *((float *) ((char *) request.data() + reqFpsOffset));
+         reqFlags = *((uint8_t *) request.data() + reqFlagsOffset);
+         memcpy(reqRoi, (char *) request.data() + reqRoiOffset, sizeof(reqRoi));
+         reqBin = *((uint8_t *) request.data() + reqBinOffset);
+         reqConvert = *((uint8_t *) request.data() + reqConvertOffset);
+         memcpy(&reqCredit, (char *) request.data() + reqCreditOffset, sizeof(uint16_t));
+         memcpy(&reqWindow, (char *) request.data() + reqWindowOffset, sizeof(uint16_t));
+         if(reqCredit == 0) reqCredit = 1;
+         if(reqWindow == 0) reqWindow = 1;
+      }
+      
+      s_stream * st = stream(reqShmim);
+      
+      //A stream is only served on its own socket, so its subscriptions are only touched by one server thread.
+      if(st->m_socket != sock)
+      {
+         sendRedirect(server, routing_id, st);
+         continue;
+      }
+      
+      st->m_lastRequest.store(get_mono_nsec(), std::memory_order_relaxed);
+      
+      s_subscription * sub;
+      bool isNew = false;
+      auto it = st->m_subscriptions.find(routing_id);
+      if(it == st->m_subscriptions.end())
+      {
+         //Clean up after clients which have gone away.  The image thread only clears the ready flag of a dead subscription
+         //after it has dropped it from its list, so once dead and not ready, the image thread is done with it.
+         for(auto dit = st->m_subscriptions.begin(); dit != st->m_subscriptions.end();)
+         {
+            if(dit->second->m_dead.load(std::memory_order_acquire) && !dit->second->m_ready.load(std::memory_order_acquire))
+            {
+               delete dit->second;
+               dit = st->m_subscriptions.erase(dit);
+            }
+            else ++dit;
+         }
+         
+         sub = new s_subscription;
+         sub->m_routingId = routing_id;
+         st->m_subscriptions[routing_id] = sub;
+         isNew = true;
+      }
+      else sub = it->second;
+      
+      //A client which asks again is still there, even if a send to it failed.
+      sub->m_dead.store(false, std::memory_order_relaxed);
+      
+      sub->m_fpsReq.store(reqFps, std::memory_order_relaxed);
+      sub->m_wantsDelta.store(reqFlags & reqFlagDelta, std::memory_order_relaxed);
+      if(reqFlags & reqFlagKeyframe) sub->m_needKey.store(true, std::memory_order_relaxed);
+      sub->m_wantsBurst.store(reqFlags & reqFlagBurst, std::memory_order_relaxed);
+      sub->m_roiX0.store(reqRoi[0], std::memory_order_relaxed);
+      sub->m_roiY0.store(reqRoi[1], std::memory_order_relaxed);
+      sub->m_roiWidth.store(reqRoi[2], std::memory_order_relaxed);
+      sub->m_roiHeight.store(reqRoi[3], std::memory_order_relaxed);
+      sub->m_bin.store(reqBin, std::memory_order_relaxed);
+      sub->m_binMean.store(reqFlags & reqFlagBinMean, std::memory_order_relaxed);
+      sub->m_convert.store(reqConvert, std::memory_order_relaxed);
+      
+      //A new subscriber to the full frame gets the newest keyframe at once, rather than waiting for the next frame.
+      bool cached = false;
+      if(isNew && (reqRoi[2] == 0 || reqRoi[3] == 0) && reqBin <= 1 && reqConvert == convertNone) cached = sendCached(st, sub);
+      
+      //Add the credits, but never hold more than the client's window, so the re-sends of a client which timed out do not pile up.
+      //The cached frame uses one, as any frame sent does.
+      int32_t used = cached ? 1 : 0;
+      int32_t credit = sub->m_credit.load(std::memory_order_acquire);
+      while(!sub->m_credit.compare_exchange_weak(credit, std::min<int32_t>(std::max<int32_t>(credit, 0) + reqCredit, reqWindow) - used, std::memory_order_acq_rel));
+      
+      //If the cached frame used the last credit, the request the client sends on getting it makes it ready.
+      if(cached && sub->m_credit.load(std::memory_order_acquire) <= 0) continue;
+      
+      //All we do is set the ready flag to true for this client and shmim, which tells the image thread to go ahead and send next time.
+      //Only the request which changes the flag adds it to the list, so it is on the list at most once.
+      if(!sub->m_ready.exchange(true, std::memory_order_acq_rel)) pushReady(st, sub);
+   }
+            
+   
+} // milkzmqServer::serverThreadExec()
+
+inline
+int milkzmqServer::serverThreadKill()
+{
+   for(size_t n = 0; n < m_serverThreads.size(); ++n) pthread_kill(m_serverThreads[n].native_handle(), SIGQUIT);
+   return 0;
+}
+
+inline
+void milkzmqServer::sendRedirect( zmq::socket_t * server,
+                                  routing_id_t routingId,
+                                  s_stream * st
+                                )
+{
+   std::string ep = endpoint(st->m_socket);
+   
+   zmq::message_t frame(headerSize + ep.size());
+   char * header = (char *) frame.data();
+   memset(header, 0, headerSize);
+   
+   snprintf(header, nameSize, "%s", st->m_name.c_str());
+   *((uint8_t *) (header + frameFlagsOffset)) = frameFlagRedirect;
+   *((uint32_t *) (header + redirectPortOffset)) = (ep.compare(0, 6, "tcp://") == 0) ? atoi(ep.c_str() + ep.rfind(':') + 1) : 0;
+   memcpy(header + headerSize, ep.data(), ep.size());
+   
+   frame.set_routing_id(routingId);
+   
+   try
+   {
+      #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+      server->send(frame, zmq::send_flags::dontwait);
+      #else
+      server->send(frame, ZMQ_DONTWAIT);
+      #endif
+   }
+   catch(...)
+   {
+      //The client has gone away, and will be redirected when it asks again.
+   }
+}
+
+inline
+void milkzmqServer::internal_imageThreadStart( s_imageThread * mit )
+{
+   mit->m_mzs->imageThreadExec(mit->m_imageName);
+}
+
+inline
+int milkzmqServer::imageThreadStart(size_t thno)
+{
+   if(m_numWatchers > 0)
+   {
+      if(watcherThreadsStart() < 0) return -1;
+      
+      s_watcherThread * wt = m_watcherThreads[thno % m_watcherThreads.size()];
+      
+      std::lock_guard<std::mutex> guard(wt->m_mutex);
+      wt->m_newStreams.push_back(m_imageThreads[thno].m_imageName);
+      
+      return 0;
+   }
+   
+   try
+   {
+      *m_imageThreads[thno].m_thread = std::thread( internal_imageThreadStart, &m_imageThreads[thno]);
+   }
+   catch( const std::exception & e )
+   {
+      reportError(std::string("exception in image thread startup: ") +e.what(), __FILE__, __LINE__);
+      return -1;
+   }
+   catch( ... )
+   {
+      reportError("unknown exception in image thread startup", __FILE__, __LINE__);
+      return -1;
+   }
+   
+   if(!m_imageThreads[thno].m_thread->joinable())
+   {
+      reportError("image thread did not start", __FILE__, __LINE__);
+      return -1;
+   }
+   
+   return 0;
+}
+
+inline
+int milkzmqServer::imageThreadKill(size_t thno)
+{
+   if(m_numWatchers > 0) return 0; //Watchers exit on m_timeToDie.
+   
+   pthread_kill(m_imageThreads[thno].m_thread->native_handle(), SIGQUIT);
+   return 0;
+}
+
+
+
+inline
+int milkzmqServer::publisherInit( s_imagePublisher & pub,
+                                  const std::string & imageName
+                                )
+{
+   pub.m_imageName = imageName;
+   pub.m_stream = stream(imageName);
+   pub.m_radioId = radioStreamId(imageName);
+   
+   ImageStreamIO_filename(pub.m_fname, sizeof(pub.m_fname), imageName.c_str());
+   
+   //Frames are encoded into buffers from this pool, which are recycled once zmq has sent them to every client.
+   pub.m_pool = std::make_shared<msgBufferPool>();
+   
+   pub.m_burstPool = std::make_shared<msgBufferPool>();
+   pub.m_burstPool->maxFree(2);
+   
+   pub.m_batchPool = std::make_shared<msgBufferPool>();
+   
+   if(xrif_new(&pub.m_xrif) != XRIF_NOERROR)
+   {
+      reportError("error allocating xrif handle for " + imageName, __FILE__, __LINE__);
+      pub.m_xrif = nullptr;
+      return -1;
+   }
+   
+   return 0;
+}
+
+inline
+int milkzmqServer::publisherOpen( s_imagePublisher & pub )
+{
+   pub.m_opened = false;
+   
+   //Taken before opening, so a restart requested while we open is not missed.
+   pub.m_restartCount = m_restartCount.load(std::memory_order_relaxed);
+   
+   //b/c ImageStreamIO prints every single time, and latest version don't support stopping it yet, and that isn't thread-safe-able anyway
+   //we do our own checks.  This is the same code in ImageStreamIO_openIm...
+   int SM_fd = open(pub.m_fname, O_RDWR);
+   if(SM_fd == -1)
+   {
+      if(!pub.m_printed) reportWarning("ImageStream " + pub.m_imageName + " not found (yet).  Retrying . . .");
+      pub.m_printed = true;
+      return -1;
+   }
+   
+   //Found and opened,  close it and then use ImageStreamIO
+   pub.m_printed = false;
+   close(SM_fd);
+   
+   if( ImageStreamIO_openIm(&pub.m_image, pub.m_imageName.c_str()) != 0) return -1;
+   
+   if(pub.m_image.md[0].sem <= 0) 
+   {
+      ImageStreamIO_closeIm(&pub.m_image); //We just need to wait for the server process to finish startup.
+      return -1;
+   }
+   
+   struct stat statbuff;
+   if(stat(pub.m_fname, &statbuff) != 0)
+   {
+      reportError("Error stat-ing ImageStream " + pub.m_imageName, __FILE__, __LINE__);   
+      ImageStreamIO_closeIm(&pub.m_image);
+      return -1;
+   }
+   pub.m_inode = statbuff.st_ino;
+   
+   pub.m_opened = true;
+   
+   reportNotice("Connected to ImageStream " + pub.m_imageName);
+   
+   //---- Claim a semaphore if we are waiting on them
+   pub.m_semIndex = -1;
+   if(pub.m_useSem)
+   {
+      pub.m_semIndex = ImageStreamIO_getsemwaitindex(&pub.m_image, pub.m_image.md[0].sem - 1);
+      if(pub.m_semIndex < 0)
+      {
+         reportWarning("No semaphore available for " + pub.m_imageName + ".  Polling instead.");
+      }
+      else
+      {
+         ImageStreamIO_semflush(&pub.m_image, pub.m_semIndex);
+      }
+   }
+   
+   pub.m_typeSize = ImageStreamIO_typesize(pub.m_image.md[0].datatype);
+   pub.m_atype = pub.m_image.md[0].datatype;
+   pub.m_snx = pub.m_image.md[0].size[0];
+   pub.m_sny = pub.m_image.md[0].size[1];
+   pub.m_snz = pub.m_image.md[0].size[2];
+   
+   //---- Set up the codecs, and size the message buffers for them
+   publisherCodecs(pub);
+   publisherCodec(pub, 0);
+   publisherBatchSetup(pub);
+   
+   pub.m_sched.fpsTgt(m_fpsTgt);
+   pub.m_lastLiveCheck = get_mono_nsec();
+   
+   pub.m_lastCnt0 = -1; //Force treating first image as new image
+   
+   //Any frame from before the re-open is stale.
+   if(pub.m_lastBuf) msgBufferPool::release(pub.m_lastBuf);
+   pub.m_lastBuf = nullptr;
+   pub.m_haveFrame = false;
+   ++pub.m_seq;
+   publisherCache(pub);
+   
+   publisherDropRefs(pub);
+   pub.m_refs.reserve(maxRefFrames);
+   
+   if(pub.m_burstBuf) msgBufferPool::release(pub.m_burstBuf);
+   pub.m_burstBuf = nullptr;
+   
+   publisherDropProducts(pub); //the shape may have changed
+   
+   return 0;
+}
+
+inline
+void milkzmqServer::publisherCodecs( s_imagePublisher & pub )
+{
+   pub.m_codecs.clear();
+   
+   bool xrifType = (pub.m_atype == XRIF_TYPECODE_INT16 || pub.m_atype == XRIF_TYPECODE_UINT16);
+   
+   s_codec none; //all NONE
+   
+   s_codec shuffle;
+   shuffle.m_reorderMethod = reorderByteShuffle;
+   shuffle.m_compressMethod = XRIF_COMPRESS_LZ4;
+   
+   if(m_adaptiveCodec)
+   {
+      pub.m_codecs.push_back(none);
+      
+      if(xrifType)
+      {
+         int reorders[] = {XRIF_REORDER_BYTEPACK, XRIF_REORDER_BYTEPACK_RENIBBLE, XRIF_REORDER_BITPACK};
+         for(int reorder : reorders)
+         {
+            s_codec c;
+            c.m_differenceMethod = XRIF_DIFFERENCE_PIXEL;
+            c.m_reorderMethod = reorder;
+            c.m_compressMethod = XRIF_COMPRESS_LZ4;
+            pub.m_codecs.push_back(c);
+         }
+         
+         s_codec fast = pub.m_codecs.back(); 
+         fast.m_reorderMethod = XRIF_REORDER_BYTEPACK_RENIBBLE;
+         fast.m_lz4Accel = 10;
+         pub.m_codecs.push_back(fast);
+      }
+      else
+      {
+         pub.m_codecs.push_back(shuffle);
+         
+         shuffle.m_lz4Accel = 10;
+         pub.m_codecs.push_back(shuffle);
+      }
+   }
+   else if(xrifType)
+   {
+      s_codec c;
+      c.m_differenceMethod = m_xrifDifferenceMethod;
+      c.m_reorderMethod = m_xrifReorderMethod;
+      c.m_compressMethod = m_xrifCompressMethod;
+      pub.m_codecs.push_back(c);
+   }
+   else if(m_xrifCompressMethod != XRIF_COMPRESS_NONE)
+   {
+      //Not compressable by xrif, so we byte-shuffle and LZ4 instead
+      pub.m_codecs.push_back(shuffle);
+   }
+   else pub.m_codecs.push_back(none);
+   
+   //---- Size the message buffers for the largest any codec needs.
+   //Buffers of the old size still held by zmq are freed when it releases them.
+   size_t nbytes = ((size_t) pub.m_snx)*pub.m_sny*pub.m_typeSize;
+   
+   pub.m_msgSz = headerSize + nbytes;
+   pub.m_scratch.clear();
+   
+   for(size_t n = 0; n < pub.m_codecs.size(); ++n)
+   {
+      if(pub.m_codecs[n].m_reorderMethod == reorderByteShuffle)
+      {
+         pub.m_msgSz = std::max(pub.m_msgSz, headerSize + shuffleCompressBound(nbytes));
+         pub.m_scratch.resize(nbytes);
+      }
+      else
+      {
+         xrif_set_size(pub.m_xrif, pub.m_snx, pub.m_sny, 1, 1, pub.m_atype);
+         xrif_configure(pub.m_xrif, pub.m_codecs[n].m_differenceMethod, pub.m_codecs[n].m_reorderMethod, pub.m_codecs[n].m_compressMethod);
+         pub.m_msgSz = std::max(pub.m_msgSz, headerSize + xrif_min_raw_size(pub.m_xrif)); //This is maximum message size.
+      }
+   }
+   
+   pub.m_pool->bufferSize(pub.m_msgSz);
+   
+   //A burst holds every slice, each with its own header.  Only allocated when a client asks for one.
+   pub.m_burstPool->bufferSize(headerSize + ((size_t) pub.m_snz)*(burstSliceHeaderSize + pub.m_msgSz - headerSize));
+   
+   if(pub.m_codecs.size() > 1) pub.m_trialBuf.resize(pub.m_msgSz - headerSize);
+   else pub.m_trialBuf.clear();
+   
+   pub.m_lastTrial = 0;
+   pub.m_trialRatio = 1;
+   pub.m_ratio = 1;
+}
+
+inline
+void milkzmqServer::publisherCodec( s_imagePublisher & pub,
+                                    size_t n
+                                  )
+{
+   const s_codec & c = pub.m_codecs[n];
+   
+   pub.m_codec = n;
+   pub.m_shuffle = (c.m_reorderMethod == reorderByteShuffle);
+   pub.m_lz4Accel = c.m_lz4Accel;
+   
+   if(pub.m_shuffle) return;
+   
+   //---- Set up and allocate xrif
+   //The raw buffer is set to a pool buffer for each frame.
+   xrif_t xrif = pub.m_xrif;
+   xrif_set_size(xrif, pub.m_snx, pub.m_sny, 1, 1, pub.m_atype);
+   xrif_configure(xrif, c.m_differenceMethod, c.m_reorderMethod, c.m_compressMethod);
+   xrif_set_lz4_acceleration(xrif, c.m_lz4Accel);
+   xrif_allocate_reordered(xrif);
+}
+
+inline
+void milkzmqServer::publisherTrial( s_imagePublisher & pub,
+                                    const char * src,
+                                    int64_t now
+                                  )
+{
+   size_t nbytes = ((size_t) pub.m_snx)*pub.m_sny*pub.m_typeSize;
+   
+   size_t prev = pub.m_codec;
+   size_t best = prev;
+   double bestCost = std::numeric_limits<double>::max();
+   size_t bestSize = nbytes;
+   int64_t bestTime = 0;
+   
+   int16_t dm, rm, cm;
+   for(size_t n = 0; n < pub.m_codecs.size(); ++n)
+   {
+      publisherCodec(pub, n);
+      
+      //Take the faster of two, so the first trial does not pay for cold caches.
+      size_t sz = 0;
+      int64_t dt = std::numeric_limits<int64_t>::max();
+      for(int r = 0; r < 2; ++r)
+      {
+         int64_t t0 = get_mono_nsec();
+         sz = publisherCompress(pub, pub.m_trialBuf.data(), src, dm, rm, cm);
+         dt = std::min(dt, get_mono_nsec() - t0);
+      }
+      
+      //Cost is encode time plus time on the wire, in seconds.
+      double cost = dt/1e9 + sz/(1e6*m_codecLinkRate);
+      
+      if(cost < bestCost)
+      {
+         bestCost = cost;
+         best = n;
+         bestSize = sz;
+         bestTime = dt;
+      }
+   }
+   
+   publisherCodec(pub, best);
+   
+   pub.m_trialRatio = ((double) bestSize)/nbytes;
+   pub.m_ratio = pub.m_trialRatio;
+   
+   if(best != prev || pub.m_lastTrial == 0)
+   {
+      const s_codec & c = pub.m_codecs[best];
+      
+      std::string cname;
+      if(c.m_reorderMethod == reorderByteShuffle) cname = "byte-shuffle";
+      else cname = "xrif difference " + std::to_string(c.m_differenceMethod) + " reorder " + std::to_string(c.m_reorderMethod);
+      
+      if(c.m_compressMethod == XRIF_COMPRESS_NONE) cname += " no compression";
+      else cname += " lz4 acceleration " + std::to_string(c.m_lz4Accel);
+      
+      reportNotice(pub.m_imageName + " codec: " + cname + " ratio " + std::to_string(pub.m_trialRatio*100) + "% encode " + std::to_string(bestTime/1000) + " usec");
+   }
+   
+   pub.m_lastTrial = now;
+}
+
+inline
+size_t milkzmqServer::publisherCompress( s_imagePublisher & pub,
+                                         char * dest,
+                                         const char * src,
+                                         int16_t & differenceMethod,
+                                         int16_t & reorderMethod,
+                                         int16_t & compressMethod
+                                       )
+{
+   size_t nel = ((size_t) pub.m_snx)*pub.m_sny;
+   
+   if(pub.m_shuffle)
+   {
+      //Byte-shuffle and LZ4 straight from the stream into the message buffer.
+      bool compressed;
+      size_t sz = shuffleCompress( dest, compressed, src, pub.m_scratch.data(), nel, pub.m_typeSize, pub.m_lz4Accel);
+      
+      differenceMethod = XRIF_DIFFERENCE_NONE;
+      reorderMethod = reorderByteShuffle;
+      compressMethod = compressed ? XRIF_COMPRESS_LZ4 : XRIF_COMPRESS_NONE;
+      
+      return sz;
+   }
+   
+   //XRIF Encoding...
+   //Because of xrif->compress_on_raw == true, xrif->raw_buffer = dest, this results in the encoded message being written to the message buffer.
+   xrif_t xrif = pub.m_xrif;
+   xrif_set_raw(xrif, dest, pub.m_msgSz - headerSize);
+   memcpy(xrif->raw_buffer, src, nel*pub.m_typeSize);
+   xrif_encode(xrif);
+   
+   //std::cerr << imageName << " XRIF: " << xrif->compression_ratio*100. << "%\n";
+
+   differenceMethod = xrif->difference_method;
+   reorderMethod = xrif->reorder_method;
+   compressMethod = xrif->compress_method;
+   
+   return xrif->compressed_size;
+}
+
+inline
+bool milkzmqServer::subscriptionDue( s_subscription * sub,
+                                     int64_t now
+                                   )
+{
+   //The client's rate, but never faster than ours.
+   float fps = sub->m_fpsReq.load(std::memory_order_relaxed);
+   if(fps <= 0 || (m_fpsTgt > 0 && fps > m_fpsTgt)) fps = m_fpsTgt;
+   
+   if(sub->m_sched.fpsTgt() != fps) sub->m_sched.fpsTgt(fps);
+   
+   return sub->m_sched.due(now);
+}
+
+inline
+bool milkzmqServer::takeCredit( s_subscription * sub )
+{
+   if(sub->m_credit.fetch_sub(1, std::memory_order_acq_rel) > 1) return true;
+   
+   //That was the last.  Clear the flag before sending, so a request sent as soon as the client gets this frame is not lost.
+   sub->m_ready.store(false, std::memory_order_seq_cst);
+   
+   //A grant which came in before the flag was cleared did not push the subscription, since it was still ready.  So we keep it.
+   if(sub->m_credit.load(std::memory_order_seq_cst) > 0 && !sub->m_ready.exchange(true, std::memory_order_acq_rel)) return true;
+   
+   return false;
+}
+
+inline
+int milkzmqServer::publisherUpdate( s_imagePublisher & pub )
+{
+   //-------- Check to see if anyone is subscribing to this stream...
+   //m_subs keeps any we took but have not sent to, because they are not due yet or we broke out for a size change.
+   takeReady(pub.m_subs, pub.m_stream);
+   
+   //A client kept for its credit stays on m_subs after a send to it fails.  Drop it now, clearing its flag last, since
+   //once it is dead and not ready the server thread may delete it.
+   for(size_t n = 0; n < pub.m_subs.size(); )
+   {
+      s_subscription * sub = pub.m_subs[n];
+      
+      if(!sub->m_dead.load(std::memory_order_acquire))
+      {
+         ++n;
+         continue;
+      }
+      
+      pub.m_subs[n] = pub.m_subs.back();
+      pub.m_subs.pop_back();
+      
+      sub->m_credit.store(0, std::memory_order_relaxed);
+      sub->m_ready.store(false, std::memory_order_release);
+   }
+   
+   //New subscribers sent the cached frame by the server thread already have it.
+   for(size_t n = 0; n < pub.m_subs.size(); ++n)
+   {
+      if(pub.m_subs[n]->m_lastSeq == 0) pub.m_subs[n]->m_lastSeq = pub.m_subs[n]->m_cachedSeq.load(std::memory_order_acquire);
+   }
+   
+   //-------- Batches collect every frame, whether or not anyone is ready for the next message.
+   bool batching = (m_batchFrames > 1 && pub.m_snz == 0);
+   
+   if(batching)
+   {
+      if(publisherBatch(pub) < 0) return -1;
+   }
+   
+   //-------- The RADIO socket gets every frame at our rate, whether or not anyone has asked.
+   int radio = 0;
+   if(m_radio)
+   {
+      radio = publisherRadio(pub);
+      if(radio < 0) return -1;
+   }
+   
+   if(pub.m_subs.size() == 0) //No subscribers, so nothing to do until one asks, or the RADIO socket is due.
+   {
+      if(radio == 1)
+      {
+         pub.m_nextDue = pub.m_radioSched.next();
+         return 1;
+      }
+      return 0;
+   }
+   
+   bool newFrame = !batching && (pub.m_image.md[0].cnt0 != pub.m_lastCnt0);
+   
+   //Is anyone waiting on a frame they have not had yet?
+   bool waiting = newFrame;
+   for(size_t n = 0; n < pub.m_subs.size() && !waiting && pub.m_haveFrame; ++n)
+   {
+      if(pub.m_subs[n]->m_lastSeq != pub.m_seq) waiting = true;
+   }
+   
+   if(!waiting) return 0;
+   
+   //-------- Wait for the deadline.  We send whatever frame is newest when it arrives.
+   //Clients at lower rates are sent to on the first of our deadlines after theirs, so they share the encoding.
+   if(pub.m_sched.fpsTgt() != m_fpsTgt) pub.m_sched.fpsTgt(m_fpsTgt);
+   
+   int64_t now = get_mono_nsec();
+   
+   pub.m_nextDue = pub.m_sched.next();
+   if( !pub.m_sched.due(now) ) return batching ? 0 : 1; //When batching, wait for the next frame rather than the deadline so none are missed.
+   
+   int64_t subNext = std::numeric_limits<int64_t>::max();
+   bool anyDue = false;
+   for(size_t n = 0; n < pub.m_subs.size(); ++n)
+   {
+      if(subscriptionDue(pub.m_subs[n], now)) anyDue = true;
+      else subNext = std::min(subNext, pub.m_subs[n]->m_sched.next());
+   }
+   
+   if(!anyDue)
+   {
+      pub.m_nextDue = subNext;
+      return batching ? 0 : 1;
+   }
+   
+   if(m_timeToDie || m_restartCount.load(std::memory_order_relaxed) != pub.m_restartCount) return -1; //Check for exit signals
+
+   if(newFrame)
+   {
+      if(publisherEncode(pub) < 0) return -1;
+   }
+   
+   //-------- Send the newest frame to everyone who is due and does not have it yet.
+   for(size_t n = 0; n < pub.m_subs.size(); )
+   {
+      s_subscription * sub = pub.m_subs[n];
+      
+      if(sub->m_lastSeq == pub.m_seq || !sub->m_sched.due(now))
+      {
+         ++n;
+         continue;
+      }
+      
+      sub->m_sched.sent(now);
+      
+      //A client with credit left stays ready, so the next frame goes out without waiting for its request.
+      bool keep = takeCredit(sub);
+      
+      if(publisherSend(pub, sub) < 0) return -1;
+      
+      //If the send failed it is dead but still ready, so it is ours until we drop it on the next update.
+      if(keep)
+      {
+         ++n;
+         continue;
+      }
+      
+      pub.m_subs[n] = pub.m_subs.back();
+      pub.m_subs.pop_back();
+   }
+   
+   pub.m_sched.sent(now);
+   pub.m_stream->m_fpsAchieved.store(pub.m_sched.fpsAchieved(), std::memory_order_relaxed);
+   
+   //A frame encoded for the subscribers goes to the RADIO socket too.
+   if(m_radio)
+   {
+      if(publisherRadio(pub) < 0) return -1;
+   }
+   
+   return 2;
+}
+
+inline
+int milkzmqServer::publisherRadio( s_imagePublisher & pub )
+{
+   bool batching = (m_batchFrames > 1 && pub.m_snz == 0);
+   
+   int rv = 0;
+   
+   if(!batching && pub.m_image.md[0].cnt0 != pub.m_lastCnt0)
+   {
+      if(pub.m_radioSched.fpsTgt() != m_fpsTgt) pub.m_radioSched.fpsTgt(m_fpsTgt);
+      
+      int64_t now = get_mono_nsec();
+      
+      if(pub.m_radioSched.due(now))
+      {
+         if(publisherEncode(pub) < 0) return -1;
+         pub.m_radioSched.sent(now);
+      }
+      else rv = 1;
+   }
+   
+   if(!pub.m_haveFrame || pub.m_radioSeq == pub.m_seq) return rv;
+   
+   //Only keyframes, since we can not know what each DISH client has.
+   if(pub.m_lastBuf == nullptr)
+   {
+      if(publisherKeyframe(pub, pub.m_curRaw.data()) < 0) return -1;
+   }
+   
+   radioSend(pub, (char *) pub.m_lastBuf->m_data, pub.m_lastSize, pub.m_seq);
+   pub.m_radioSeq = pub.m_seq;
+   
+   return rv;
+}
+
+inline
+void milkzmqServer::radioSend( s_imagePublisher & pub,
+                               const char * data,
+                               size_t sz,
+                               uint64_t seq
+                             )
+{
+   std::string group = radioGroup(pub.m_imageName);
+   
+   uint32_t fragSize = m_radioFragment - radioHeaderSize;
+   uint32_t nfrags = (sz + fragSize - 1)/fragSize;
+   uint32_t size = sz;
+   
+   for(uint32_t n = 0; n < nfrags; ++n)
+   {
+      uint32_t offset = n*fragSize;
+      size_t len = std::min<size_t>(fragSize, sz - offset);
+      
+      zmq::message_t frag(radioHeaderSize + len);
+      char * d = (char *) frag.data();
+      
+      memcpy(d + radioStreamIdOffset, &pub.m_radioId, sizeof(uint32_t));
+      memcpy(d + radioSessionOffset, &m_radioSession, sizeof(uint32_t));
+      memcpy(d + radioSeqOffset, &seq, sizeof(uint64_t));
+      memcpy(d + radioSizeOffset, &size, sizeof(uint32_t));
+      memcpy(d + radioNfragsOffset, &nfrags, sizeof(uint32_t));
+      memcpy(d + radioIndexOffset, &n, sizeof(uint32_t));
+      memcpy(d + radioFragSizeOffset, &fragSize, sizeof(uint32_t));
+      memcpy(d + radioHeaderSize, data + offset, len);
+      
+      frag.set_group(group.c_str());
+      
+      try
+      {
+         #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+         m_radio->send(frag, zmq::send_flags::dontwait);
+         #else
+         m_radio->send(frag, ZMQ_DONTWAIT);
+         #endif
+      }
+      catch(...)
+      {
+         //The rest of the frame would be dropped by the clients anyway.
+         return;
+      }
+   }
+}
+
+inline
+int milkzmqServer::publisherEncode( s_imagePublisher & pub )
+{
+   IMAGE & image = pub.m_image;
+   
+   //-------- Get size and look for changes
+   uint8_t atype = image.md[0].datatype;
+   uint32_t snx = image.md[0].size[0];
+   uint32_t sny = image.md[0].size[1];
+   uint32_t snz = image.md[0].size[2];
+
+   if( atype != pub.m_atype || snx != pub.m_snx || sny != pub.m_sny || snz != pub.m_snz )
+   {
+      return -1; //get the new image setup.
+   }
+   
+   int curr_image;
+   if(image.md[0].size[2] > 0) ///\todo change to naxis?
+   {
+      curr_image = image.md[0].cnt1;
+      if(curr_image < 0) curr_image = image.md[0].size[2] - 1;
+   }
+   else curr_image = 0;
+
+   size_t nbytes = ((size_t) snx)*sny*pub.m_typeSize;
+   const char * src = (char *) image.array.SI8 + curr_image*nbytes;
+   
+   //-------- This is now the newest frame
+   pub.m_lastCnt0 = image.md[0].cnt0;
+   pub.m_frameCnt0 = image.md[0].cnt0;
+   pub.m_frameSlice = curr_image;
+   pub.m_frameTime = image.md[0].writetime;
+   ++pub.m_seq;
+   pub.m_haveFrame = true;
+   
+   if(pub.m_lastBuf) msgBufferPool::release(pub.m_lastBuf);
+   pub.m_lastBuf = nullptr;
+   
+   if(pub.m_burstBuf) msgBufferPool::release(pub.m_burstBuf);
+   pub.m_burstBuf = nullptr;
+   
+   //If anyone takes delta frames, we need a copy of exactly what we encode, to difference later frames against.
+   //Products are cut from it too, since the source may have written the next frame by the time we get to them.
+   bool wantsCopy = false;
+   s_productKey key;
+   for(size_t n = 0; n < pub.m_subs.size() && !wantsCopy; ++n)
+   {
+      if(pub.m_subs[n]->m_wantsDelta.load(std::memory_order_relaxed) || subscriptionProduct(pub, pub.m_subs[n], key)) wantsCopy = true;
+   }
+   
+   if(!wantsCopy) return publisherKeyframe(pub, src);
+   
+   //Keyframes and deltas are encoded from the copy when first needed.
+   pub.m_curRaw.resize(nbytes);
+   memcpy(pub.m_curRaw.data(), src, nbytes);
+   pub.m_curRawSeq = pub.m_seq;
+   
+   //If no one needs the keyframe the cache could get arbitrarily old, so we encode one now and then for new subscribers.
+   if(get_mono_nsec() - pub.m_cacheTime > cacheRefresh) return publisherKeyframe(pub, pub.m_curRaw.data());
+   
+   return 0;
+}
+
+inline
+int milkzmqServer::publisherKeyframe( s_imagePublisher & pub,
+                                      const char * src
+                                    )
+{
+   //-------- Get a fresh buffer, so we never overwrite a frame zmq is still sending.
+   msgBuffer * buf = pub.m_pool->acquire();
+   if(buf == nullptr)
+   {
+      reportError("could not allocate message buffer for " + pub.m_imageName, __FILE__, __LINE__);
+      return -1;
+   }
+   
+   //-------- Choose the codec, if it is time to
+   if(pub.m_codecs.size() > 1)
+   {
+      int64_t now = get_mono_nsec();
+      
+      if( pub.m_lastTrial == 0 || now - pub.m_lastTrial > 1e9*m_codecTrialInterval ||
+            (fabs(pub.m_ratio - pub.m_trialRatio) > m_codecDrift*pub.m_trialRatio && now - pub.m_lastTrial > 1000000000LL) )
+      {
+         publisherTrial(pub, src, now);
+      }
+   }
+   
+   int16_t differenceMethod, reorderMethod, compressMethod;
+   uint32_t compressedSize = publisherCompress(pub, (char *) buf->m_data + headerSize, src, differenceMethod, reorderMethod, compressMethod);
+   
+   //Track the compression ratio, so we notice when the image statistics change
+   pub.m_ratio = 0.9*pub.m_ratio + 0.1*((double) compressedSize)/(((size_t) pub.m_snx)*pub.m_sny*pub.m_typeSize);
+
+   publisherHeader(pub, buf->m_data, compressedSize, differenceMethod, reorderMethod, compressMethod, 0, 0);
+   
+   pub.m_lastBuf = buf;
+   pub.m_lastSize = headerSize + compressedSize;
+   
+   publisherCache(pub);
+   
+   return 0;
+}
+
+inline
+int milkzmqServer::publisherDelta( s_imagePublisher & pub,
+                                   s_refFrame & ref
+                                 )
+{
+   msgBuffer * buf = pub.m_pool->acquire();
+   if(buf == nullptr)
+   {
+      reportError("could not allocate message buffer for " + pub.m_imageName, __FILE__, __LINE__);
+      return -1;
+   }
+   
+   size_t nbytes = pub.m_curRaw.size();
+   pub.m_deltaRaw.resize(nbytes);
+   frameDelta(pub.m_deltaRaw.data(), pub.m_curRaw.data(), ref.m_raw.data(), nbytes, pub.m_typeSize, deltaIsXor(pub.m_atype));
+   
+   int16_t differenceMethod, reorderMethod, compressMethod;
+   uint32_t compressedSize = publisherCompress(pub, (char *) buf->m_data + headerSize, pub.m_deltaRaw.data(), differenceMethod, reorderMethod, compressMethod);
+   
+   publisherHeader(pub, buf->m_data, compressedSize, differenceMethod, reorderMethod, compressMethod, frameFlagDelta, ref.m_seq);
+   
+   if(ref.m_delta) msgBufferPool::release(ref.m_delta);
+   ref.m_delta = buf;
+   ref.m_deltaSize = headerSize + compressedSize;
+   ref.m_deltaSeq = pub.m_seq;
+   
+   return 0;
+}
+
+inline
+void milkzmqServer::publisherBatchSetup( s_imagePublisher & pub )
+{
+   pub.m_batchCount = 0;
+   pub.m_batchCnt0 = pub.m_image.md[0].cnt0; //Start with the next frame
+   
+   if(m_batchFrames <= 1 || pub.m_snz > 0)
+   {
+      pub.m_batchRaw.clear();
+      pub.m_batchDelta.clear();
+      pub.m_batchMeta.clear();
+      return;
+   }
+   
+   size_t nbytes = ((size_t) pub.m_snx)*pub.m_sny*pub.m_typeSize;
+   
+   //So that one large stream can not make us allocate gigabytes.
+   size_t K = std::min<size_t>(m_batchFrames, std::max<size_t>(maxBatchBytes/std::max<size_t>(nbytes, 1), 1));
+   if(K < m_batchFrames)
+   {
+      reportWarning(pub.m_imageName + ": frames are too large to batch " + std::to_string(m_batchFrames) + ", batching " + std::to_string(K));
+   }
+   pub.m_batchFrames = K;
+   
+   pub.m_batchRaw.resize(K*nbytes);
+   pub.m_batchMeta.resize(3*K);
+   
+   if(pub.m_batchXrif == nullptr)
+   {
+      if(xrif_new(&pub.m_batchXrif) != XRIF_NOERROR)
+      {
+         reportError("error allocating batch xrif handle for " + pub.m_imageName, __FILE__, __LINE__);
+         pub.m_batchXrif = nullptr;
+      }
+   }
+   
+   //16 bit integers use xrif, which differences each frame from the previous one.  Others byte-shuffle the frame to frame deltas.
+   bool xrifType = (pub.m_atype == XRIF_TYPECODE_INT16 || pub.m_atype == XRIF_TYPECODE_UINT16);
+   bool compress = (m_xrifCompressMethod != XRIF_COMPRESS_NONE || m_adaptiveCodec);
+   
+   pub.m_batchShuffle = (compress && !xrifType) || pub.m_batchXrif == nullptr;
+   
+   size_t encSz = K*nbytes;
+   if(pub.m_batchShuffle)
+   {
+      encSz = std::max(encSz, shuffleCompressBound(K*nbytes));
+      pub.m_scratch.resize(K*nbytes);
+      pub.m_batchDelta.resize(K*nbytes);
+   }
+   else
+   {
+      xrif_t xrif = pub.m_batchXrif;
+      xrif_set_size(xrif, pub.m_snx, pub.m_sny, 1, K, pub.m_atype);
+      //Differencing from the previous frame is what makes a batch worth sending.
+      if(compress) xrif_configure(xrif, XRIF_DIFFERENCE_PREVIOUS, XRIF_REORDER_BYTEPACK_RENIBBLE, XRIF_COMPRESS_LZ4);
+      else xrif_configure(xrif, XRIF_DIFFERENCE_NONE, XRIF_REORDER_NONE, XRIF_COMPRESS_NONE);
+      encSz = std::max(encSz, xrif_min_raw_size(xrif));
+      xrif_allocate_reordered(xrif);
+   }
+   
+   //The payload is the table of frame cnt0s and times, then the encoded frames.
+   pub.m_batchPool->bufferSize(headerSize + 3*K*sizeof(uint64_t) + encSz);
+}
+
+inline
+int milkzmqServer::publisherBatch( s_imagePublisher & pub )
+{
+   IMAGE & image = pub.m_image;
+   
+   uint64_t cnt0 = image.md[0].cnt0;
+   if(cnt0 == pub.m_batchCnt0) return 0;
+   pub.m_batchCnt0 = cnt0;
+   
+   //Only collect if someone has asked for this stream recently.
+   if(get_mono_nsec() - pub.m_stream->m_lastRequest.load(std::memory_order_relaxed) > 5000000000LL)
+   {
+      pub.m_batchCount = 0;
+      return 0;
+   }
+   
+   if( image.md[0].datatype != pub.m_atype || image.md[0].size[0] != pub.m_snx || image.md[0].size[1] != pub.m_sny || image.md[0].size[2] != pub.m_snz )
+   {
+      return -1; //get the new image setup.
+   }
+   
+   size_t nbytes = ((size_t) pub.m_snx)*pub.m_sny*pub.m_typeSize;
+   size_t K = pub.m_batchFrames;
+   
+   memcpy(pub.m_batchRaw.data() + pub.m_batchCount*nbytes, image.array.SI8, nbytes);
+   pub.m_batchMeta[3*pub.m_batchCount] = cnt0;
+   pub.m_batchMeta[3*pub.m_batchCount + 1] = image.md[0].writetime.tv_sec;
+   pub.m_batchMeta[3*pub.m_batchCount + 2] = image.md[0].writetime.tv_nsec;
+   
+   ++pub.m_batchCount;
+   if(pub.m_batchCount < K) return 0;
+   
+   pub.m_batchCount = 0;
+   
+   //-------- Encode the batch
+   msgBuffer * buf = pub.m_batchPool->acquire();
+   if(buf == nullptr)
+   {
+      reportError("could not allocate batch buffer for " + pub.m_imageName, __FILE__, __LINE__);
+      return -1;
+   }
+   
+   size_t tableSize = 3*K*sizeof(uint64_t);
+   memcpy(buf->m_data + headerSize, pub.m_batchMeta.data(), tableSize);
+   
+   char * dest = (char *) buf->m_data + headerSize + tableSize;
+   
+   int16_t differenceMethod, reorderMethod, compressMethod;
+   size_t encSize;
+   
+   if(pub.m_batchShuffle)
+   {
+      //Each frame is replaced by its delta from the previous one, then the whole cube is shuffled and compressed.
+      char * raw = pub.m_batchRaw.data();
+      char * delta = pub.m_batchDelta.data();
+      memcpy(delta, raw, nbytes);
+      for(size_t k = 1; k < K; ++k)
+      {
+         frameDelta(delta + k*nbytes, raw + k*nbytes, raw + (k-1)*nbytes, nbytes, pub.m_typeSize, deltaIsXor(pub.m_atype));
+      }
+      
+      bool compressed;
+      encSize = shuffleCompress(dest, compressed, delta, pub.m_scratch.data(), K*nbytes/pub.m_typeSize, pub.m_typeSize);
+      
+      differenceMethod = XRIF_DIFFERENCE_PREVIOUS;
+      reorderMethod = reorderByteShuffle;
+      compressMethod = XRIF_COMPRESS_LZ4;
+      
+      if(!compressed)
+      {
+         //Send the frames themselves rather than their deltas.
+         memcpy(dest, raw, K*nbytes);
+         differenceMethod = XRIF_DIFFERENCE_NONE;
+         compressMethod = XRIF_COMPRESS_NONE;
+      }
+   }
+   else
+   {
+      xrif_t xrif = pub.m_batchXrif;
+      xrif_set_raw(xrif, dest, pub.m_batchPool->bufferSize() - headerSize - tableSize);
+      memcpy(xrif->raw_buffer, pub.m_batchRaw.data(), K*nbytes);
+      xrif_encode(xrif);
+      
+      differenceMethod = xrif->difference_method;
+      reorderMethod = xrif->reorder_method;
+      compressMethod = xrif->compress_method;
+      encSize = xrif->compressed_size;
+   }
+   
+   //-------- This is now the newest frame
+   pub.m_lastCnt0 = cnt0;
+   pub.m_frameCnt0 = cnt0;
+   pub.m_frameTime = image.md[0].writetime;
+   pub.m_frameSlice = 0;
+   ++pub.m_seq;
+   pub.m_haveFrame = true;
+   
+   publisherHeader(pub, buf->m_data, tableSize + encSize, differenceMethod, reorderMethod, compressMethod, frameFlagBatch, 0);
+   *((uint32_t *) (buf->m_data + nframesOffset)) = K;
+   
+   if(pub.m_lastBuf) msgBufferPool::release(pub.m_lastBuf);
+   pub.m_lastBuf = buf;
+   pub.m_lastSize = headerSize + tableSize + encSize;
+   pub.m_curRawSeq = 0; //batches are never sent as deltas
+   
+   publisherCache(pub);
+   
+   return 1;
+}
+
+inline
+int milkzmqServer::publisherBurst( s_imagePublisher & pub,
+                                   uint64_t from
+                                 )
+{
+   uint64_t cur = pub.m_frameCnt0;
+   
+   //Everything written since from, but not the slice after the newest, which the source writes next.
+   uint32_t nframes = 1;
+   if(from != 0 && from < cur) nframes = std::min<uint64_t>(cur - from, std::max<uint32_t>(pub.m_snz, 2) - 1);
+   
+   msgBuffer * buf = pub.m_burstPool->acquire();
+   if(buf == nullptr)
+   {
+      reportError("could not allocate burst buffer for " + pub.m_imageName, __FILE__, __LINE__);
+      return -1;
+   }
+   
+   size_t nbytes = ((size_t) pub.m_snx)*pub.m_sny*pub.m_typeSize;
+   
+   int16_t differenceMethod = XRIF_DIFFERENCE_NONE, reorderMethod = XRIF_REORDER_NONE, compressMethod = XRIF_COMPRESS_NONE;
+   
+   //Oldest first
+   std::vector<size_t> starts(nframes); //where each slice starts in the payload
+   uint8_t * slice = buf->m_data + headerSize;
+   for(uint32_t n = nframes; n > 0; --n)
+   {
+      size_t idx = (pub.m_frameSlice + pub.m_snz - (n-1)) % pub.m_snz;
+      const char * src = (char *) pub.m_image.array.SI8 + idx*nbytes;
+      
+      starts[nframes - n] = slice - (buf->m_data + headerSize);
+      
+      uint32_t sz = publisherCompress(pub, (char *) slice + burstSliceHeaderSize, src, differenceMethod, reorderMethod, compressMethod);
+      
+      memset(slice, 0, burstSliceHeaderSize);
+      *((uint32_t *) slice) = sz;
+      *((int16_t *) (slice + sizeof(uint32_t))) = compressMethod;
+      
+      //Each frame's own count and time, from the circular buffer's arrays if the stream has them.  Otherwise the time 
+      //is left 0, and the client uses the newest frame's from the message header.
+      uint64_t sliceCnt0 = (pub.m_image.cntarray != nullptr) ? pub.m_image.cntarray[idx] : cur - (n-1);
+      memcpy(slice + burstSliceCnt0Offset, &sliceCnt0, sizeof(uint64_t));
+      if(pub.m_image.writetimearray != nullptr)
+      {
+         uint64_t sec = pub.m_image.writetimearray[idx].tv_sec;
+         uint64_t nsec = pub.m_image.writetimearray[idx].tv_nsec;
+         memcpy(slice + burstSliceSecOffset, &sec, sizeof(uint64_t));
+         memcpy(slice + burstSliceNsecOffset, &nsec, sizeof(uint64_t));
+      }
+      
+      slice += burstSliceHeaderSize + sz;
+   }
+   
+   uint32_t payloadSize = slice - (buf->m_data + headerSize);
+   
+   //The source writes slice newest+1, then newest+2, and so on.  Having written d frames since, it has reached every slice
+   //within d+1 of the newest going forward, which are the oldest of ours.  Those may be torn, so drop them.
+   std::atomic_thread_fence(std::memory_order_acquire);
+   uint64_t written = pub.m_image.md[0].cnt0 - cur;
+   uint64_t reached = (written + 1 >= pub.m_snz) ? pub.m_snz : written + 1;
+   uint32_t keep = (pub.m_snz - reached < nframes) ? pub.m_snz - reached : nframes;
+   
+   if(keep == 0)
+   {
+      msgBufferPool::release(buf);
+      return 1;
+   }
+   
+   if(keep < nframes)
+   {
+      size_t drop = starts[nframes - keep];
+      memmove(buf->m_data + headerSize, buf->m_data + headerSize + drop, payloadSize - drop);
+      payloadSize -= drop;
+      nframes = keep;
+   }
+   
+   publisherHeader(pub, buf->m_data, payloadSize, differenceMethod, reorderMethod, compressMethod, frameFlagBurst, 0);
+   *((uint32_t *) (buf->m_data + nframesOffset)) = nframes;
+   
+   if(pub.m_burstBuf) msgBufferPool::release(pub.m_burstBuf);
+   pub.m_burstBuf = buf;
+   pub.m_burstSize = headerSize + payloadSize;
+   pub.m_burstFrom = from;
+   
+   return 0;
+}
+
+inline
+void milkzmqServer::publisherHeader( s_imagePublisher & pub,
+                                     uint8_t * msg,
+                                     uint32_t compressedSize,
+                                     int16_t differenceMethod,
+                                     int16_t reorderMethod,
+                                     int16_t compressMethod,
+                                     uint8_t flags,
+                                     uint64_t refSeq
+                                   )
+{
+   memset(msg, 0, headerSize);
+   snprintf((char *) msg, nameSize, "%s", pub.m_imageName.c_str());
+   *((uint8_t *) (msg + typeOffset)) = pub.m_atype;
+   *((uint32_t *) (msg + size0Offset)) = pub.m_snx;
+   *((uint32_t *) (msg + size1Offset)) = pub.m_sny;
+   *((uint64_t *) (msg + cnt0Offset)) = pub.m_frameCnt0;
+   *((uint64_t *) (msg + tv_secOffset)) = pub.m_frameTime.tv_sec;
+   *((uint64_t *) (msg + tv_nsecOffset)) = pub.m_frameTime.tv_nsec;
+   *((int16_t *) (msg + xrifDifferenceOffset)) = differenceMethod; 
+   *((int16_t *) (msg + xrifReorderOffset))    = reorderMethod;
+   *((int16_t *) (msg + xrifCompressOffset))   = compressMethod;
+   *((uint32_t *) (msg + xrifSizeOffset))  = compressedSize;
+   *((uint8_t *) (msg + frameFlagsOffset)) = flags;
+   *((uint64_t *) (msg + seqOffset)) = pub.m_seq;
+   *((uint64_t *) (msg + refSeqOffset)) = refSeq;
+   *((uint8_t *) (msg + naxisOffset)) = pub.m_image.md[0].naxis;
+   *((uint32_t *) (msg + size2Offset)) = pub.m_snz;
+}
+
+inline
+milkzmqServer::s_refFrame * milkzmqServer::publisherRef( s_imagePublisher & pub,
+                                                         uint64_t seq
+                                                       )
+{
+   if(seq == 0) return nullptr;
+   
+   for(size_t n = 0; n < pub.m_refs.size(); ++n)
+   {
+      if(pub.m_refs[n].m_seq == seq) return &pub.m_refs[n];
+   }
+   
+   return nullptr;
+}
+
+inline
+void milkzmqServer::publisherRetain( s_imagePublisher & pub,
+                                     uint64_t oldSeq
+                                   )
+{
+   s_refFrame * old = publisherRef(pub, oldSeq);
+   if(old && old->m_users > 0) --old->m_users;
+   
+   s_refFrame * ref = publisherRef(pub, pub.m_seq);
+   
+   if(ref == nullptr)
+   {
+      if(pub.m_refs.size() < maxRefFrames)
+      {
+         pub.m_refs.emplace_back();
+         ref = &pub.m_refs.back();
+      }
+      else
+      {
+         //Replace the oldest frame no one is using, or failing that the oldest.
+         ref = &pub.m_refs[0];
+         for(size_t n = 1; n < pub.m_refs.size(); ++n)
+         {
+            s_refFrame & r = pub.m_refs[n];
+            if( (r.m_users == 0 && ref->m_users > 0) || ((r.m_users == 0) == (ref->m_users == 0) && r.m_seq < ref->m_seq) ) ref = &r;
+         }
+         
+         if(ref->m_delta) msgBufferPool::release(ref->m_delta);
+         ref->m_delta = nullptr;
+         ref->m_deltaSeq = 0;
+         ref->m_users = 0;
+      }
+      
+      ref->m_seq = pub.m_seq;
+      ref->m_raw = pub.m_curRaw;
+   }
+   
+   ++ref->m_users;
+}
+
+inline
+void milkzmqServer::publisherDropRefs( s_imagePublisher & pub )
+{
+   for(size_t n = 0; n < pub.m_refs.size(); ++n)
+   {
+      if(pub.m_refs[n].m_delta) msgBufferPool::release(pub.m_refs[n].m_delta);
+   }
+   pub.m_refs.clear();
+   pub.m_curRawSeq = 0;
+}
+
+inline
+bool milkzmqServer::subscriptionProduct( s_imagePublisher & pub,
+                                         s_subscription * sub,
+                                         s_productKey & key
+                                       )
+{
+   //These are stored separately, so a change can be seen half made for one frame.  Clipping keeps that harmless.
+   key.m_x0 = sub->m_roiX0.load(std::memory_order_relaxed);
+   key.m_y0 = sub->m_roiY0.load(std::memory_order_relaxed);
+   key.m_width = sub->m_roiWidth.load(std::memory_order_relaxed);
+   key.m_height = sub->m_roiHeight.load(std::memory_order_relaxed);
+   key.m_bin = sub->m_bin.load(std::memory_order_relaxed);
+   key.m_binMean = sub->m_binMean.load(std::memory_order_relaxed);
+   key.m_convert = sub->m_convert.load(std::memory_order_relaxed);
+   
+   if(key.m_width == 0 || key.m_height == 0 || key.m_x0 >= pub.m_snx || key.m_y0 >= pub.m_sny) 
+   {
+      key.m_x0 = 0;
+      key.m_y0 = 0;
+      key.m_width = pub.m_snx;
+      key.m_height = pub.m_sny;
+   }
+   
+   key.m_width = std::min(key.m_width, pub.m_snx - key.m_x0);
+   key.m_height = std::min(key.m_height, pub.m_sny - key.m_y0);
+   
+   //Bin by no more than the region, and only types we can bin.
+   key.m_bin = std::min(key.m_bin, std::min(key.m_width, key.m_height));
+   if(key.m_bin < 1 || binnedType(pub.m_atype, key.m_binMean) == 0) key.m_bin = 1;
+   if(key.m_bin == 1) key.m_binMean = false;
+   
+   //Only floating point can be converted
+   uint8_t atype = (key.m_bin > 1) ? binnedType(pub.m_atype, key.m_binMean) : pub.m_atype;
+   if(key.m_convert > convertBf16 || !convertible(atype)) key.m_convert = convertNone;
+   
+   if(key.m_width == pub.m_snx && key.m_height == pub.m_sny && key.m_bin == 1 && key.m_convert == convertNone) return false;
+   
+   return true;
+}
+
+inline
+milkzmqServer::s_product * milkzmqServer::publisherProduct( s_imagePublisher & pub,
+                                                            const s_productKey & key
+                                                          )
+{
+   s_product * p = nullptr;
+   for(size_t n = 0; n < pub.m_products.size(); ++n)
+   {
+      if(pub.m_products[n].m_key == key) 
+      {
+         p = &pub.m_products[n];
+         break;
+      }
+   }
+   
+   if(p == nullptr)
+   {
+      if(pub.m_products.size() < maxProducts)
+      {
+         pub.m_products.emplace_back();
+         p = &pub.m_products.back();
+         p->m_pool = std::make_shared<msgBufferPool>();
+      }
+      else
+      {
+         //Replace the least recently sent
+         p = &pub.m_products[0];
+         for(size_t n = 1; n < pub.m_products.size(); ++n)
+         {
+            if(pub.m_products[n].m_lastUsed < p->m_lastUsed) p = &pub.m_products[n];
+         }
+         
+         if(p->m_buf) msgBufferPool::release(p->m_buf);
+         p->m_buf = nullptr;
+         p->m_seq = 0;
+      }
+      
+      p->m_key = key;
+      p->m_nx = key.m_width/key.m_bin;
+      p->m_ny = key.m_height/key.m_bin;
+      p->m_atype = (key.m_bin > 1) ? binnedType(pub.m_atype, key.m_binMean) : pub.m_atype;
+      p->m_wireType = (key.m_convert != convertNone) ? convertedType(key.m_convert) : p->m_atype;
+      p->m_codec = -1; //set up the codec for the new size on first encode
+      p->m_raw.resize(((size_t) p->m_nx)*p->m_ny*ImageStreamIO_typesize(p->m_wireType));
+      if(key.m_convert != convertNone) p->m_unconverted.resize(((size_t) p->m_nx)*p->m_ny*ImageStreamIO_typesize(p->m_atype));
+      else p->m_unconverted.clear();
+   }
+   
+   p->m_lastUsed = get_mono_nsec();
+   
+   return p;
+}
+
+inline
+int milkzmqServer::publisherProductEncode( s_imagePublisher & pub,
+                                           s_product & p
+                                         )
+{
+   size_t typeSize = ImageStreamIO_typesize(p.m_wireType);
+   size_t nbytes = p.m_raw.size();
+   
+   //-------- Set up the codec if it changed
+   if(p.m_codec != pub.m_codec)
+   {
+      //The stream's codec, unless binning or conversion changed the type.  Then, if the stream is compressed, 
+      //xrif for 16 bit integers and byte-shuffle for the rest.
+      p.m_codecUsed = pub.m_codecs[pub.m_codec];
+      if(p.m_wireType != pub.m_atype)
+      {
+         s_codec c;
+         if(p.m_codecUsed.m_compressMethod != XRIF_COMPRESS_NONE)
+         {
+            if(p.m_wireType == XRIF_TYPECODE_INT16 || p.m_wireType == XRIF_TYPECODE_UINT16)
+            {
+               c.m_differenceMethod = m_xrifDifferenceMethod;
+               c.m_reorderMethod = m_xrifReorderMethod;
+               c.m_compressMethod = m_xrifCompressMethod;
+            }
+            else
+            {
+               c.m_reorderMethod = reorderByteShuffle;
+               c.m_compressMethod = XRIF_COMPRESS_LZ4;
+            }
+            c.m_lz4Accel = p.m_codecUsed.m_lz4Accel;
+         }
+         p.m_codecUsed = c;
+      }
+      
+      const s_codec & c = p.m_codecUsed;
+      
+      if(c.m_reorderMethod == reorderByteShuffle)
+      {
+         p.m_pool->bufferSize(headerSize + std::max(nbytes, shuffleCompressBound(nbytes)));
+      }
+      else
+      {
+         if(p.m_xrif == nullptr && xrif_new(&p.m_xrif) != XRIF_NOERROR)
+         {
+            reportError("error allocating xrif handle for " + pub.m_imageName, __FILE__, __LINE__);
+            p.m_xrif = nullptr;
+            return -1;
+         }
+         
+         xrif_set_size(p.m_xrif, p.m_nx, p.m_ny, 1, 1, p.m_wireType);
+         xrif_configure(p.m_xrif, c.m_differenceMethod, c.m_reorderMethod, c.m_compressMethod);
+         xrif_set_lz4_acceleration(p.m_xrif, c.m_lz4Accel);
+         xrif_allocate_reordered(p.m_xrif);
+         
+         p.m_pool->bufferSize(headerSize + std::max(nbytes, xrif_min_raw_size(p.m_xrif)));
+      }
+      
+      p.m_codec = pub.m_codec;
+   }
+   
+   const s_codec & c = p.m_codecUsed;
+   
+   //-------- Crop, bin, and convert the newest frame, from our copy
+   size_t rowBytes = ((size_t) pub.m_snx)*pub.m_typeSize;
+   size_t frameBytes = rowBytes*pub.m_sny;
+   
+   //publisherEncode copies the frame if anyone wanted a product then.  One asked for since, we copy now, as long as
+   //the source has not started to overwrite the frame.
+   if(pub.m_curRawSeq != pub.m_seq)
+   {
+      IMAGE & image = pub.m_image;
+      
+      pub.m_curRaw.resize(frameBytes);
+      memcpy(pub.m_curRaw.data(), (char *) image.array.SI8 + pub.m_frameSlice*frameBytes, frameBytes);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      
+      //A circular buffer overwrites the slice when it comes back around to it.
+      uint64_t behind = image.md[0].cnt0 - pub.m_frameCnt0;
+      if( (pub.m_snz > 0) ? (behind + 1 >= pub.m_snz) : (behind > 0 || image.md[0].write) ) return 1;
+      
+      pub.m_curRawSeq = pub.m_seq;
+   }
+   
+   const char * src = pub.m_curRaw.data();
+   src += p.m_key.m_y0*rowBytes + ((size_t) p.m_key.m_x0)*pub.m_typeSize;
+   
+   char * stage = (p.m_key.m_convert != convertNone) ? p.m_unconverted.data() : p.m_raw.data();
+   
+   if(p.m_key.m_bin > 1)
+   {
+      binFrame(stage, src, pub.m_atype, p.m_key.m_width, p.m_key.m_height, pub.m_snx, p.m_key.m_bin, p.m_key.m_binMean, p.m_scratch);
+   }
+   else
+   {
+      size_t outRowBytes = ((size_t) p.m_nx)*pub.m_typeSize;
+      for(uint32_t y = 0; y < p.m_ny; ++y)
+      {
+         memcpy(stage + y*outRowBytes, src + y*rowBytes, outRowBytes);
+      }
+   }
+   
+   double convertScale = 1, convertZero = 0;
+   if(p.m_key.m_convert != convertNone)
+   {
+      convertFrame(p.m_raw.data(), stage, p.m_atype, ((size_t) p.m_nx)*p.m_ny, p.m_key.m_convert, convertScale, convertZero);
+   }
+   
+   //-------- Encode
+   msgBuffer * buf = p.m_pool->acquire();
+   if(buf == nullptr)
+   {
+      reportError("could not allocate message buffer for " + pub.m_imageName, __FILE__, __LINE__);
+      return -1;
+   }
+   
+   char * dest = (char *) buf->m_data + headerSize;
+   
+   int16_t differenceMethod, reorderMethod, compressMethod;
+   size_t compressedSize;
+   
+   if(c.m_reorderMethod == reorderByteShuffle)
+   {
+      p.m_scratch.resize(nbytes);
+      
+      bool compressed;
+      compressedSize = shuffleCompress(dest, compressed, p.m_raw.data(), p.m_scratch.data(), nbytes/typeSize, typeSize, c.m_lz4Accel);
+      
+      differenceMethod = XRIF_DIFFERENCE_NONE;
+      reorderMethod = reorderByteShuffle;
+      compressMethod = compressed ? XRIF_COMPRESS_LZ4 : XRIF_COMPRESS_NONE;
+   }
+   else
+   {
+      xrif_t xrif = p.m_xrif;
+      xrif_set_raw(xrif, dest, p.m_pool->bufferSize() - headerSize);
+      memcpy(xrif->raw_buffer, p.m_raw.data(), nbytes);
+      xrif_encode(xrif);
+      
+      differenceMethod = xrif->difference_method;
+      reorderMethod = xrif->reorder_method;
+      compressMethod = xrif->compress_method;
+      compressedSize = xrif->compressed_size;
+   }
+   
+   publisherHeader(pub, buf->m_data, compressedSize, differenceMethod, reorderMethod, compressMethod, frameFlagRoi, 0);
+   *((uint8_t *) (buf->m_data + typeOffset)) = p.m_atype;
+   *((uint32_t *) (buf->m_data + size0Offset)) = p.m_nx;
+   *((uint32_t *) (buf->m_data + size1Offset)) = p.m_ny;
+   *((uint32_t *) (buf->m_data + roiX0Offset)) = p.m_key.m_x0;
+   *((uint32_t *) (buf->m_data + roiY0Offset)) = p.m_key.m_y0;
+   *((uint8_t *) (buf->m_data + binOffset)) = p.m_key.m_bin;
+   *((uint8_t *) (buf->m_data + binMeanOffset)) = p.m_key.m_binMean;
+   *((uint8_t *) (buf->m_data + convertOffset)) = p.m_key.m_convert;
+   *((double *) (buf->m_data + convertScaleOffset)) = convertScale;
+   *((double *) (buf->m_data + convertZeroOffset)) = convertZero;
+   
+   if(p.m_buf) msgBufferPool::release(p.m_buf);
+   p.m_buf = buf;
+   p.m_size = headerSize + compressedSize;
+   p.m_seq = pub.m_seq;
+   
+   return 0;
+}
+
+inline
+void milkzmqServer::publisherDropProducts( s_imagePublisher & pub )
+{
+   for(size_t n = 0; n < pub.m_products.size(); ++n)
+   {
+      if(pub.m_products[n].m_buf) msgBufferPool::release(pub.m_products[n].m_buf);
+      if(pub.m_products[n].m_xrif) xrif_delete(pub.m_products[n].m_xrif);
+   }
+   pub.m_products.clear();
+}
+
+inline
+int milkzmqServer::publisherSend( s_imagePublisher & pub,
+                                  s_subscription * sub
+                                )
+{
+   uint64_t lastSeq = sub->m_lastSeq;
+   sub->m_lastSeq = pub.m_seq;
+   
+   //-------- Send a product, shared by every subscriber which asked for the same one
+   s_productKey key;
+   if(subscriptionProduct(pub, sub, key))
+   {
+      s_product * p = publisherProduct(pub, key);
+      if(p->m_seq != pub.m_seq)
+      {
+         int rv = publisherProductEncode(pub, *p);
+         if(rv < 0) return -1;
+         
+         if(rv > 0) //the subscriber gets the next frame instead
+         {
+            sub->m_lastSeq = lastSeq;
+            return 0;
+         }
+      }
+      
+      sub->m_lastCnt0 = pub.m_frameCnt0;
+      
+      sendBuffer(pub.m_stream, sub, p->m_buf, p->m_size);
+      return 0;
+   }
+   
+   //-------- Send a burst of every slice written since the last one sent, if the client wants them and this is a circular buffer
+   if(pub.m_snz > 0 && sub->m_wantsBurst.load(std::memory_order_relaxed))
+   {
+      uint64_t from = sub->m_lastCnt0;
+      sub->m_lastCnt0 = pub.m_frameCnt0;
+      
+      int rv = 0;
+      if(pub.m_burstBuf == nullptr || pub.m_burstFrom != from) rv = publisherBurst(pub, from);
+      if(rv < 0) return -1;
+      
+      if(rv == 0)
+      {
+         sendBuffer(pub.m_stream, sub, pub.m_burstBuf, pub.m_burstSize);
+         return 0;
+      }
+      
+      //Otherwise the newest frame went too, and the client gets it as a single frame.
+   }
+   
+   sub->m_lastCnt0 = pub.m_frameCnt0;
+   
+   //-------- Send a delta if the client takes them and still has a frame we have kept
+   if(sub->m_wantsDelta.load(std::memory_order_relaxed) && pub.m_curRawSeq == pub.m_seq)
+   {
+      s_refFrame * ref = nullptr;
+      
+      bool needKey = sub->m_needKey.exchange(false, std::memory_order_relaxed);
+      if(!needKey && sub->m_sinceKey + 1 < m_keyframeInterval) ref = publisherRef(pub, lastSeq);
+      
+      if(ref)
+      {
+         if(ref->m_deltaSeq != pub.m_seq)
+         {
+            if(publisherDelta(pub, *ref) < 0) return -1;
+         }
+         
+         msgBuffer * buf = ref->m_delta;
+         size_t sz = ref->m_deltaSize;
+         
+         ++sub->m_sinceKey;
+         sendBuffer(pub.m_stream, sub, buf, sz); //takes a reference before the retain can replace ref
+         
+         publisherRetain(pub, lastSeq);
+         return 0;
+      }
+      
+      sub->m_sinceKey = 0;
+      publisherRetain(pub, lastSeq);
+   }
+   
+   //-------- Otherwise send a keyframe
+   if(pub.m_lastBuf == nullptr)
+   {
+      if(publisherKeyframe(pub, pub.m_curRaw.data()) < 0) return -1;
+   }
+   
+   sendBuffer(pub.m_stream, sub, pub.m_lastBuf, pub.m_lastSize);
+   
+   return 0;
+}
+
+inline
+void milkzmqServer::publisherCache( s_imagePublisher & pub )
+{
+   s_stream * st = pub.m_stream;
+   
+   std::lock_guard<std::mutex> guard(st->m_cacheMutex);
+   
+   if(st->m_cacheBuf) msgBufferPool::release(st->m_cacheBuf);
+   
+   st->m_cacheBuf = pub.m_lastBuf;
+   st->m_cacheSize = pub.m_lastSize;
+   st->m_cacheSeq = pub.m_seq;
+   
+   pub.m_cacheTime = st->m_cacheBuf ? get_mono_nsec() : 0;
+   
+   if(st->m_cacheBuf) msgBufferPool::addRef(st->m_cacheBuf);
+}
+
+inline
+bool milkzmqServer::sendCached( s_stream * st,
+                                s_subscription * sub
+                              )
+{
+   msgBuffer * buf;
+   size_t sz;
+   uint64_t seq;
+   
+   //Scope for mutex.  We take our own reference so the publisher can replace the cache while we send.
+   {
+      std::lock_guard<std::mutex> guard(st->m_cacheMutex);
+      
+      buf = st->m_cacheBuf;
+      if(buf == nullptr) return false;
+      
+      msgBufferPool::addRef(buf);
+      sz = st->m_cacheSize;
+      seq = st->m_cacheSeq;
+   }
+   
+   //The message takes over our reference.
+   zmq::message_t frame( buf->m_data, sz, msgBufferPool::zmqFree, buf);
+   frame.set_routing_id(sub->m_routingId);
+   
    try
    {
-      *m_imageThreads[thno].m_thread = std::thread( internal_imageThreadStart, &m_imageThreads[thno]);
+      #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+      m_servers[st->m_socket]->send(frame, zmq::send_flags::dontwait);
+      #else
+      m_servers[st->m_socket]->send(frame, ZMQ_DONTWAIT);
+      #endif
    }
-   catch( const std::exception & e )
+   catch(...)
    {
-      reportError(std::string("exception in image thread startup: ") +e.what(), __FILE__, __LINE__);
-      return -1;
+      return false;
    }
-   catch( ... )
+   
+   sub->m_cachedSeq.store(seq, std::memory_order_release);
+   
+   return true;
+}
+
+inline
+void milkzmqServer::sendBuffer( s_stream * st,
+                                s_subscription * sub,
+                                msgBuffer * buf,
+                                size_t sz
+                              )
+{
+   sub->m_dead.store(false, std::memory_order_relaxed);
+   
+   //This version will not copy the data.  Each message holds a reference to the buffer, released by zmq when sent.
+   msgBufferPool::addRef(buf);
+   zmq::message_t frame( buf->m_data, sz, msgBufferPool::zmqFree, buf);
+   frame.set_routing_id(sub->m_routingId);
+   
+   try
    {
-      reportError("unknown exception in image thread startup", __FILE__, __LINE__);
-      return -1;
+      #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+      m_servers[st->m_socket]->send(frame, zmq::send_flags::dontwait);
+      #else
+      m_servers[st->m_socket]->send(frame, ZMQ_DONTWAIT);
+      #endif
+   }
+   catch(...)
+   {
+      //Assume this means the client is no longer connected.  Unless it is still ready, we must not touch sub after this.
+      sub->m_dead.store(true, std::memory_order_release);
    }
+}
+
+inline
+int milkzmqServer::publisherCheck( s_imagePublisher & pub )
+{
+   pub.m_lastLiveCheck = get_mono_nsec();
    
-   if(!m_imageThreads[thno].m_thread->joinable())
+   if(pub.m_image.md[0].sem <= 0) return -1; //Indicates that the server has cleaned up.
+   
+   struct stat statbuff;
+   int rv = stat(pub.m_fname, &statbuff);
+
+   if(rv != 0)
    {
-      reportError("image thread did not start", __FILE__, __LINE__);
+      char serr[512];
+      if(strerror_r(errno, serr, sizeof(serr)) ) 
+      {
+         static_cast<void>(errno); //not error checking b/c the GNU vs XSI thing makes it impossible to understand what to do.
+      }
+
+      reportError("Error stat-ing ImageStream " + pub.m_imageName + ": " + serr, __FILE__, __LINE__);  
+      return -1;
+   }
+
+   if(statbuff.st_ino != pub.m_inode)
+   {
+      std::cerr << "inode changed " << statbuff.st_ino << " " << pub.m_inode << "\n";
       return -1;
    }
    
@@ -654,375 +3518,278 @@ int milkzmqServer::imageThreadStart(size_t thno)
 }
 
 inline
-int milkzmqServer::imageThreadKill(size_t thno)
+void milkzmqServer::publisherClose( s_imagePublisher & pub )
 {
-   pthread_kill(m_imageThreads[thno].m_thread->native_handle(), SIGQUIT);
-   return 0;
+   if(!pub.m_opened) return;
+   
+   if(pub.m_semIndex >= 0 && pub.m_image.md[0].sem > pub.m_semIndex) pub.m_image.semReadPID[pub.m_semIndex] = 0; //release the semaphore for other readers
+   pub.m_semIndex = -1;
+   
+   ImageStreamIO_closeIm(&pub.m_image);
+   pub.m_opened = false;
 }
 
+inline
+void milkzmqServer::publisherHangup( s_imagePublisher & pub )
+{
+   //-------- Send a message shorter than a header to tell the other side to hangup...
+   takeReady(pub.m_subs, pub.m_stream);
+   
+   //It carries just the name, so a client receiving many streams on one socket knows which one hung up.
+   char hangup[nameSize];
+   memset(hangup, 0, sizeof(hangup));
+   snprintf(hangup, nameSize, "%s", pub.m_stream->m_name.c_str());
+   
+   for(size_t n = 0; n < pub.m_subs.size(); ++n)
+   {
+      s_subscription * sub = pub.m_subs[n];
+      sub->m_dead.store(false, std::memory_order_relaxed);
+      
+      zmq::message_t frame( hangup, sizeof(hangup)); //copies, since hangup goes out of scope before zmq sends
+      frame.set_routing_id(sub->m_routingId);
+      
+      sub->m_credit.store(0, std::memory_order_relaxed);
+      sub->m_ready.store(false, std::memory_order_release);
+      
+      try
+      {
+         #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
+         m_servers[pub.m_stream->m_socket]->send(frame, zmq::send_flags::dontwait);
+         #else
+         m_servers[pub.m_stream->m_socket]->send(frame, ZMQ_DONTWAIT);
+         #endif
+      }
+      catch(...)
+      {
+         //Assume this means the client is no longer connected
+         sub->m_dead.store(true, std::memory_order_release);
+      }
+   }
+   pub.m_subs.clear();
+}
 
+inline
+void milkzmqServer::publisherFree( s_imagePublisher & pub )
+{
+   publisherClose(pub);
+   
+   if(pub.m_xrif != nullptr) xrif_delete(pub.m_xrif);
+   pub.m_xrif = nullptr;
+   
+   if(pub.m_lastBuf) msgBufferPool::release(pub.m_lastBuf);
+   pub.m_lastBuf = nullptr;
+   pub.m_haveFrame = false;
+   if(pub.m_stream) publisherCache(pub);
+   
+   publisherDropRefs(pub);
+   
+   if(pub.m_burstBuf) msgBufferPool::release(pub.m_burstBuf);
+   pub.m_burstBuf = nullptr;
+   
+   if(pub.m_batchXrif != nullptr) xrif_delete(pub.m_batchXrif);
+   pub.m_batchXrif = nullptr;
+   
+   publisherDropProducts(pub);
+   
+   pub.m_pool.reset(); //buffers still held by zmq keep the pool alive until released
+   pub.m_burstPool.reset();
+   pub.m_batchPool.reset();
+}
 
 inline
 void milkzmqServer::imageThreadExec(const std::string & imageName)
 {   
-   IMAGE image;
-
-   size_t type_size = 0; ///< The size, in bytes, of the image data type
-
-   bool opened = false;
+   s_imagePublisher pub;
    
-   uint8_t * msg = nullptr;
-   
-   while(m_server == nullptr)
+   while(!m_serving)
    {
       milkzmq::sleep(1);
    }
    
-   xrif_error_t xe;
-   xrif_t xrif = nullptr;
-   xe = xrif_new(&xrif);
+   if(publisherInit(pub, imageName) < 0) return;
+   pub.m_useSem = m_semWait;
    
-                              
    while(!m_timeToDie)
    {
-      opened = false;
-      m_restart = false; //Set this up front, since we're about to restart.
+      while(!m_timeToDie)
+      {
+         if(publisherOpen(pub) == 0) break;
+         milkzmq::sleep(1); //be patient
+      }
+      if(m_timeToDie || !pub.m_opened) break;
       
-      int SM_fd;
-      char SM_fname[512];
-      ImageStreamIO_filename(SM_fname, sizeof(SM_fname), imageName.c_str());
-
-      int printed = 0;
-
-      ino_t inode {0};
-
-      while(!opened && !m_timeToDie && !m_restart)
+      while(!m_timeToDie && m_restartCount.load(std::memory_order_relaxed) == pub.m_restartCount)
       {
-         //b/c ImageStreamIO prints every single time, and latest version don't support stopping it yet, and that isn't thread-safe-able anyway
-         //we do our own checks.  This is the same code in ImageStreamIO_openIm...
-         SM_fd = open(SM_fname, O_RDWR);
-         if(SM_fd == -1)
-         {
-            if(!printed) reportWarning("ImageStream " + imageName + " not found (yet).  Retrying . . .");
-            printed = 1;
-            milkzmq::sleep(1); //be patient
-            continue;
-         }
+         int rv = publisherUpdate(pub);
+         
+         if(rv < 0) break; //exit the nearest while loop and get the new image setup.
          
-         //Found and opened,  close it and then use ImageStreamIO
-         printed = 0;
-         close(SM_fd);
+         if(rv == 2) continue; //sent, look for the next one right away.
          
-         if( ImageStreamIO_openIm(&image, imageName.c_str()) == 0)
+         if(rv == 1) //a frame is waiting but no one is due, so wait until someone is.
          {
-            if(image.md[0].sem <= 0) 
+            //No point in waking up before the deadline, but not so long we miss m_timeToDie.
+            int64_t now = get_mono_nsec();
+            if(pub.m_nextDue > now) 
             {
-               ImageStreamIO_closeIm(&image);
-               milkzmq::sleep(1); //We just need to wait for the server process to finish startup.
+               mono_sleep_until( std::min<int64_t>(pub.m_nextDue, now + 1000LL*m_semTimeout) );
             }
-            else
-            {
-               type_size = ImageStreamIO_typesize(image.md[0].datatype);
-               opened = true;
-
-               struct stat statbuff;
-               int rv = stat(SM_fname, &statbuff);
-
-               if(rv != 0)
-               {
-                  reportError("Error stat-ing ImageStream " + imageName, __FILE__, __LINE__);   
-                  ImageStreamIO_closeIm(&image);
-                  opened = false;
-               }
-               else
-               {
-                  inode = statbuff.st_ino;
-               }
-            }
-         }
-         else
-         {
-            milkzmq::sleep(1); //be patient
+            else milkzmq::microsleep(m_usecSleep);
+            continue;
          }
-      }
-      if(m_timeToDie || !opened) return;
-    
-      reportNotice("Connected to ImageStream " + imageName);
-      
-      int curr_image;
-      uint8_t atype;
-      uint32_t snx, sny, snz;
-      uint8_t last_atype = image.md[0].datatype;
-      uint32_t last_snx = image.md[0].size[0];
-      uint32_t last_sny = image.md[0].size[1];
-      uint32_t last_snz = image.md[0].size[2];
-
-      //---- Set up xrif handle      
-      xe = xrif_set_size(xrif, last_snx, last_sny, 1, 1, last_atype);
-
-      //We check that this stream is actually compressable...
-      int xrifDifferenceMethod = m_xrifDifferenceMethod;
-      int xrifReorderMethod = m_xrifReorderMethod;
-      int xrifCompressMethod = m_xrifCompressMethod;
-      
-      if(last_atype != XRIF_TYPECODE_INT16 && last_atype != XRIF_TYPECODE_UINT16)
-      {
-         //Not compressable:
-         xrifDifferenceMethod = XRIF_DIFFERENCE_NONE;
-         xrifReorderMethod = XRIF_REORDER_NONE;
-         xrifCompressMethod = XRIF_COMPRESS_NONE;
-      }
-      
-      xe = xrif_configure(xrif, xrifDifferenceMethod, xrifReorderMethod, xrifCompressMethod);
-      
-      //---- Allocate the message
-      if(msg != nullptr) 
-      {
-         //problem: if msg is not nullptr, then it means that it was allocated and 
-         //most likely handed over to zmq for sending.  We can't afford to free it 
-         //until zmq actually decides it's done with it.
-         //for now: we sleep.
-         sleep(2);
-         free(msg);
-      }
-      size_t msgSz = headerSize + xrif_min_raw_size(xrif); //This is maximum message size.
-      msg = (uint8_t *) malloc(msgSz);
-      
-      //---- Allocate XRIF
-      xe = xrif_set_size(xrif, last_snx, last_sny, 1, 1, last_atype);
-      xe = xrif_set_raw(xrif, msg + headerSize, xrif_min_raw_size(xrif));
-      xe = xrif_allocate_reordered(xrif);
-      
-      double lastCheck = get_curr_time();
-      double lastSend = get_curr_time();
-      double delta = 0;
-      
-      uint64_t lastCnt0 = -1; //Force treating first image as new image
-      
-      std::vector<routing_id_t> rids;
-      
-      while(!m_timeToDie && !m_restart)
-      {
-         uint64_t cnt0 = image.md[0].cnt0;
-         if(cnt0 != lastCnt0)
+         
+         //No new frame
+         if(pub.m_semIndex >= 0)
          {
-            //-------- Do a wait for max fps here.
-            double currtime = get_curr_time();
-            if( currtime - lastCheck < 1.0/m_fpsTgt-delta) 
-            {
-               milkzmq::microsleep(m_usecSleep);
-               continue;
-            }
-            lastCheck = currtime;
-
-            //-------- Check to see if anyone is subscribing to this stream...
-            rids.clear();
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += (m_semTimeout % 1000000)*1000;
+            ts.tv_sec += m_semTimeout / 1000000 + ts.tv_nsec / 1000000000;
+            ts.tv_nsec %= 1000000000;
             
-            //We lock the mutex during lookup, but unlock so that it isn't blocked during the send call.
-            //Scope for map mutex
+            if(ImageStreamIO_semtimedwait(&pub.m_image, pub.m_semIndex, &ts) == 0)
             {
-               std::lock_guard<std::mutex> guard(m_mapMutex);
-
-               std::unordered_map<routing_id_t, imageReceivedFlagMap_t>::iterator it = m_requestorMap.begin();
-            
-               while(it != m_requestorMap.end())
-               {
-                  if( it->second.count(imageName) > 0 )
-                  {
-                     if(it->second[imageName] == true)
-                     {
-                        rids.push_back(it->first);
-                     }
-                  }
-                  ++it;
-               }
+               //Drain any backlog, cnt0 tells us everything we need to know about new frames.
+               ImageStreamIO_semflush(&pub.m_image, pub.m_semIndex);
+               continue;
             }
-            if(rids.size() == 0) continue; //No subscribers
             
-            if(m_timeToDie || m_restart) break; //Check for exit signals
-
-            //-------- Get size and look for changes
-            atype = image.md[0].datatype;
-            snx = image.md[0].size[0];
-            sny = image.md[0].size[1];
-            snz = image.md[0].size[2];
+            //Timed out (or interrupted), so do the liveness checks.
+         }
          
-            if( atype!= last_atype || snx != last_snx || sny != last_sny || snz != last_snz )
-            {
-               break; //exit the nearest while loop and get the new image setup.
-            }
-            
-            if(image.md[0].size[2] > 0) ///\todo change to naxis?
-            {
-               curr_image = image.md[0].cnt1;
-               if(curr_image < 0) curr_image = image.md[0].size[2] - 1;
-            }
-            else curr_image = 0;
+         if(publisherCheck(pub) < 0) break;
 
-            cnt0 = image.md[0].cnt0;
-            
-            
-            //XRIF Encoding...
-            //Because of xrif->compress_on_raw == true, xrif->raw_buffer = msg + headerSize, this results in the encoded message being written to the message buffer.
-            memcpy(xrif->raw_buffer, image.array.SI8 + curr_image*snx*sny*type_size, snx*sny*type_size);
-            xe = xrif_encode(xrif);
-   
-            //std::cerr << imageName << " XRIF: " << xrif->compression_ratio*100. << "%\n";
-
-            //----Now construct header
-            memset(msg, 0, headerSize);
-            snprintf((char *) msg, nameSize, "%s", imageName.c_str());
-            *((uint8_t *) (msg + typeOffset)) = atype;
-            *((uint32_t *) (msg + size0Offset)) = snx;
-            *((uint32_t *) (msg + size1Offset)) = sny;
-            *((uint64_t *) (msg + cnt0Offset)) = image.md[0].cnt0;
-            *((uint64_t *) (msg + tv_secOffset)) = image.md[0].writetime.tv_sec;
-            *((uint64_t *) (msg + tv_nsecOffset)) = image.md[0].writetime.tv_nsec;
-            *((int16_t *) (msg + xrifDifferenceOffset)) = xrif->difference_method; 
-            *((int16_t *) (msg + xrifReorderOffset))    = xrif->reorder_method;
-            *((int16_t *) (msg + xrifCompressOffset))   = xrif->compress_method;
-            *((uint32_t *) (msg + xrifSizeOffset))  = xrif->compressed_size;
-            
-            
-            //memcpy(msg + imageOffset, image.array.SI8 + curr_image*snx*sny*type_size, snx*sny*type_size);
-            //memcpy(msg+imageOffset, xrif->raw_buffer, xrif->compressed_size);
-            
-            if(m_timeToDie || m_restart) break; //Check for exit signals
-            
-            if( rids.size() > 0 )
-            {
-               for(size_t rid = 0; rid < rids.size(); ++rid)
-               {
-                  zmq::message_t frame( msg, headerSize + xrif->compressed_size, nullptr, nullptr);//this version will not copy the data.
-                  frame.set_routing_id(rids[rid]);
-                  try
-                  {
-                     #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
-                     m_server->send(frame, zmq::send_flags::dontwait);
-                     #else
-                     m_server->send(frame, ZMQ_DONTWAIT);
-                     #endif
-                  
-                     std::lock_guard<std::mutex> guard(m_mapMutex);
-                     m_requestorMap[rids[rid]][imageName] = false;
-                  }
-                  catch(...)
-                  {
-                     //Assume this means the client is no longer connected
-                     std::lock_guard<std::mutex> guard(m_mapMutex);
-                     m_requestorMap.erase(rids[rid]);
-                  }
-               }
-            }            
-            
-            
-            double ct = get_curr_time();
-            
-            //An integrator controller to keep frame rate on target
-            delta += m_fpsGain * (ct-lastSend - 1.0/m_fpsTgt);
-            lastSend = ct;
-            lastCnt0 = cnt0;
-            
-         }
-         else
-         {
-            if(image.md[0].sem <= 0) break; //Indicates that the server has cleaned up.
-            
-            struct stat statbuff;
-            int rv = stat(SM_fname, &statbuff);
+         if(pub.m_semIndex < 0) milkzmq::microsleep(m_usecSleep);
+      }
 
-            if(rv != 0)
-            {
-                char serr[512];
-                if(strerror_r(errno, serr, sizeof(serr)) ) 
-                {
-                    static_cast<void>(errno); //not error checking b/c the GNU vs XSI thing makes it impossible to understand what to do.
-                }
-
-                reportError("Error stat-ing ImageStream " + imageName + ": " + serr, __FILE__, __LINE__);  
-                break; 
-            }
+      publisherClose(pub);
+   }
+   
+   publisherHangup(pub);
+   publisherFree(pub);
+   
+} // milkzmqServer::imageThreadExec()
 
-            if(statbuff.st_ino != inode)
-            {
-               std::cerr << "inode changed " << statbuff.st_ino << " " << inode << "\n";
-               break;
-            }
+inline
+void milkzmqServer::internal_watcherThreadStart( s_watcherThread * wt )
+{
+   wt->m_mzs->watcherThreadExec(wt);
+}
 
-            milkzmq::microsleep(m_usecSleep);
-            
-            //If delay is long, we reset the loop b/c we aren't doing any good anyway, and this prevents over shoot on a reconnect
-            if(get_curr_time() - lastSend > 2*1.0/m_fpsTgt)
-            {
-               delta = 0;
-               lastSend = get_curr_time() - 2*1.0/m_fpsTgt;
-            }
-         }
+inline
+int milkzmqServer::watcherThreadsStart()
+{
+   if(m_watcherThreads.size() > 0) return 0;
+   
+   for(int n = 0; n < m_numWatchers; ++n)
+   {
+      s_watcherThread * wt = new s_watcherThread;
+      wt->m_mzs = this;
+      wt->m_wno = n;
+      m_watcherThreads.push_back(wt);
+      
+      try
+      {
+         wt->m_thread = std::thread( internal_watcherThreadStart, wt);
       }
-
-      if(opened) 
+      catch( const std::exception & e )
       {
-         ImageStreamIO_closeIm(&image);
-         opened = false;
-      } 
+         reportError(std::string("exception in watcher thread startup: ") +e.what(), __FILE__, __LINE__);
+         return -1;
+      }
+      catch( ... )
+      {
+         reportError("unknown exception in watcher thread startup", __FILE__, __LINE__);
+         return -1;
+      }
+      
+      if(!wt->m_thread.joinable())
+      {
+         reportError("watcher thread did not start", __FILE__, __LINE__);
+         return -1;
+      }
    }
    
-   //-------- Send a 0 message to tell the other side to hangup...
-   std::vector<routing_id_t> rids;
-   //Scope for map mutex
-   {
-      std::lock_guard<std::mutex> guard(m_mapMutex);
+   return 0;
+}
 
-      std::unordered_map<routing_id_t, imageReceivedFlagMap_t>::iterator it = m_requestorMap.begin();
-            
-      while(it != m_requestorMap.end())
+inline
+void milkzmqServer::watcherThreadExec( s_watcherThread * wt )
+{
+   while(!m_serving)
+   {
+      milkzmq::sleep(1);
+   }
+   
+   std::vector<s_imagePublisher *> pubs;
+   
+   while(!m_timeToDie)
+   {
+      //-------- Pick up any streams assigned to us since the last scan.
+      //Scope for mutex
       {
-         if( it->second.count(imageName) > 0 )
+         std::lock_guard<std::mutex> guard(wt->m_mutex);
+         
+         for(size_t n = 0; n < wt->m_newStreams.size(); ++n)
          {
-            if(it->second[imageName] == true)
+            s_imagePublisher * pub = new s_imagePublisher;
+            if(publisherInit(*pub, wt->m_newStreams[n]) < 0)
             {
-               rids.push_back(it->first);
+               delete pub;
+               continue;
             }
+            pubs.push_back(pub);
          }
-         ++it;
+         wt->m_newStreams.clear();
       }
-   }
-   if( rids.size() > 0 )
-   {
-      char zero = '\0';
       
-      for(size_t rid = 0; rid < rids.size(); ++rid)
+      //-------- Scan the shard
+      bool sent = false;
+      int64_t currtime = get_mono_nsec();
+      
+      for(size_t n = 0; n < pubs.size() && !m_timeToDie; ++n)
       {
-         zmq::message_t frame( &zero, sizeof(char), nullptr, nullptr);
-         frame.set_routing_id(rids[rid]);
-         try
+         s_imagePublisher & pub = *pubs[n];
+         
+         //A restart since the stream was opened means its mapping may be stale.
+         if(pub.m_opened && m_restartCount.load(std::memory_order_relaxed) != pub.m_restartCount) publisherClose(pub);
+         
+         if(!pub.m_opened)
          {
-            #if(CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 1))
-            m_server->send(frame, zmq::send_flags::dontwait);
-            #else
-            m_server->send(frame, ZMQ_DONTWAIT);
-            #endif
+            if(currtime - pub.m_lastOpenTry < 1000000000) continue; //be patient
+            pub.m_lastOpenTry = currtime;
+            
+            if(publisherOpen(pub) < 0) continue;
+         }
          
-            std::lock_guard<std::mutex> guard(m_mapMutex);
-            m_requestorMap[rids[rid]][imageName] = false;
+         int rv = publisherUpdate(pub);
+         
+         if(rv < 0)
+         {
+            publisherClose(pub);
+            continue;
          }
-         catch(...)
+         
+         if(rv == 2) sent = true;
+         
+         //The liveness checks are too expensive to do on every scan.
+         if(rv == 0 && currtime - pub.m_lastLiveCheck > 1000LL*m_semTimeout)
          {
-            //Assume this means the client is no longer connected
-            std::lock_guard<std::mutex> guard(m_mapMutex);
-            m_requestorMap.erase(rids[rid]);
+            if(publisherCheck(pub) < 0) publisherClose(pub);
          }
       }
-   }            
-   
-   
+      
+      if(!sent) milkzmq::microsleep(m_usecSleep);
+   }
    
-   //One more check
-   if(opened) ImageStreamIO_closeIm(&image);
-   if(msg) free(msg);
-   if(xrif != nullptr) xrif_delete(xrif);
+   for(size_t n = 0; n < pubs.size(); ++n)
+   {
+      publisherHangup(*pubs[n]);
+      publisherFree(*pubs[n]);
+      delete pubs[n];
+   }
    
-} // milkzmqServer::imageThreadExec()
+} // milkzmqServer::watcherThreadExec()
 
 inline 
 void milkzmqServer::reportInfo( const std::string & msg )
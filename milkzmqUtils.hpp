@@ -60,12 +60,88 @@ constexpr size_t xrifDifferenceOffset = tv_nsecOffset + sizeof(uint64_t); ///< T
 constexpr size_t xrifReorderOffset = xrifDifferenceOffset + sizeof(int16_t);                  ///< The XRIF encoding reordering method.
 constexpr size_t xrifCompressOffset = xrifReorderOffset + sizeof(int16_t);                 ///< The XRIF encoding compression method.
 constexpr size_t xrifSizeOffset =  xrifCompressOffset + sizeof(int16_t);                    ///< The size of the compressed data.
+constexpr size_t frameFlagsOffset = xrifSizeOffset + sizeof(uint32_t);   ///< Flags describing the frame, see frameFlagDelta.
+constexpr size_t seqOffset = frameFlagsOffset + sizeof(uint8_t);         ///< The server's sequence number of this frame (uint64_t), 0 if unknown.
+constexpr size_t refSeqOffset = seqOffset + sizeof(uint64_t);            ///< For a delta frame, the sequence number of the frame it is relative to (uint64_t).
+constexpr size_t nframesOffset = refSeqOffset + sizeof(uint64_t);        ///< For a burst, the number of frames (uint32_t).
+constexpr size_t naxisOffset = nframesOffset + sizeof(uint32_t);          ///< The number of axes of the source stream (uint8_t), 3 for a circular buffer.
+constexpr size_t size2Offset = naxisOffset + sizeof(uint8_t);             ///< The number of slices of the source stream (uint32_t), 0 if 2D.
+constexpr size_t roiX0Offset = size2Offset + sizeof(uint32_t);            ///< For a region of interest, its first column in the source stream (uint32_t).
+constexpr size_t roiY0Offset = roiX0Offset + sizeof(uint32_t);            ///< For a region of interest, its first row in the source stream (uint32_t).
+constexpr size_t binOffset = roiY0Offset + sizeof(uint32_t);              ///< For a region of interest, the binning factor (uint8_t), 0 or 1 if not binned.
+constexpr size_t binMeanOffset = binOffset + sizeof(uint8_t);             ///< For a region of interest, 1 if each bin is the mean, 0 if the sum (uint8_t).
+constexpr size_t convertOffset = binMeanOffset + sizeof(uint8_t);         ///< The conversion to a 16 bit type (uint8_t), see convertInt16.  The data type field is the type before conversion.
+constexpr size_t convertScaleOffset = convertOffset + sizeof(uint8_t);    ///< For convertInt16, the scale (double).
+constexpr size_t convertZeroOffset = convertScaleOffset + sizeof(double); ///< For convertInt16, the zero (double).
+constexpr size_t redirectPortOffset = convertZeroOffset + sizeof(double); ///< For a redirect to a tcp endpoint, the port the stream is served on (uint32_t), otherwise 0.
 
-constexpr size_t endOfHeader = xrifSizeOffset + sizeof(uint16_t);         ///< The current end of the header.
+constexpr size_t endOfHeader = redirectPortOffset + sizeof(uint32_t);       ///< The current end of the header.
 constexpr size_t imageOffset = headerSize;
       
 static_assert(endOfHeader <= imageOffset, "Header fields sum to larger than reserved headerSize");
 
+constexpr uint8_t frameFlagDelta = 0x01; ///< The frame is the difference from the frame with sequence number refSeq, see frameDelta.
+constexpr uint8_t frameFlagBurst = 0x02; ///< The message holds nframes frames of a circular buffer, oldest first, the last with cnt0.
+constexpr uint8_t frameFlagBatch = 0x04; ///< The message holds nframes consecutive frames encoded together as a cube, see below.
+constexpr uint8_t frameFlagRoi = 0x08;   ///< The frame is the region of interest starting at roiX0, roiY0, binned by bin to size0 x size1.
+constexpr uint8_t frameFlagRedirect = 0x10; ///< The stream is served elsewhere, so ask there.  The header is followed by the URI, and for tcp redirectPort is its port.
+
+//A batch payload is a table of nframes x {cnt0, tv_sec, tv_nsec} (uint64_t), followed by the nframes frames encoded as one cube.
+//For xrif the cube is nframes frames deep.  For byte-shuffle with XRIF_DIFFERENCE_PREVIOUS, each frame after the first is
+//the frameDelta from the one before it.
+
+//A burst payload is nframes slices, each a burst slice header followed by the encoded frame:
+/*
+ *  0-3      size of the encoded frame (uint32_t)
+ *  4-5      compress method of this frame (int16_t), which can differ from the message's for byte-shuffle
+ *  6-7      reserved
+ *  8-15     cnt0 of this frame (uint64_t), 0 if unknown
+ *  16-23    writetime tv_sec of this frame (uint64_t), 0 with tv_nsec if unknown, when the message's is used
+ *  24-31    writetime tv_nsec of this frame (uint64_t)
+ */
+constexpr size_t burstSliceHeaderSize = 32;  ///< The size of the header of each frame in a burst.
+constexpr size_t burstSliceCnt0Offset = 8;   ///< Start of the cnt0 field of a burst slice header.
+constexpr size_t burstSliceSecOffset = 16;   ///< Start of the tv_sec field of a burst slice header.
+constexpr size_t burstSliceNsecOffset = 24;  ///< Start of the tv_nsec field of a burst slice header.
+
+//The milkzmq request format:
+/*
+ *  0-127    image stream name, NUL terminated so that servers which only read the name still work.
+ *  128-131  max fps requested by the client (float), <= 0 means the server's rate.
+ *  132      request flags (uint8_t), see reqFlagDelta, reqFlagKeyframe, and reqFlagBurst.
+ *  133-148  region of interest x0, y0, width, height (uint32_t).  A width or height of 0 means the full frame.
+ *  149      binning factor (uint8_t), 0 or 1 for none.  Sums, unless reqFlagBinMean is set, are sent widened, see binnedType.
+ *  150      conversion of floating point frames to a 16 bit type (uint8_t), see convertInt16.
+ *  151-152  credits granted by this request (uint16_t), the number of further frames the server may send.  0 means 1.
+ *  153-154  credit window (uint16_t), the most credits the client holds out at once.  0 means 1, one frame per request.
+ * 
+ * A request shorter than requestSize is just the name, without the NUL, and uses the defaults for the rest.
+ */
+constexpr size_t requestSize = 256; ///< total size in bytes of a request,  gives room to grow!
+
+constexpr size_t reqFpsOffset = nameSize;                    ///< Start of the requested fps field.
+
+constexpr size_t reqFlagsOffset = reqFpsOffset + sizeof(float); ///< Start of the request flags field.
+
+constexpr size_t reqRoiOffset = reqFlagsOffset + sizeof(uint8_t); ///< Start of the region of interest field, 4 x uint32_t.
+
+constexpr size_t reqBinOffset = reqRoiOffset + 4*sizeof(uint32_t); ///< Start of the binning factor field.
+
+constexpr size_t reqConvertOffset = reqBinOffset + sizeof(uint8_t); ///< Start of the conversion field.
+
+constexpr size_t reqCreditOffset = reqConvertOffset + sizeof(uint8_t); ///< Start of the credits granted field.
+
+constexpr size_t reqWindowOffset = reqCreditOffset + sizeof(uint16_t); ///< Start of the credit window field.
+
+constexpr size_t endOfRequest = reqWindowOffset + sizeof(uint16_t); ///< The current end of the request.
+
+constexpr uint8_t reqFlagDelta = 0x01;    ///< The client can reconstruct delta frames.
+constexpr uint8_t reqFlagKeyframe = 0x02; ///< The client could not apply a delta frame, and needs a keyframe.
+constexpr uint8_t reqFlagBurst = 0x04;    ///< The client wants every frame of a circular buffer written since the last one it was sent.
+constexpr uint8_t reqFlagBinMean = 0x08;  ///< The client wants the mean of each bin rather than the sum.
+
+static_assert(endOfRequest <= requestSize, "Request fields sum to larger than reserved requestSize");
+
 /// Sleep for a specified period in seconds.
 inline
 void sleep( unsigned sec /**< [in] the number of seconds to sleep. */)
@@ -93,6 +169,45 @@ double get_curr_time()
    return ((double)tsp.tv_sec) + ((double)tsp.tv_nsec)/1e9;
 }
 
+/// Get the current monotonic time, as integer nanoseconds
+/** Uses CLOCK_MONOTONIC, so is not affected by steps in the wall clock.
+  * 
+  * \returns the time since an arbitrary fixed point in nanoseconds.
+  */ 
+inline
+int64_t get_mono_nsec()
+{
+   struct timespec tsp;
+   clock_gettime(CLOCK_MONOTONIC, &tsp);
+
+   return ((int64_t)tsp.tv_sec)*1000000000 + tsp.tv_nsec;
+}
+
+/// Get the current wall clock time, as integer nanoseconds
+/** Uses CLOCK_REALTIME, the clock of the writetime of ImageStreamIO images.
+  * 
+  * \returns the time since the epoch in nanoseconds.
+  */ 
+inline
+int64_t get_real_nsec()
+{
+   struct timespec tsp;
+   clock_gettime(CLOCK_REALTIME, &tsp);
+
+   return ((int64_t)tsp.tv_sec)*1000000000 + tsp.tv_nsec;
+}
+
+/// Sleep until a monotonic time.
+inline
+void mono_sleep_until( int64_t nsec /**< [in] the CLOCK_MONOTONIC time to wake up at, in nanoseconds */)
+{
+   struct timespec tsp;
+   tsp.tv_sec = nsec / 1000000000;
+   tsp.tv_nsec = nsec % 1000000000;
+   
+   while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsp, NULL) == EINTR);
+}
+
 /// Report status (with LOG_INFO level of priority) to the user using stderr.
 inline 
 void reportInfo( const std::string & argv0, ///< [in] the name of the application reporting status
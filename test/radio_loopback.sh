@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# Sends a test stream from milkzmqServer to milkzmqClient in RADIO/DISH mode over loopback, and checks that the
+# client receives it.  Run from the directory where milkzmqServer, milkzmqClient and ims3_rand_send were built:
+#
+#   sh test/radio_loopback.sh [udp port]
+#
+# This needs libzmq built with the draft API.  Exits 0 if frames arrived, 1 if not.
+
+PORT=${1:-5600}
+SHM_DIR=${MILK_SHM_DIR:-/tmp}
+WAIT=5
+
+LOGS=$(mktemp -d)
+
+cleanup()
+{
+   kill $CLIENT $SERVER $SOURCE 2>/dev/null
+   wait 2>/dev/null
+   if [ -n "$NAME" ]; then rm -f "$SHM_DIR/$NAME.im.shm" "$SHM_DIR/${NAME}_radio.im.shm"; fi
+}
+trap cleanup EXIT
+
+# A 32x32 float stream with a random name, written at 1 Hz.  It only prints the name if built with std::format, so
+# it is found as the stream which appears.
+ls "$SHM_DIR" > "$LOGS/before"
+./ims3_rand_send > "$LOGS/source.log" 2>&1 &
+SOURCE=$!
+
+NAME=
+for i in 1 2 3 4 5 6 7 8 9 10; do
+   NAME=$(ls "$SHM_DIR" | grep '\.im\.shm$' | grep -vxF -f "$LOGS/before" | head -n 1 | sed 's/\.im\.shm$//')
+   if [ -n "$NAME" ]; then break; fi
+   sleep 0.5
+done
+
+if [ -z "$NAME" ]; then
+   echo "radio_loopback: ims3_rand_send did not create its stream in $SHM_DIR" >&2
+   exit 1
+fi
+
+# The server's own socket is on a spare port, so this does not disturb a server already running.
+./milkzmqServer -p $((PORT+1)) -U "udp://127.0.0.1:$PORT" "$NAME" > "$LOGS/server.log" 2>&1 &
+SERVER=$!
+
+./milkzmqClient -U "udp://*:$PORT" localhost "$NAME/${NAME}_radio" > "$LOGS/client.log" 2>&1 &
+CLIENT=$!
+
+sleep $WAIT
+
+if grep -q "Connected to $NAME" "$LOGS/client.log" && [ -e "$SHM_DIR/${NAME}_radio.im.shm" ]; then
+   echo "radio_loopback: $NAME received over udp://127.0.0.1:$PORT"
+   rm -rf "$LOGS"
+   exit 0
+fi
+
+echo "radio_loopback: no frames of $NAME received in $WAIT s, logs are in $LOGS" >&2
+echo "--- server" >&2
+cat "$LOGS/server.log" >&2
+echo "--- client" >&2
+cat "$LOGS/client.log" >&2
+exit 1